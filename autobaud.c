@@ -0,0 +1,153 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "autobaud.h"
+#include "dbg.h"
+#include "string_functions.h"
+#include "ttysocket.h"
+
+// standard speeds to check
+static const int stdspeeds[] = {1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400, 460800,
+                                500000, 576000, 921600, 1000000, 1500000, 2000000, 3000000, 0};
+// max amount of speeds to check
+#define MAXSPEEDS       (64)
+// minimal time to listen on each speed, ms
+#define MINDWELL        (50)
+// minimal amount of bytes to make any decision
+#define MINBYTES        (4)
+// bonus for expected pattern
+#define MATCHBONUS      (2.)
+
+typedef struct{
+    int speed;      // baudrate
+    size_t nbytes;  // bytes received
+    double score;   // resulting score
+} abresult;
+
+static int cmpint(const void *a, const void *b){
+    return *(const int*)a - *(const int*)b;
+}
+
+// fill `speeds` by standard and extra speeds (sorted, without repeats); return amount
+static int getspeeds(const char *extra, int *speeds){
+    int n = 0;
+    for(const int *s = stdspeeds; *s; ++s) speeds[n++] = *s;
+    if(extra){
+        char *str = strdup(extra), *saveptr = NULL;
+        for(char *tok = strtok_r(str, ",", &saveptr); tok && n < MAXSPEEDS; tok = strtok_r(NULL, ",", &saveptr)){
+            int s = atoi(tok);
+            if(s > 0) speeds[n++] = s;
+            else WARNX(_("Wrong speed: %s"), tok);
+        }
+        FREE(str);
+    }
+    qsort(speeds, n, sizeof(int), cmpint);
+    int m = 0;
+    for(int i = 0; i < n; ++i)
+        if(m == 0 || speeds[m-1] != speeds[i]) speeds[m++] = speeds[i];
+    return m;
+}
+
+/**
+ * @brief tryspeed - listen on given speed and calculate score
+ * @param r (io) - result (speed should be set)
+ * @param pars - parameters
+ * @param dwell - time to listen, ms
+ * @return TRUE if expected pattern found
+ */
+static int tryspeed(abresult *r, const autobaud_pars *pars, int dwell){
+    if(!SetSpeed(r->speed)) return FALSE;
+    devstat_t s0, s1;
+    GetDevStat(&s0);
+    if(pars->probe) SendData(pars->probe, pars->probelen);
+    strmatch_t *m = strmatch_new(pars->expect, pars->expectlen);
+    uint8_t buf[BUFSIZ];
+    size_t nprint = 0;
+    int found = FALSE;
+    double tend = dtime() + dwell / 1000.;
+    while(!found){
+        int rest = (int)((tend - dtime()) * 1000.);
+        if(rest < 1) break;
+        int l = ReadRaw(buf, sizeof(buf), rest);
+        if(l < 0) break;
+        for(int i = 0; i < l; ++i){
+            uint8_t c = buf[i];
+            if((c > 31 && c < 127) || c == '\n' || c == '\r' || c == '\t') ++nprint;
+        }
+        r->nbytes += l;
+        if(m && strmatch_feed(m, buf, l)) found = TRUE;
+    }
+    strmatch_free(&m);
+    GetDevStat(&s1);
+    int errs = (s1.frame - s0.frame) + (s1.parity - s0.parity) + (s1.brk - s0.brk);
+    r->score = 0.;
+    if(r->nbytes >= MINBYTES || found){
+        double n = (double)r->nbytes;
+        double err = (n > 0.) ? errs / n : 1.;
+        if(err > 1.) err = 1.;
+        r->score = ((n > 0.) ? nprint / n : 0.) - err;
+        if(found) r->score += MATCHBONUS;
+    }
+    DBG("speed %d: %zd bytes, %zd printable, %d errors, score=%g%s", r->speed, r->nbytes, nprint, errs, r->score, found ? " (found)" : "");
+    return found;
+}
+
+/**
+ * @brief Autobaud - find speed of device by checking all standard and given speeds
+ * @param pars - parameters
+ * @param curspeed - current speed (would be restored if nothing found)
+ * @return found speed or 0 if nothing found
+ */
+int Autobaud(const autobaud_pars *pars, int curspeed){
+    if(!pars || !ClaimDevice()) return 0;
+    int speeds[MAXSPEEDS + sizeof(stdspeeds)/sizeof(int)];
+    int N = getspeeds(pars->extra, speeds);
+    devstat_t st;
+    GetDevStat(&st);
+    if(!st.hwcounters) WARNX(_("UART error counters aren't available, use only data analysis"));
+    int dwell = pars->budget / N;
+    if(dwell < MINDWELL) dwell = MINDWELL;
+    abresult *res = MALLOC(abresult, N);
+    int best = -1;
+    double tend = dtime() + pars->budget / 1000.;
+    for(int i = 0; i < N; ++i){
+        if(dtime() > tend){
+            WARNX(_("Autobaud: time is over, checked %d speeds of %d"), i, N);
+            break;
+        }
+        res[i].speed = speeds[i];
+        int found = tryspeed(&res[i], pars, dwell);
+        green("%8d: %6zd bytes, score %.2f\n", res[i].speed, res[i].nbytes, res[i].score);
+        if(res[i].score > 0. && (best < 0 || res[i].score > res[best].score)) best = i;
+        if(found && res[i].score > MATCHBONUS + 0.9) break; // good enough
+    }
+    int speed = 0;
+    if(best > -1){
+        speed = res[best].speed;
+        SetSpeed(speed);
+    }else{
+        WARNX(_("Autobaud: can't detect speed"));
+        SetSpeed(curspeed);
+    }
+    ReleaseDevice();
+    FREE(res);
+    return speed;
+}
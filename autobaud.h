@@ -0,0 +1,37 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef AUTOBAUD_H__
+#define AUTOBAUD_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct{
+    const char *extra;      // comma-separated list of additional speeds (or NULL)
+    uint8_t *probe;         // data to send on each speed (or NULL)
+    size_t probelen;        // its length
+    uint8_t *expect;        // expected answer (or NULL)
+    size_t expectlen;       // its length
+    int budget;             // time budget, ms
+} autobaud_pars;
+
+int Autobaud(const autobaud_pars *pars, int curspeed);
+
+#endif // AUTOBAUD_H__
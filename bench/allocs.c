@@ -0,0 +1,48 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Counter of heap allocations for benchmarks: ttybench is linked with `-Wl,--wrap=malloc` (and
+ * calloc, realloc), so all calls of them from tty_term code come here; allocations inside system
+ * libraries aren't counted.
+ */
+
+#include <stddef.h>
+
+#include "allocs.h"
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+size_t nallocs = 0;
+
+void *__wrap_malloc(size_t size){
+    ++nallocs;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size){
+    ++nallocs;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size){
+    ++nallocs;
+    return __real_realloc(ptr, size);
+}
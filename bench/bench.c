@@ -0,0 +1,272 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Micro-benchmarks of hot paths: input conversion (`convert_line` and Modbus framing, nothing
+ * is sent) and formatting of received data (`FormatChunks`, `AddData`) without screen.
+ * Usage: ttybench [substring of benchmark name]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "allocs.h"
+#include "modbus.h"
+#include "ncurses_and_readline.h"
+#include "string_functions.h"
+#include "timestamps.h"
+
+#define WARMUP      (5)     // amount of untimed runs
+#define FMTSIZE     (65536) // size of data portion for formatting benchmarks
+#define CHUNKSIZE   (4096)  // size of data portion in long session
+// size of view
+#define BCOLS       (120)
+#define BROWS       (48)
+
+void signals(int signo){
+    exit(signo);
+}
+
+typedef struct{
+    const char *name;           // name of benchmark
+    void (*prep)(void *arg);    // untimed preparation before each run (or NULL)
+    void (*run)(void *arg);     // timed operation
+    void *arg;                  // its argument
+    size_t bytes;               // amount of data processed by one operation
+    int reps;                   // amount of timed runs
+} bench_t;
+
+static const char *namefilter = NULL;
+
+static int64_t nsnow(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static int cmpi64(const void *a, const void *b){
+    int64_t x = *(const int64_t*)a, y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief bench - run benchmark and print median and 99th percentile of operation time, speed and
+ *          amount of heap allocations per operation
+ * @param b - benchmark
+ */
+static void bench(const bench_t *b){
+    if(namefilter && !strstr(b->name, namefilter)) return;
+    for(int i = 0; i < WARMUP; ++i){
+        if(b->prep) b->prep(b->arg);
+        b->run(b->arg);
+    }
+    int64_t *t = MALLOC(int64_t, b->reps);
+    size_t allocs = 0;
+    for(int i = 0; i < b->reps; ++i){
+        if(b->prep) b->prep(b->arg);
+        size_t n0 = nallocs;
+        int64_t t0 = nsnow();
+        b->run(b->arg);
+        t[i] = nsnow() - t0;
+        allocs += nallocs - n0;
+    }
+    qsort(t, b->reps, sizeof(int64_t), cmpi64);
+    double med = t[b->reps / 2] / 1e3, p99 = t[(b->reps - 1) * 99 / 100] / 1e3;
+    printf("%-28s %8zd %10.2f %10.2f %9.1f %9.2f\n", b->name, b->bytes, med, p99,
+           med > 0. ? b->bytes / med : 0., (double)allocs / b->reps);
+    FREE(t);
+}
+
+/******************************** input conversion ********************************/
+
+typedef struct{
+    disptype type;
+    char *line;
+} convarg_t;
+
+static void convrun(void *arg){
+    static uint8_t *buf = NULL;
+    static size_t bufsiz = 0;
+    convarg_t *c = (convarg_t*)arg;
+    size_t l = convert_line(c->type, c->line, "\n", NULL, &buf, &bufsiz);
+    if(c->type == DISP_MBASCII) mb_ascii_frame(buf, l);
+    else if(c->type == DISP_MBTCP) mb_tcp_frame(buf, l, 0);
+}
+
+/**
+ * @brief mkinput - make input line for given mode which gives `n` bytes of data
+ * @param type - input mode
+ * @param n - amount of data bytes
+ * @param spaced - in HEX modes separate bytes by spaces
+ * @return allocated line
+ */
+static char *mkinput(disptype type, size_t n, int spaced){
+    char *line = MALLOC(char, 12*n + 1), *ptr = line;
+    for(size_t i = 0; i < n; ++i){
+        uint8_t c = (uint8_t)(i * 37 + 11);
+        switch(type){
+            case DISP_TEXT: // printable symbols with some escapes
+                if(i % 32 == 31) ptr += sprintf(ptr, "\\x%02x", c);
+                else{
+                    char p = 32 + c % 95;
+                    *ptr++ = (p == '\\') ? '/' : p;
+                }
+            break;
+            case DISP_RAW: // all kinds of numbers
+            case DISP_RTURAW:
+                switch(i % 4){
+                    case 0: ptr += sprintf(ptr, "0x%02X ", c); break;
+                    case 1: ptr += sprintf(ptr, "%u ", c ? c : 1); break;
+                    case 2: ptr += sprintf(ptr, "0%o ", c | 1); break;
+                    default:
+                        *ptr++ = '0'; *ptr++ = 'b';
+                        for(int b = 7; b > -1; --b) *ptr++ = '0' + ((c >> b) & 1);
+                        *ptr++ = ' ';
+                    break;
+                }
+            break;
+            default: // HEX
+                ptr += sprintf(ptr, spaced ? "%02X " : "%02X", c);
+            break;
+        }
+    }
+    *ptr = 0;
+    return line;
+}
+
+static void convbenches(){
+    static const struct{ disptype type; int spaced; const char *name; } modes[] = {
+        {DISP_TEXT, 0, "text"}, {DISP_RAW, 0, "raw"}, {DISP_HEX, 1, "hex"}, {DISP_HEX, 0, "hex-solid"},
+        {DISP_RTURAW, 0, "rturaw"}, {DISP_RTUHEX, 1, "rtuhex"}, {DISP_MBASCII, 1, "ascii"}, {DISP_MBTCP, 1, "tcp"}
+    };
+    static const size_t sizes[] = {16, 250, 4096, 65536};
+    char name[64];
+    for(size_t m = 0; m < sizeof(modes)/sizeof(modes[0]); ++m){
+        for(size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); ++s){
+            // Modbus ADU can't be longer than 253 bytes
+            if((modes[m].type == DISP_MBASCII || modes[m].type == DISP_MBTCP) && sizes[s] > MB_MAXADU) continue;
+            convarg_t c = {.type = modes[m].type, .line = mkinput(modes[m].type, sizes[s], modes[m].spaced)};
+            snprintf(name, 64, "convert/%s/%zd", modes[m].name, sizes[s]);
+            bench_t b = {.name = name, .run = convrun, .arg = &c, .bytes = sizes[s],
+                         .reps = sizes[s] > 4096 ? 200 : 2000};
+            bench(&b);
+            FREE(c.line);
+        }
+    }
+}
+
+/*********************************** formatting ***********************************/
+
+typedef enum{
+    DATA_PRINTABLE, // printable text with '\n' each 64 symbols (average)
+    DATA_BINARY,    // random bytes
+    DATA_MIXED,     // 3/4 of printable symbols, lines of different length
+    DATA_LONGLINES, // printable text without '\n'
+    DATA_AMOUNT
+} datakind;
+
+static const char *datanames[DATA_AMOUNT] = {"printable", "binary", "mixed", "longlines"};
+
+typedef struct{
+    disptype type;      // display mode
+    bool utf8;          // UTF-8 terminal
+    const uint8_t *data;
+    size_t len;
+    size_t chunk;       // length of portions (1 - bytewise)
+} fmtarg_t;
+
+static void mkdata(datakind kind, uint8_t *data, size_t len){
+    uint32_t r = 12345;
+    for(size_t i = 0; i < len; ++i){
+        r = r * 1103515245 + 12345;
+        uint8_t c = r >> 16, p = 32 + c % 95;
+        switch(kind){
+            case DATA_PRINTABLE: data[i] = (c % 64) ? p : '\n'; break;
+            case DATA_BINARY: data[i] = c; break;
+            case DATA_MIXED: data[i] = ((r >> 8) % 4) ? p : ((c % 8) ? c : '\n'); break;
+            default: data[i] = p; break;
+        }
+    }
+}
+
+// start formatting from scratch
+static void fmtprep(void *arg){
+    fmtarg_t *f = (fmtarg_t*)arg;
+    FormatReset(f->type, f->utf8, BCOLS, BROWS);
+}
+
+static void fmtrun(void *arg){
+    fmtarg_t *f = (fmtarg_t*)arg;
+    FormatChunks(f->data, f->len, f->chunk);
+}
+
+// long session: add data portions until buffers become large
+static void sessrun(void *arg){
+    fmtarg_t *f = (fmtarg_t*)arg;
+    AddData(f->data, f->len, ts_now());
+}
+
+static void fmtbenches(){
+    static const struct{ disptype type; bool utf8; const char *name; } modes[] = {
+        {DISP_TEXT, false, "text"}, {DISP_TEXT, true, "text-utf8"}, {DISP_RAW, false, "raw"}, {DISP_HEX, false, "hex"}
+    };
+    char name[64];
+    uint8_t *data = MALLOC(uint8_t, FMTSIZE);
+    for(int k = 0; k <= DATA_AMOUNT; ++k){
+        mkdata(k == DATA_AMOUNT ? DATA_MIXED : (datakind)k, data, FMTSIZE);
+        for(size_t m = 0; m < sizeof(modes)/sizeof(modes[0]); ++m){
+            fmtarg_t f = {.type = modes[m].type, .utf8 = modes[m].utf8, .data = data, .len = FMTSIZE,
+                          .chunk = (k == DATA_AMOUNT) ? 1 : FMTSIZE};
+            snprintf(name, 64, "format/%s/%s", modes[m].name, k == DATA_AMOUNT ? "bytewise" : datanames[k]);
+            bench_t b = {.name = name, .prep = fmtprep, .run = fmtrun, .arg = &f, .bytes = FMTSIZE, .reps = 100};
+            bench(&b);
+        }
+    }
+    // growth of raw buffer, formatted buffer and line index in long session
+    mkdata(DATA_MIXED, data, CHUNKSIZE);
+    for(size_t m = 0; m < sizeof(modes)/sizeof(modes[0]); ++m){
+        if(modes[m].utf8) continue;
+        snprintf(name, 64, "session/%s", modes[m].name);
+        if(namefilter && !strstr(name, namefilter)) continue;
+        fmtarg_t f = {.type = modes[m].type, .data = data, .len = CHUNKSIZE};
+        fmtprep(&f);
+        bench_t b = {.name = name, .run = sessrun, .arg = &f, .bytes = CHUNKSIZE, .reps = 8192};
+        bench(&b);
+        size_t bytes, lines, fbufsz, lnarrsz;
+        FormatStat(&bytes, &lines, &fbufsz, &lnarrsz);
+        printf("%-28s %zd bytes -> %zd lines, formatted buffer %zd bytes, line index %zd\n", "",
+               bytes, lines, fbufsz, lnarrsz);
+    }
+    FREE(data);
+}
+
+int main(int argc, char **argv){
+    if(argc > 1){
+        if(argc > 2 || argv[1][0] == '-'){
+            printf("Usage: %s [substring of benchmark name]\n", argv[0]);
+            return 1;
+        }
+        namefilter = argv[1];
+    }
+    printf("%-28s %8s %10s %10s %9s %9s\n", "benchmark", "bytes", "median,us", "p99,us", "MB/s", "allocs");
+    convbenches();
+    fmtbenches();
+    return 0;
+}
@@ -0,0 +1,298 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checksums of sent data and received frames. CRCs are table-driven (slice-by-8: eight bytes per step),
+ * CRC-32 of long buffers is calculated by folding with carry-less multiplication (PCLMULQDQ) if CPU
+ * supports it. Checking of received frames is in `tt_setrxcs()`.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#define HAVE_CLMUL
+#endif
+
+#include "checksum.h"
+#include "dbg.h"
+
+// min length of data for PCLMUL CRC-32
+#define CLMUL_MIN   (64)
+
+typedef struct{
+    const char *name;   // name for `cs_byname`
+    int width;          // width, bits
+    int refl;           // reflected (LSB first)
+    uint32_t poly;      // polynomial (reversed for reflected CRCs), 0 for XOR and sum
+    uint32_t init;      // initial value
+    uint32_t xorout;    // final XOR
+} csdef_t;
+
+static const csdef_t csdefs[CS_AMOUNT] = {
+    [CS_NONE]   = {"none",   0,  0, 0,          0,          0},
+    [CS_CRC8]   = {"crc8",   8,  1, 0x8C,       0,          0},
+    [CS_MODBUS] = {"modbus", 16, 1, 0xA001,     0xFFFF,     0},
+    [CS_CCITT]  = {"ccitt",  16, 0, 0x1021,     0xFFFF,     0},
+    [CS_XMODEM] = {"xmodem", 16, 0, 0x1021,     0,          0},
+    [CS_CRC32]  = {"crc32",  32, 1, 0xEDB88320, 0xFFFFFFFF, 0xFFFFFFFF},
+    [CS_XOR]    = {"xor",    8,  0, 0,          0,          0},
+    [CS_SUM]    = {"sum",    8,  0, 0,          0,          0},
+};
+
+static uint32_t tables[CS_AMOUNT][8][256];
+static pthread_once_t tablesonce = PTHREAD_ONCE_INIT;
+static int have_clmul = FALSE;
+
+// fill slice-by-8 tables: T[k][i] is CRC of byte `i` followed by `k` zero bytes
+static void mktables(){
+    for(int a = 0; a < CS_AMOUNT; ++a){
+        const csdef_t *d = &csdefs[a];
+        if(!d->poly) continue;
+        uint32_t (*T)[256] = tables[a];
+        uint32_t p = d->refl ? d->poly : d->poly << (32 - d->width); // normal CRC is calculated in high bits
+        for(uint32_t i = 0; i < 256; ++i){
+            uint32_t c;
+            if(d->refl){
+                c = i;
+                for(int j = 0; j < 8; ++j) c = (c & 1) ? (c >> 1) ^ p : (c >> 1);
+            }else{
+                c = i << 24;
+                for(int j = 0; j < 8; ++j) c = (c & 0x80000000) ? (c << 1) ^ p : (c << 1);
+            }
+            T[0][i] = c;
+        }
+        for(int k = 1; k < 8; ++k)
+            for(int i = 0; i < 256; ++i){
+                uint32_t c = T[k-1][i];
+                T[k][i] = d->refl ? (c >> 8) ^ T[0][c & 0xff] : (c << 8) ^ T[0][c >> 24];
+            }
+    }
+#ifdef HAVE_CLMUL
+    __builtin_cpu_init();
+    have_clmul = __builtin_cpu_supports("pclmul");
+    DBG("PCLMUL %s", have_clmul ? "supported" : "not supported");
+#endif
+}
+
+// reflected CRC, slice-by-8
+static uint32_t crc_refl(uint32_t (*T)[256], uint32_t crc, const uint8_t *p, size_t len){
+    for(; len >= 8; len -= 8, p += 8){
+        uint32_t lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+        uint32_t hi = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24;
+        crc = T[7][lo & 0xff] ^ T[6][(lo >> 8) & 0xff] ^ T[5][(lo >> 16) & 0xff] ^ T[4][lo >> 24] ^
+              T[3][hi & 0xff] ^ T[2][(hi >> 8) & 0xff] ^ T[1][(hi >> 16) & 0xff] ^ T[0][hi >> 24];
+    }
+    while(len--) crc = (crc >> 8) ^ T[0][(crc ^ *p++) & 0xff];
+    return crc;
+}
+
+// normal (MSB first) CRC in high bits of `crc`, slice-by-8
+static uint32_t crc_norm(uint32_t (*T)[256], uint32_t crc, const uint8_t *p, size_t len){
+    for(; len >= 8; len -= 8, p += 8){
+        uint32_t hi = crc ^ ((uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]);
+        uint32_t lo = (uint32_t)p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7];
+        crc = T[7][hi >> 24] ^ T[6][(hi >> 16) & 0xff] ^ T[5][(hi >> 8) & 0xff] ^ T[4][hi & 0xff] ^
+              T[3][lo >> 24] ^ T[2][(lo >> 16) & 0xff] ^ T[1][(lo >> 8) & 0xff] ^ T[0][lo & 0xff];
+    }
+    while(len--) crc = (crc << 8) ^ T[0][(crc >> 24) ^ *p++];
+    return crc;
+}
+
+#ifdef HAVE_CLMUL
+/*
+ * CRC-32 by folding with carry-less multiplication ("Fast CRC Computation for Generic Polynomials
+ * Using PCLMULQDQ Instruction", Intel, 2009): four 128-bit accumulators are folded by 512 bits,
+ * then into one and reduced to 32 bits by Barrett reduction. `len` >= 64 and multiple of 16,
+ * `crc` - current (not inverted) value.
+ */
+__attribute__((target("pclmul,sse2")))
+static uint32_t crc32_clmul(const uint8_t *p, size_t len, uint32_t crc){
+    // constants in bit-reflected domain: x^(4*128+32), x^(4*128-32), x^(128+32), x^(128-32), x^64 mod P, P and mu
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+    __m128i x1 = _mm_loadu_si128((const __m128i*)(p + 0x00));
+    __m128i x2 = _mm_loadu_si128((const __m128i*)(p + 0x10));
+    __m128i x3 = _mm_loadu_si128((const __m128i*)(p + 0x20));
+    __m128i x4 = _mm_loadu_si128((const __m128i*)(p + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    p += 64; len -= 64;
+#define FOLD(x, k, y) do{ __m128i t_ = _mm_clmulepi64_si128(x, k, 0x00); \
+        x = _mm_clmulepi64_si128(x, k, 0x11); x = _mm_xor_si128(_mm_xor_si128(x, t_), y); }while(0)
+    for(; len >= 64; p += 64, len -= 64){
+        FOLD(x1, k1k2, _mm_loadu_si128((const __m128i*)(p + 0x00)));
+        FOLD(x2, k1k2, _mm_loadu_si128((const __m128i*)(p + 0x10)));
+        FOLD(x3, k1k2, _mm_loadu_si128((const __m128i*)(p + 0x20)));
+        FOLD(x4, k1k2, _mm_loadu_si128((const __m128i*)(p + 0x30)));
+    }
+    FOLD(x1, k3k4, x2);
+    FOLD(x1, k3k4, x3);
+    FOLD(x1, k3k4, x4);
+    for(; len >= 16; p += 16, len -= 16) FOLD(x1, k3k4, _mm_loadu_si128((const __m128i*)p));
+#undef FOLD
+    // 128 -> 64 bits
+    __m128i x2t = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2t);
+    x2t = _mm_srli_si128(x1, 4);
+    x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2t);
+    // Barrett reduction to 32 bits
+    x2t = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), poly, 0x10);
+    x2t = _mm_clmulepi64_si128(_mm_and_si128(x2t, mask32), poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2t);
+    return (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+#endif
+
+/**
+ * @brief cs_byname - get algorithm by name
+ * @param name - "none", "crc8", "modbus", "ccitt", "xmodem", "crc32", "xor" or "sum"
+ * @return algorithm or CS_AMOUNT if name is wrong
+ */
+csalgo cs_byname(const char *name){
+    if(!name) return CS_AMOUNT;
+    for(int i = 0; i < CS_AMOUNT; ++i)
+        if(0 == strcasecmp(csdefs[i].name, name)) return (csalgo)i;
+    return CS_AMOUNT;
+}
+
+const char *cs_name(csalgo algo){
+    if(algo < CS_NONE || algo >= CS_AMOUNT) return "?";
+    return csdefs[algo].name;
+}
+
+// size of checksum, bytes
+size_t cs_size(csalgo algo){
+    if(algo < CS_NONE || algo >= CS_AMOUNT) return 0;
+    return csdefs[algo].width / 8;
+}
+
+/**
+ * @brief cs_parse - parse checksum specification `algo[:le|be][:head[:tail]]`
+ * @param spec - specification (e.g. "crc32", "ccitt:be", "xor:le:1:1")
+ * @param p (o) - parameters
+ * @return FALSE if wrong
+ */
+int cs_parse(const char *spec, cspars_t *p){
+    if(!spec || !p) return FALSE;
+    cspars_t r = {0};
+    char *str = strdup(spec), *saveptr = NULL, *tok = strtok_r(str, ":", &saveptr);
+    int ok = FALSE;
+    if(!tok || (r.algo = cs_byname(tok)) == CS_AMOUNT) goto ret;
+    tok = strtok_r(NULL, ":", &saveptr);
+    if(tok && (0 == strcasecmp(tok, "be") || 0 == strcasecmp(tok, "le"))){
+        r.bigendian = (0 == strcasecmp(tok, "be"));
+        tok = strtok_r(NULL, ":", &saveptr);
+    }
+    for(int i = 0; tok && i < 2; ++i, tok = strtok_r(NULL, ":", &saveptr)){
+        char *eptr;
+        long l = strtol(tok, &eptr, 0);
+        if(eptr == tok || *eptr || l < 0) goto ret;
+        if(i == 0) r.skiphead = l;
+        else r.skiptail = l;
+    }
+    if(tok) goto ret;
+    *p = r;
+    ok = TRUE;
+ret:
+    FREE(str);
+    return ok;
+}
+
+/**
+ * @brief cs_calc - calculate checksum
+ * @param algo - algorithm
+ * @param data - data
+ * @param len - its length
+ * @return checksum value
+ */
+uint32_t cs_calc(csalgo algo, const uint8_t *data, size_t len){
+    if(algo <= CS_NONE || algo >= CS_AMOUNT || !data) return 0;
+    if(algo == CS_XOR || algo == CS_SUM){
+        uint8_t s = 0;
+        if(algo == CS_XOR) for(size_t i = 0; i < len; ++i) s ^= data[i];
+        else for(size_t i = 0; i < len; ++i) s += data[i];
+        return s;
+    }
+    pthread_once(&tablesonce, mktables);
+    const csdef_t *d = &csdefs[algo];
+    if(d->refl){
+        uint32_t crc = d->init;
+#ifdef HAVE_CLMUL
+        if(algo == CS_CRC32 && have_clmul && len >= CLMUL_MIN){
+            size_t n = len & ~(size_t)15;
+            crc = crc32_clmul(data, n, crc);
+            data += n;
+            len -= n;
+        }
+#endif
+        return crc_refl(tables[algo], crc, data, len) ^ d->xorout;
+    }
+    int sh = 32 - d->width;
+    return (crc_norm(tables[algo], d->init << sh, data, len) >> sh) ^ d->xorout;
+}
+
+// put `n` bytes of checksum into `buf`
+static void putcs(uint8_t *buf, uint32_t cs, size_t n, int bigendian){
+    for(size_t i = 0; i < n; ++i)
+        buf[bigendian ? n - 1 - i : i] = (uint8_t)(cs >> (8*i));
+}
+
+// calculate checksum of span: data[skiphead .. len - skiptail)
+static uint32_t spancs(const cspars_t *p, const uint8_t *data, size_t len){
+    if(len < p->skiphead + p->skiptail) return cs_calc(p->algo, data, 0);
+    return cs_calc(p->algo, data + p->skiphead, len - p->skiphead - p->skiptail);
+}
+
+/**
+ * @brief cs_append - add checksum to the end of data
+ * @param p - parameters
+ * @param buf - data (should have place for 4 bytes more)
+ * @param len - its length
+ * @return amount of bytes added
+ */
+size_t cs_append(const cspars_t *p, uint8_t *buf, size_t len){
+    if(!p || !buf || p->algo <= CS_NONE || p->algo >= CS_AMOUNT) return 0;
+    size_t n = cs_size(p->algo);
+    putcs(buf + len, spancs(p, buf, len), n, p->bigendian);
+    return n;
+}
+
+/**
+ * @brief cs_check - check frame with checksum at the end
+ * @param p - parameters
+ * @param frame - frame
+ * @param len - its length
+ * @return TRUE if checksum is right
+ */
+int cs_check(const cspars_t *p, const uint8_t *frame, size_t len){
+    if(!p || !frame || p->algo <= CS_NONE || p->algo >= CS_AMOUNT) return FALSE;
+    size_t n = cs_size(p->algo);
+    if(len < n + p->skiphead + p->skiptail) return FALSE;
+    len -= n;
+    uint8_t cs[4];
+    if(n > sizeof(cs)) return FALSE;
+    putcs(cs, spancs(p, frame, len), n, p->bigendian);
+    return (0 == memcmp(cs, frame + len, n));
+}
@@ -0,0 +1,53 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef CHECKSUM_H__
+#define CHECKSUM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum{
+    CS_NONE,        // no checksum
+    CS_CRC8,        // CRC-8/MAXIM (Dallas 1-Wire)
+    CS_MODBUS,      // CRC-16/MODBUS
+    CS_CCITT,       // CRC-16/CCITT-FALSE
+    CS_XMODEM,      // CRC-16/XMODEM
+    CS_CRC32,       // CRC-32 (Ethernet, zlib)
+    CS_XOR,         // XOR of all bytes
+    CS_SUM,         // 8-bit sum of all bytes
+    CS_AMOUNT
+} csalgo;
+
+typedef struct{
+    csalgo algo;        // algorithm
+    int bigendian;      // order of checksum bytes (default - little-endian)
+    size_t skiphead;    // amount of first bytes which aren't covered by checksum
+    size_t skiptail;    // amount of last bytes (before checksum) which aren't covered
+} cspars_t;
+
+csalgo cs_byname(const char *name);
+const char *cs_name(csalgo algo);
+size_t cs_size(csalgo algo);
+int cs_parse(const char *spec, cspars_t *p);
+uint32_t cs_calc(csalgo algo, const uint8_t *data, size_t len);
+size_t cs_append(const cspars_t *p, uint8_t *buf, size_t len);
+int cs_check(const cspars_t *p, const uint8_t *frame, size_t len);
+
+#endif // CHECKSUM_H__
@@ -0,0 +1,119 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Queue of data portions between reading thread and main loop: writer never waits for reader
+ * (data is lost if queue is full), reader swaps queue with spare buffer and processes it unlocked.
+ */
+
+#include <pthread.h>
+#include <string.h>
+
+#include "chunkqueue.h"
+#include "dbg.h"
+
+struct chunkqueue{
+    uint8_t *buf;           // current queue
+    uint8_t *spare;         // buffer to swap with `buf`
+    size_t size;            // size of buffers
+    size_t len;             // data length in `buf`
+    size_t lost;            // amount of bytes lost due to overflow
+    pthread_mutex_t mutex;
+};
+
+/**
+ * @brief cq_new - create new queue
+ * @param size - max size of data in queue (including headers)
+ * @return queue
+ */
+chunkqueue_t *cq_new(size_t size){
+    chunkqueue_t *q = MALLOC(chunkqueue_t, 1);
+    q->buf = MALLOC(uint8_t, size);
+    q->spare = MALLOC(uint8_t, size);
+    q->size = size;
+    pthread_mutex_init(&q->mutex, NULL);
+    return q;
+}
+
+void cq_free(chunkqueue_t **q){
+    if(!q || !*q) return;
+    FREE((*q)->buf);
+    FREE((*q)->spare);
+    pthread_mutex_destroy(&(*q)->mutex);
+    FREE(*q);
+}
+
+/**
+ * @brief cq_put - put data portion into queue
+ * @param q - queue
+ * @param dir - direction or source of data
+ * @param t - timestamp
+ * @param data - data
+ * @param len - its length
+ * @return FALSE if queue is full (data lost)
+ */
+int cq_put(chunkqueue_t *q, uint32_t dir, double t, const uint8_t *data, size_t len){
+    int ret = TRUE;
+    pthread_mutex_lock(&q->mutex);
+    if(q->len + sizeof(chunkhdr_t) + len > q->size){
+        q->lost += len;
+        ret = FALSE;
+    }else{
+        chunkhdr_t h = {.t = t, .dir = dir, .len = len};
+        memcpy(q->buf + q->len, &h, sizeof(h));
+        memcpy(q->buf + q->len + sizeof(h), data, len);
+        q->len += sizeof(h) + len;
+    }
+    pthread_mutex_unlock(&q->mutex);
+    return ret;
+}
+
+/**
+ * @brief cq_flush - process all data in queue in order of putting
+ * @param q - queue
+ * @param handler - function to process each chunk
+ * @return amount of chunks processed
+ */
+size_t cq_flush(chunkqueue_t *q, chunkhandler_t handler){
+    if(!q || !handler) return 0;
+    pthread_mutex_lock(&q->mutex);
+    uint8_t *buf = q->buf;
+    size_t len = q->len;
+    q->buf = q->spare;
+    q->spare = buf;
+    q->len = 0;
+    pthread_mutex_unlock(&q->mutex);
+    size_t n = 0;
+    for(size_t pos = 0; pos < len; ++n){
+        chunkhdr_t h;
+        memcpy(&h, buf + pos, sizeof(h));
+        pos += sizeof(h);
+        handler(&h, buf + pos);
+        pos += h.len;
+    }
+    return n;
+}
+
+// amount of bytes lost due to queue overflow
+size_t cq_lost(chunkqueue_t *q){
+    if(!q) return 0;
+    pthread_mutex_lock(&q->mutex);
+    size_t l = q->lost;
+    pthread_mutex_unlock(&q->mutex);
+    return l;
+}
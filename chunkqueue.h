@@ -0,0 +1,44 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef CHUNKQUEUE_H__
+#define CHUNKQUEUE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// header of data portion in queue
+typedef struct{
+    double t;           // time of reading
+    uint32_t dir;       // direction (or source)
+    uint32_t len;       // length of data
+} chunkhdr_t;
+
+typedef struct chunkqueue chunkqueue_t;
+
+// function to process chunks by cq_flush()
+typedef void (*chunkhandler_t)(const chunkhdr_t *h, const uint8_t *data);
+
+chunkqueue_t *cq_new(size_t size);
+void cq_free(chunkqueue_t **q);
+int cq_put(chunkqueue_t *q, uint32_t dir, double t, const uint8_t *data, size_t len);
+size_t cq_flush(chunkqueue_t *q, chunkhandler_t handler);
+size_t cq_lost(chunkqueue_t *q);
+
+#endif // CHUNKQUEUE_H__
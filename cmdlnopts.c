@@ -36,7 +36,10 @@ glob_pars const Gdefault = {
     .speed = 9600,
     .eol = "n",
     .tmoutms = 100,
-    .serformat = "8N1"
+    .serformat = "8N1",
+    .abtime = 5000,
+    .execmode = "text",
+    .wait = 1000
 };
 
 /*
@@ -53,7 +56,35 @@ static myoption cmdlnopts[] = {
     {"port",    NEED_ARG,   NULL,   'p',    arg_string, APTR(&G.port),      _("socket port (none for UNIX)")},
     {"socket",  NO_ARGS,    NULL,   'S',    arg_int,    APTR(&G.socket),    _("open socket")},
     {"dumpfile",NEED_ARG,   NULL,   'd',    arg_string, APTR(&G.dumpfile),  _("dump data to this file")},
-    {"format",  NEED_ARG,   NULL,   'f',    arg_string, APTR(&G.serformat), _("tty format (default: 8N1)")},
+    {"format",  NEED_ARG,   NULL,   'f',    arg_string, APTR(&G.serformat), _("tty format (default: 8N1), add H for RTS/CTS or X for XON/XOFF flow control (e.g. 8N1H)")},
+    {"autobaud",NO_ARGS,    NULL,   'A',    arg_int,    APTR(&G.autobaud),  _("detect tty speed automatically")},
+    {"baudlist",NEED_ARG,   NULL,   0,      arg_string, APTR(&G.baudlist),  _("comma-separated list of additional speeds for autobaud")},
+    {"probe",   NEED_ARG,   NULL,   0,      arg_string, APTR(&G.probe),     _("data to send on each speed while autobaud (escapes like in TEXT mode)")},
+    {"expect",  NEED_ARG,   NULL,   0,      arg_string, APTR(&G.expect),    _("expected answer while autobaud (escapes like in TEXT mode)")},
+    {"abtime",  NEED_ARG,   NULL,   0,      arg_int,    APTR(&G.abtime),    _("autobaud time budget in ms (default: 5000)")},
+    {"script",  NEED_ARG,   NULL,   0,      arg_string, APTR(&G.script),    _("run send/expect script without UI, exit with its result")},
+    {"scriptlog",NEED_ARG,  NULL,   0,      arg_string, APTR(&G.scriptlog), _("write timing of script steps into this file")},
+    {"dgram",   NO_ARGS,    NULL,   0,      arg_int,    APTR(&G.dgram),     _("datagram socket (UDP or UNIX SOCK_DGRAM), one line per datagram")},
+    {"seqpacket",NO_ARGS,   NULL,   0,      arg_int,    APTR(&G.seqpacket), _("UNIX SOCK_SEQPACKET socket, one line per packet")},
+    {"bind",    NO_ARGS,    NULL,   0,      arg_int,    APTR(&G.bindsock),  _("bind datagram socket to given address and answer to last sender")},
+    {"rcvbuf",  NEED_ARG,   NULL,   0,      arg_int,    APTR(&G.rcvbuf),    _("socket receive buffer size, bytes")},
+    {"pty",     NEED_ARG,   NULL,   0,      arg_string, APTR(&G.pty),       _("create pty (symlinked to given path) for other programs and show all traffic through it")},
+    {"sniff",   NEED_ARG,   NULL,   0,      arg_string, APTR(&G.sniff),     _("sniff two ports: this one and given by `name` (both with the same settings)")},
+    {"framegap",NEED_ARG,   NULL,   0,      arg_double, APTR(&G.framegap),  _("start new frame of sniffed data after this idle time, ms")},
+    {"view",    NEED_ARG,   NULL,   0,      arg_string, APTR(&G.view),      _("view captured data file (without device)")},
+    {"dumpsize",NEED_ARG,   NULL,   0,      arg_int,    APTR(&G.dumpsize),  _("rotate dump file when its size exceeds given value, MB")},
+    {"dumptime",NEED_ARG,   NULL,   0,      arg_int,    APTR(&G.dumptime),  _("rotate dump file each given amount of seconds")},
+    {"dumpkeep",NEED_ARG,   NULL,   0,      arg_int,    APTR(&G.dumpkeep),  _("max amount of old dump segments (default: keep all)")},
+    {"dumpgzip",NO_ARGS,    NULL,   0,      arg_int,    APTR(&G.dumpgzip),  _("gzip old dump segments in background")},
+    {"pcapng",  NO_ARGS,    NULL,   0,      arg_int,    APTR(&G.pcapng),    _("write dump in pcapng format (with timestamps and direction)")},
+    {"exec",    NEED_ARG,   NULL,   0,      arg_string, APTR(&G.exec),      _("send given data, print reply and exit (without UI)")},
+    {"execmode",NEED_ARG,   NULL,   0,      arg_string, APTR(&G.execmode),  _("input mode for --exec: text (default), raw, hex, rturaw, rtuhex, ascii or tcp")},
+    {"until",   NEED_ARG,   NULL,   0,      arg_string, APTR(&G.until),     _("--exec: stop reading after this terminator (escapes like in TEXT mode)")},
+    {"wait",    NEED_ARG,   NULL,   0,      arg_int,    APTR(&G.wait),      _("--exec: max time to wait for reply, ms (default: 1000)")},
+    {"ctlsock", NEED_ARG,   NULL,   0,      arg_string, APTR(&G.ctlsock),   _("UNIX socket to control running session (send data, subscribe to RX, get state)")},
+    {"cksum",   NEED_ARG,   NULL,   0,      arg_string, APTR(&G.cksum),     _("checksum added in RAW/HEX input modes and checked in received frames: algo[:le|be][:head[:tail]]")},
+    {"packets", NEED_ARG,   NULL,   0,      arg_int,    APTR(&G.packets),   _("packet view: show each frame from new line (frames are separated by idle gap of given amount of symbols)")},
+    {"pastesend",NO_ARGS,   NULL,   0,      arg_int,    APTR(&G.pastesend), _("send all lines of multi-line paste at once (without input line and history)")},
     end_option
 };
 
@@ -32,6 +32,34 @@ typedef struct{
     char *eol;          // end of line: \r (CR), \rn (CR+LF) or \n (LF): "r", "rn", "n"
     char *port;         // socket port
     char *serformat;    // format of serial line
+    int autobaud;       // find speed automatically
+    char *baudlist;     // additional speeds for autobaud (comma-separated)
+    char *probe;        // data to send on each speed while autobaud
+    char *expect;       // expected answer while autobaud
+    int abtime;         // autobaud time budget, ms
+    char *script;       // script to run without UI
+    char *scriptlog;    // script steps timing log
+    int dgram;          // datagram socket (UDP or UNIX SOCK_DGRAM)
+    int seqpacket;      // UNIX SOCK_SEQPACKET socket
+    int bindsock;       // bind socket instead of connecting
+    int rcvbuf;         // socket receive buffer size
+    char *pty;          // symlink to pty for PTY bridge
+    char *sniff;        // second port for sniffer
+    double framegap;    // min idle gap between sniffed frames, ms
+    char *view;         // captured file to view without device
+    int dumpsize;       // rotate dump file when it's larger, MB
+    int dumptime;       // rotate dump file each `dumptime` seconds
+    int dumpkeep;       // max amount of old dump segments
+    int dumpgzip;       // compress old dump segments
+    int pcapng;         // dump in pcapng format
+    char *exec;         // data to send in one-shot mode
+    char *execmode;     // its input mode
+    char *until;        // reply terminator
+    int wait;           // max time to wait for reply, ms
+    char *ctlsock;      // path of control socket
+    char *cksum;        // checksum of sent data and received frames
+    int packets;        // packet view: min idle gap between frames, symbols
+    int pastesend;      // send multi-line pastes at once
 } glob_pars;
 
 
@@ -0,0 +1,459 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "checksum.h"
+#include "commands.h"
+#include "dbg.h"
+#include "filesend.h"
+#include "modbus.h"
+#include "ncurses_and_readline.h"
+#include "ptybridge.h"
+#include "script.h"
+#include "string_functions.h"
+#include "xmodem.h"
+
+// max amount of command arguments
+#define MAXARGS     (32)
+
+typedef struct{
+    const char *name;                   // command name
+    int (*handler)(int argc, char **argv); // command handler (return FALSE if failed)
+    const char *help;                   // help string
+} command_t;
+
+static int cmd_send(int argc, char **argv);
+static int cmd_stop(int argc, char **argv);
+static int cmd_sx(int argc, char **argv);
+static int cmd_sb(int argc, char **argv);
+static int cmd_rx(int argc, char **argv);
+static int cmd_rb(int argc, char **argv);
+static int cmd_stat(int argc, char **argv);
+static int cmd_script(int argc, char **argv);
+static int cmd_export(int argc, char **argv);
+static int cmd_cksum(int argc, char **argv);
+static int cmd_packets(int argc, char **argv);
+static int cmd_split(int argc, char **argv);
+static int cmd_filter(int argc, char **argv);
+
+static const command_t commands[] = {
+    {"send", cmd_send,  "send [-b us] [-l ms] [-B size] [-D ms] [-p prompt] [-w ms] [-e] [-m raw|hex] file - send file;\n"
+                        "    -b - delay after each byte, -l - after each line, -B/-D - after each block of `size` bytes,\n"
+                        "    -p - wait for `prompt` (escapes like in TEXT mode) after each line, -w - prompt timeout,\n"
+                        "    -e - change '\\n' in file to current EOL, -m - file contains data written like in RAW or\n"
+                        "    HEX input mode (no checksum added, -l, -p and -e are ignored)"},
+    {"sx",   cmd_sx,    "sx [-k] file - send file by XMODEM-CRC (-k - XMODEM-1K)"},
+    {"sb",   cmd_sb,    "sb file - send file by YMODEM"},
+    {"rx",   cmd_rx,    "rx file - receive file by XMODEM (CRC or 1K)"},
+    {"rb",   cmd_rb,    "rb [dir] - receive files by YMODEM into `dir` (default - current)"},
+    {"script", cmd_script, "script [-l log] file - run send/expect script (-l - write steps timing into `log`)"},
+    {"stop", cmd_stop,  "stop - stop current transfer or script"},
+    {"stat", cmd_stat,  "stat - show device statistics (bytes transferred, UART errors)"},
+    {"export", cmd_export, "export [-m text|raw|hex] [-w cols] [-j threads] file - save all received data like\n"
+                        "    it is shown in scrollback (default - current mode and screen width)"},
+    {"cksum", cmd_cksum, "cksum [-t|-r] algo[:le|be][:head[:tail]] | off - checksum added to data sent in RAW/HEX modes (-t)\n"
+                        "    and checked in each received frame (-r), default - both; algo: crc8, modbus, ccitt, xmodem,\n"
+                        "    crc32, xor or sum; head/tail - amount of first/last bytes not covered"},
+    {"packets", cmd_packets, "packets N | off - packet view: show each frame received from new line with its length and\n"
+                        "    idle time before it; frames are separated by idle gap of N symbols (only for serial devices)"},
+    {"split", cmd_split, "split h|v|off [text|raw|hex] - show received data in two views (one above other or side by side)\n"
+                        "    scrolled together; second view is in given mode (F12 switches active view)"},
+    {"filter", cmd_filter, "filter [-v] [-r|-b] pattern | on | off | clear - show only lines with substring `pattern` in them,\n"
+                        "    -r - extended regex, -b - bytes in received data (escapes like in TEXT mode), -v - lines\n"
+                        "    without pattern; on/off - show filtered or all lines (`f` in scroll mode), clear - remove filter"},
+    {NULL, NULL, NULL}
+};
+
+/**
+ * @brief getint - get integer argument of option
+ * @param arg - argument
+ * @param val (o) - value
+ * @return FALSE if wrong
+ */
+static int getint(const char *arg, int *val){
+    char *eptr;
+    long l = strtol(arg, &eptr, 0);
+    if(eptr == arg || *eptr || l < 0 || l > INT32_MAX) return FALSE;
+    *val = (int)l;
+    return TRUE;
+}
+
+// check if there's no active transfers
+static int notbusy(){
+    if(SendFileActive() || XmodemActive() || script_active()){
+        set_status("Previous transfer isn't over");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static int cmd_send(int argc, char **argv){
+    if(!notbusy()) return FALSE;
+    sendfile_pars pars = {0};
+    int opt, ret = FALSE;
+    optind = 0; // reinit getopt
+    while((opt = getopt(argc, argv, "b:l:B:D:p:w:em:")) != -1){
+        int ok = TRUE;
+        switch(opt){
+            case 'b': ok = getint(optarg, &pars.bytedelay); break;
+            case 'l': ok = getint(optarg, &pars.linedelay); break;
+            case 'B': ok = getint(optarg, &pars.blocksize); break;
+            case 'D': ok = getint(optarg, &pars.blockdelay); break;
+            case 'w': ok = getint(optarg, &pars.prompttmout); break;
+            case 'e': pars.eolconv = TRUE; break;
+            case 'm':
+                pars.convmode = str2mode(optarg);
+                ok = (pars.convmode == DISP_RAW || pars.convmode == DISP_HEX);
+            break;
+            case 'p':
+                FREE(pars.prompt);
+                pars.prompt = unescape(optarg, &pars.promptlen);
+                ok = (pars.prompt != NULL);
+            break;
+            default:
+                ok = FALSE;
+        }
+        if(!ok){
+            set_status("send: wrong option -%c", optopt ? optopt : opt);
+            goto ret;
+        }
+    }
+    if(optind != argc - 1){
+        set_status("send: point exactly one file name");
+        goto ret;
+    }
+    ret = SendFile(argv[optind], &pars);
+ret:
+    FREE(pars.prompt);
+    return ret;
+}
+
+static int cmd_stop(_U_ int argc, _U_ char **argv){
+    if(SendFileActive()) SendFileStop();
+    else if(XmodemActive()) XmodemStop();
+    else if(script_active()) script_stop();
+    else{
+        set_status("No active transfers");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static int cmd_sx(int argc, char **argv){
+    if(!notbusy()) return FALSE;
+    xmodem_proto proto = XM_CRC;
+    if(argc == 3 && strcmp(argv[1], "-k") == 0) proto = XM_1K;
+    else if(argc != 2){
+        set_status("sx: point file name");
+        return FALSE;
+    }
+    return XmodemSend(proto, argv[argc-1]);
+}
+
+static int cmd_sb(int argc, char **argv){
+    if(!notbusy()) return FALSE;
+    if(argc != 2){
+        set_status("sb: point file name");
+        return FALSE;
+    }
+    return XmodemSend(XM_YMODEM, argv[1]);
+}
+
+static int cmd_rx(int argc, char **argv){
+    if(!notbusy()) return FALSE;
+    if(argc != 2){
+        set_status("rx: point file name");
+        return FALSE;
+    }
+    return XmodemReceive(XM_CRC, argv[1]);
+}
+
+static int cmd_rb(int argc, char **argv){
+    if(!notbusy()) return FALSE;
+    if(argc > 2){
+        set_status("rb: too many arguments");
+        return FALSE;
+    }
+    return XmodemReceive(XM_YMODEM, (argc == 2) ? argv[1] : NULL);
+}
+
+static int cmd_script(int argc, char **argv){
+    if(!notbusy()) return FALSE;
+    const char *log = NULL;
+    if(argc == 4 && strcmp(argv[1], "-l") == 0) log = argv[2];
+    else if(argc != 2){
+        set_status("script: point file name");
+        return FALSE;
+    }
+    return script_run(argv[argc-1], log, FALSE);
+}
+
+static int cmd_export(int argc, char **argv){
+    disptype type = DISP_UNCHANGED;
+    int cols = 0, nthreads = 0, opt;
+    optind = 0; // reinit getopt
+    while((opt = getopt(argc, argv, "m:w:j:")) != -1){
+        int ok = TRUE;
+        switch(opt){
+            case 'm':
+                if(strcmp(optarg, "text") == 0) type = DISP_TEXT;
+                else if(strcmp(optarg, "raw") == 0) type = DISP_RAW;
+                else if(strcmp(optarg, "hex") == 0) type = DISP_HEX;
+                else ok = FALSE;
+            break;
+            case 'w': ok = getint(optarg, &cols); break;
+            case 'j': ok = getint(optarg, &nthreads); break;
+            default:
+                ok = FALSE;
+        }
+        if(!ok){
+            set_status("export: wrong option -%c", optopt ? optopt : opt);
+            return FALSE;
+        }
+    }
+    if(optind != argc - 1){
+        set_status("export: point exactly one file name");
+        return FALSE;
+    }
+    double t0 = dtime();
+    if(!ExportBuffer(argv[optind], type, cols, nthreads)){
+        set_status("export: can't save %s", argv[optind]);
+        return FALSE;
+    }
+    set_status("Saved %s in %.2fs", argv[optind], dtime() - t0);
+    return TRUE;
+}
+
+static int cmd_cksum(int argc, char **argv){
+    int tx = TRUE, rx = TRUE;
+    if(argc == 3 && 0 == strcmp(argv[1], "-t")) rx = FALSE;
+    else if(argc == 3 && 0 == strcmp(argv[1], "-r")) tx = FALSE;
+    else if(argc != 2){
+        set_status("cksum: point checksum or `off`");
+        return FALSE;
+    }
+    cspars_t p = {0};
+    if(strcmp(argv[argc-1], "off") && !cs_parse(argv[argc-1], &p)){
+        set_status("cksum: wrong checksum %s", argv[argc-1]);
+        return FALSE;
+    }
+    if(tx) SetTxChecksum(&p);
+    if(rx && !SetRxChecksum(&p)){
+        if(tx){ // checksum of sent data is set anyway
+            set_status("Checksum: %s (received data isn't checked: turn on `packets` first)", cs_name(p.algo));
+            return TRUE;
+        }
+        set_status("cksum: received data is checked only in datagram socket or packet mode");
+        return FALSE;
+    }
+    set_status("Checksum: %s", cs_name(p.algo));
+    return TRUE;
+}
+
+static int cmd_packets(int argc, char **argv){
+    int n = 0;
+    if(argc != 2 || (strcmp(argv[1], "off") && (!getint(argv[1], &n) || n == 0))){
+        set_status("packets: point amount of symbols or `off`");
+        return FALSE;
+    }
+    if(!SetFrameGap(n)){
+        set_status("packets: works only for serial devices");
+        return FALSE;
+    }
+    if(n) set_status("Packet view: gap %d symbols", n);
+    else set_status("Packet view is off");
+    return TRUE;
+}
+
+static int cmd_split(int argc, char **argv){
+    splitmode_t mode = SPLIT_AMOUNT;
+    disptype type = DISP_UNCHANGED;
+    if(argc == 2 || argc == 3){
+        if(strcmp(argv[1], "h") == 0) mode = SPLIT_HORIZONTAL;
+        else if(strcmp(argv[1], "v") == 0) mode = SPLIT_VERTICAL;
+        else if(strcmp(argv[1], "off") == 0) mode = SPLIT_NONE;
+    }
+    if(argc == 3){
+        type = str2mode(argv[2]);
+        if(type > DISP_HEX) mode = SPLIT_AMOUNT;
+    }
+    if(mode == SPLIT_AMOUNT){
+        set_status("split: point h, v or off and mode text, raw or hex");
+        return FALSE;
+    }
+    SplitViews(mode, type);
+    return TRUE;
+}
+
+static int cmd_filter(int argc, char **argv){
+    filtertype type = FILTER_SUBSTR;
+    int invert = FALSE, opt;
+    if(argc == 2 && (0 == strcmp(argv[1], "on") || 0 == strcmp(argv[1], "off"))){
+        if(!ShowFiltered(argv[1][1] == 'n')){
+            set_status("filter: no filter");
+            return FALSE;
+        }
+        return TRUE;
+    }
+    if(argc == 2 && 0 == strcmp(argv[1], "clear")){
+        SetFilter(NULL);
+        set_status("Filter removed");
+        return TRUE;
+    }
+    optind = 0; // reinit getopt
+    while((opt = getopt(argc, argv, "vrb")) != -1){
+        switch(opt){
+            case 'v': invert = TRUE; break;
+            case 'r': type = FILTER_REGEX; break;
+            case 'b': type = FILTER_BYTES; break;
+            default:
+                set_status("filter: wrong option -%c", optopt ? optopt : opt);
+                return FALSE;
+        }
+    }
+    if(optind != argc - 1){
+        set_status("filter: point exactly one pattern");
+        return FALSE;
+    }
+    filter_t *f = filter_new(type, argv[optind], invert);
+    if(!f){
+        set_status("filter: wrong pattern %s", argv[optind]);
+        return FALSE;
+    }
+    double t0 = dtime();
+    SetFilter(f);
+    set_status("Filter%s: %s (%.2fs)", invert ? " (inverted)" : "", argv[optind], dtime() - t0);
+    return TRUE;
+}
+
+static int cmd_stat(_U_ int argc, _U_ char **argv){
+    devstat_t s;
+    if(!GetDevStat(&s)){
+        set_status("No device");
+        return FALSE;
+    }
+    char lines[24][64];
+    const char *msg[25];
+    int n = 0;
+    snprintf(lines[n++], 64, "Bytes read:        %zd", s.rxbytes);
+    snprintf(lines[n++], 64, "Bytes sent:        %zd", s.txbytes);
+    if(s.hwcounters){
+        snprintf(lines[n++], 64, "UART RX/TX:        %d/%d", s.uartrx, s.uarttx);
+        snprintf(lines[n++], 64, "Overruns:          %d", s.overrun);
+        snprintf(lines[n++], 64, "Buffer overruns:   %d", s.buf_overrun);
+        snprintf(lines[n++], 64, "Framing errors:    %d", s.frame);
+        snprintf(lines[n++], 64, "Parity errors:     %d", s.parity);
+        snprintf(lines[n++], 64, "Breaks:            %d", s.brk);
+        snprintf(lines[n++], 64, "CTS/DSR/DCD changes: %d/%d/%d", s.cts, s.dsr, s.dcd);
+    }else snprintf(lines[n++], 64, "UART counters aren't available");
+    size_t good, bad;
+    GetRxChecksumStat(&good, &bad);
+    if(good || bad) snprintf(lines[n++], 64, "Checksum right/wrong: %zd/%zd", good, bad);
+    mbstat_t mb;
+    if(GetModbusStat(&mb)){
+        snprintf(lines[n++], 64, "Modbus sent/answered: %zd/%zd", mb.sent, mb.answered);
+        snprintf(lines[n++], 64, "Modbus in flight/lost: %d/%zd", mb.inflight, mb.lost);
+        snprintf(lines[n++], 64, "Modbus exc/unknown/bad: %zd/%zd/%zd", mb.exceptions, mb.unknown, mb.badframes);
+    }
+    bridgestat_t b;
+    if(PtyBridgeStat(&b)){
+        snprintf(lines[n++], 64, "PTY RX/TX:         %zd/%zd", b.rx, b.tx);
+        snprintf(lines[n++], 64, "Dropped/not shown: %zd/%zd", b.dropped, b.lost);
+        snprintf(lines[n++], 64, "Relay time, us:    mean %.1f, max %.1f", b.meanlat * 1e6, b.maxlat * 1e6);
+    }
+    for(int i = 0; i < n; ++i) msg[i] = lines[i];
+    msg[n] = NULL;
+    show_popup(msg);
+    return TRUE;
+}
+
+/**
+ * @brief splitargs - split command line into arguments (words in double quotes are one argument)
+ * @param line (io) - line to split (would be modified)
+ * @param argv (o) - arguments
+ * @return amount of arguments
+ */
+static int splitargs(char *line, char **argv){
+    int argc = 0;
+    while(*line && argc < MAXARGS){
+        while(*line == ' ' || *line == '\t') ++line;
+        if(!*line) break;
+        char *out = line;
+        argv[argc++] = out;
+        int quoted = FALSE;
+        while(*line && (quoted || (*line != ' ' && *line != '\t'))){
+            if(*line == '"'){ quoted = !quoted; ++line; continue; }
+            *out++ = *line++;
+        }
+        if(*line) ++line;
+        *out = 0;
+    }
+    return argc;
+}
+
+/**
+ * @brief run_command - parse and run user command
+ * @param line - command line
+ * @return FALSE if failed
+ */
+int run_command(const char *line){
+    if(!line) return FALSE;
+    char *str = strdup(line), *argv[MAXARGS+1] = {0};
+    int argc = splitargs(str, argv), ret = FALSE;
+    if(argc == 0) goto ret;
+    DBG("command: %s, argc=%d", argv[0], argc);
+    const command_t *c = commands;
+    for(; c->name; ++c){
+        if(strcmp(c->name, argv[0]) == 0){
+            ret = c->handler(argc, argv);
+            break;
+        }
+    }
+    if(!c->name) set_status("Unknown command: %s", argv[0]);
+ret:
+    FREE(str);
+    return ret;
+}
+
+/**
+ * @brief commands_help - get help lines for all commands
+ * @return NULL-terminated array of strings
+ */
+const char *const *commands_help(){
+    static char **help = NULL;
+    if(help) return (const char *const *)help;
+    int n = 0, nmax = 4;
+    help = MALLOC(char*, nmax);
+    for(const command_t *c = commands; c->name; ++c){
+        char *str = strdup(c->help), *saveptr = NULL;
+        for(char *tok = strtok_r(str, "\n", &saveptr); tok; tok = strtok_r(NULL, "\n", &saveptr)){
+            if(n + 2 > nmax){
+                nmax *= 2;
+                help = realloc(help, nmax * sizeof(char*));
+            }
+            help[n] = MALLOC(char, strlen(tok) + 3);
+            sprintf(help[n++], "  %s", tok);
+        }
+        FREE(str);
+    }
+    help[n] = NULL;
+    return (const char *const *)help;
+}
@@ -0,0 +1,429 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Control socket of running session (UNIX stream socket, text commands, one per line):
+ *   send MODE DATA     - convert DATA like user input in MODE (text, raw, hex, rturaw, rtuhex, ascii, tcp) and send it
+ *   sub bin|text|raw|hex - subscribe to received data: unchanged or formatted like in given display mode
+ *   unsub              - stop subscription
+ *   stat               - get counters and state
+ *   quit               - close connection
+ * Replies are "OK [...]" or "ERR message". RX hook only copies data into bounded ring of each
+ * subscriber (data which doesn't fit is dropped and counted), so slow clients never block reading
+ * of device; formatting and sending are made by control thread.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "checksum.h"
+#include "ctlsock.h"
+#include "dbg.h"
+#include "formatter.h"
+#include "modbus.h"
+#include "ncurses_and_readline.h"
+#include "string_functions.h"
+
+// max amount of clients
+#define CTL_MAXCLIENTS  (16)
+// max length of command line
+#define CTL_LINEMAX     (4096)
+// max length of one reply (commands aren't run while output buffer has less free space)
+#define CTL_REPLYMAX    (1024)
+// size of received data ring of each subscriber
+#define CTL_RXBUFSZ     (256*1024)
+// size of output buffer of each client
+#define CTL_OUTBUFSZ    (64*1024)
+// max amount of raw data formatted at once (formatted data is up to 5 times larger)
+#define CTL_PORTION     (CTL_OUTBUFSZ/6)
+// bytes per line in RAW subscription
+#define CTL_RAWLINE     (32)
+// bytes per line in HEX subscription
+#define CTL_HEXLINE     (16)
+// subscription type for unchanged data
+#define SUB_BIN         (DISP_SIZE)
+
+typedef struct{
+    int fd;                 // socket (-1 if slot is free)
+    char in[CTL_LINEMAX];   // incomplete command line (or commands waiting for place for replies)
+    size_t inlen;
+    int stalled;            // commands in `in` wait until output buffer would be sent
+    int sub;                // subscription: DISP_TEXT/RAW/HEX, SUB_BIN or -1
+    uint8_t *rx;            // ring of received data
+    size_t rxhead, rxlen;   // its start and amount of data
+    size_t dropped;         // bytes dropped due to ring overflow
+    size_t hexaddr;         // address of next hexdump line
+    char *out;              // output buffer (replies and subscription data)
+    size_t outpos, outlen;  // position of unsent data and amount of data
+} ctlclient;
+
+static ctlclient clients[CTL_MAXCLIENTS];
+static pthread_mutex_t ctlmutex = PTHREAD_MUTEX_INITIALIZER; // subscriptions and rings
+static const chardevice *dev = NULL;
+static char *sockpath = NULL;
+static int lsock = -1, evfd = -1;
+static volatile int stopflag = 0;
+static int wakeup = 0;      // eventfd already signaled
+static pthread_t thread;
+
+// RX hook: called from main loop for each data portion
+static void rxhook(_U_ ttyterm_t *t, const uint8_t *data, int len, _U_ void *arg){
+    if(len < 1) return;
+    int wake = FALSE;
+    pthread_mutex_lock(&ctlmutex);
+    for(int i = 0; i < CTL_MAXCLIENTS; ++i){
+        ctlclient *c = &clients[i];
+        if(c->fd < 0 || c->sub < 0) continue;
+        size_t n = CTL_RXBUFSZ - c->rxlen;
+        if(n > (size_t)len) n = len;
+        c->dropped += len - n;
+        size_t tail = (c->rxhead + c->rxlen) % CTL_RXBUFSZ, part = CTL_RXBUFSZ - tail;
+        if(part > n) part = n;
+        memcpy(c->rx + tail, data, part);
+        memcpy(c->rx, data + part, n - part);
+        c->rxlen += n;
+        if(n) wake = TRUE;
+    }
+    if(wake && !wakeup){
+        uint64_t one = 1;
+        if(write(evfd, &one, sizeof(one)) == sizeof(one)) wakeup = 1;
+    }
+    pthread_mutex_unlock(&ctlmutex);
+}
+
+// add text to output buffer of client (commands are run only when there's CTL_REPLYMAX free bytes)
+static void reply(ctlclient *c, const char *fmt, ...){
+    va_list ap;
+    va_start(ap, fmt);
+    int l = vsnprintf(c->out + c->outlen, CTL_OUTBUFSZ + CTL_LINEMAX - c->outlen, fmt, ap);
+    va_end(ap);
+    if(l > 0) c->outlen += l;
+    if(c->outlen > CTL_OUTBUFSZ + CTL_LINEMAX - 1) c->outlen = CTL_OUTBUFSZ + CTL_LINEMAX - 1;
+}
+
+static void closeclient(ctlclient *c){
+    pthread_mutex_lock(&ctlmutex);
+    close(c->fd);
+    c->fd = -1;
+    c->sub = -1;
+    FREE(c->rx);
+    FREE(c->out);
+    pthread_mutex_unlock(&ctlmutex);
+}
+
+static void newclient(int fd){
+    int i = 0;
+    for(; i < CTL_MAXCLIENTS && clients[i].fd > -1; ++i);
+    if(i == CTL_MAXCLIENTS){
+        const char *msg = "ERR too many clients\n";
+        if(send(fd, msg, strlen(msg), MSG_DONTWAIT | MSG_NOSIGNAL) < 0) DBG("send()");
+        close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    ctlclient *c = &clients[i];
+    pthread_mutex_lock(&ctlmutex);
+    memset(c, 0, sizeof(ctlclient));
+    c->sub = -1;
+    c->out = MALLOC(char, CTL_OUTBUFSZ + CTL_LINEMAX);
+    c->fd = fd;
+    pthread_mutex_unlock(&ctlmutex);
+    DBG("New control client %d", i);
+}
+
+// run command; return FALSE to close connection
+static int runcmd(ctlclient *c, char *line){
+    char *arg = strchr(line, ' ');
+    if(arg) *arg++ = 0;
+    else arg = line + strlen(line);
+    if(0 == strcmp(line, "send")){
+        char *data = strchr(arg, ' ');
+        if(data) *data++ = 0;
+        disptype mode = str2mode(arg);
+        if(mode == DISP_UNCHANGED || !data || !*data){
+            reply(c, "ERR usage: send text|raw|hex|rturaw|rtuhex|ascii|tcp data\n");
+            return TRUE;
+        }
+        int r = convert_and_send(mode, data);
+        if(r > 0) reply(c, "OK %d\n", r);
+        else reply(c, "ERR %s\n", r < 0 ? "disconnected" : "can't send");
+    }else if(0 == strcmp(line, "sub")){
+        int sub = (0 == strcmp(arg, "bin")) ? SUB_BIN : (int)str2mode(arg);
+        if(sub != SUB_BIN && sub > DISP_HEX){
+            reply(c, "ERR usage: sub bin|text|raw|hex\n");
+            return TRUE;
+        }
+        pthread_mutex_lock(&ctlmutex);
+        if(!c->rx) c->rx = MALLOC(uint8_t, CTL_RXBUFSZ);
+        c->sub = sub;
+        pthread_mutex_unlock(&ctlmutex);
+        reply(c, "OK\n");
+    }else if(0 == strcmp(line, "unsub")){
+        pthread_mutex_lock(&ctlmutex);
+        c->sub = -1;
+        c->rxlen = 0;
+        pthread_mutex_unlock(&ctlmutex);
+        reply(c, "OK\n");
+    }else if(0 == strcmp(line, "stat")){
+        devstat_t st;
+        if(!GetDevStat(&st)){
+            reply(c, "ERR no device\n");
+            return TRUE;
+        }
+        size_t sbytes, slines;
+        GetScrollback(&sbytes, &slines);
+        reply(c, "OK name=%.256s speed=%d eol=%s rx=%zd tx=%zd scrollback=%zd lines=%zd dropped=%zd",
+              dev->name, dev->speed, dev->seol, st.rxbytes, st.txbytes, sbytes, slines, c->dropped);
+        size_t good, bad;
+        GetRxChecksumStat(&good, &bad);
+        if(good || bad) reply(c, " cksum_ok=%zd cksum_bad=%zd", good, bad);
+        mbstat_t mb;
+        if(GetModbusStat(&mb)) reply(c, " mb_sent=%zd mb_answered=%zd mb_inflight=%d mb_lost=%zd mb_exceptions=%zd mb_unknown=%zd mb_bad=%zd",
+                               mb.sent, mb.answered, mb.inflight, mb.lost, mb.exceptions, mb.unknown, mb.badframes);
+        if(st.hwcounters) reply(c, " frame=%d overrun=%d parity=%d brk=%d buf_overrun=%d",
+                                st.frame, st.overrun, st.parity, st.brk, st.buf_overrun);
+        reply(c, "\n");
+    }else if(0 == strcmp(line, "quit")) return FALSE;
+    else if(*line) reply(c, "ERR unknown command %.64s\n", line);
+    return TRUE;
+}
+
+// run complete commands while there's place for their replies; return FALSE to close connection
+static int runcmds(ctlclient *c){
+    char *start = c->in, *nl;
+    c->stalled = FALSE;
+    while((nl = strchr(start, '\n'))){
+        if(CTL_OUTBUFSZ + CTL_LINEMAX - c->outlen < CTL_REPLYMAX){ // the rest - after client reads replies
+            c->stalled = TRUE;
+            break;
+        }
+        *nl = 0;
+        if(nl > start && nl[-1] == '\r') nl[-1] = 0;
+        if(!runcmd(c, start)) return FALSE;
+        start = nl + 1;
+    }
+    c->inlen -= start - c->in;
+    memmove(c->in, start, c->inlen + 1);
+    return TRUE;
+}
+
+// read commands; return FALSE if connection closed
+static int readclient(ctlclient *c){
+    ssize_t l = recv(c->fd, c->in + c->inlen, CTL_LINEMAX - 1 - c->inlen, 0);
+    if(l == 0) return FALSE;
+    if(l < 0) return (errno == EAGAIN || errno == EINTR);
+    c->inlen += l;
+    c->in[c->inlen] = 0;
+    if(!runcmds(c)) return FALSE;
+    if(!c->stalled && c->inlen == CTL_LINEMAX - 1){ // too long line
+        reply(c, "ERR line too long\n");
+        c->inlen = 0;
+    }
+    return TRUE;
+}
+
+// move next portion of received data into empty output buffer
+static void formatrx(ctlclient *c){
+    uint8_t data[CTL_PORTION];
+    size_t n = 0;
+    pthread_mutex_lock(&ctlmutex);
+    int sub = c->sub;
+    if(sub > -1 && c->rxlen){
+        n = (c->rxlen > CTL_PORTION) ? CTL_PORTION : c->rxlen;
+        size_t part = CTL_RXBUFSZ - c->rxhead;
+        if(part > n) part = n;
+        memcpy(data, c->rx + c->rxhead, part);
+        memcpy(data + part, c->rx, n - part);
+        c->rxhead = (c->rxhead + n) % CTL_RXBUFSZ;
+        c->rxlen -= n;
+    }
+    pthread_mutex_unlock(&ctlmutex);
+    if(!n) return;
+    char *out = c->out;
+    size_t pos = 0;
+    switch(sub){
+        case SUB_BIN:
+            memcpy(out, data, n);
+            pos = n;
+        break;
+        case DISP_TEXT:{
+            fmtpars_t p = {.type = DISP_TEXT, .cols = MAXCOLS, .linelen = MAXCOLS};
+            fmtline_t l;
+            for(size_t i = 0; i < n;){
+                size_t u = fmt_textline(&p, data + i, n - i, 0, &l);
+                memcpy(out + pos, l.buf, l.len);
+                pos += l.len;
+                if(l.full) out[pos++] = '\n';
+                if(!u) break;
+                i += u;
+            }
+        }
+        break;
+        case DISP_RAW:
+            for(size_t i = 0; i < n; i += CTL_RAWLINE){
+                pos += fmt_rawline(out + pos, data + i, (n - i > CTL_RAWLINE) ? CTL_RAWLINE : n - i);
+                out[pos++] = '\n';
+            }
+        break;
+        case DISP_HEX:
+            for(size_t i = 0; i < n; i += CTL_HEXLINE){
+                size_t nb = (n - i > CTL_HEXLINE) ? CTL_HEXLINE : n - i;
+                pos += fmt_hexline(out + pos, data + i, nb, CTL_HEXLINE, c->hexaddr);
+                out[pos++] = '\n';
+                c->hexaddr += nb;
+            }
+        break;
+        default:
+        break;
+    }
+    c->outpos = 0;
+    c->outlen = pos;
+}
+
+// send as much as possible; return FALSE if connection closed
+static int writeclient(ctlclient *c){
+    while(1){
+        if(c->outpos == c->outlen){ // buffer is empty: run waiting commands or get next data portion
+            c->outpos = c->outlen = 0;
+            if(c->stalled && !runcmds(c)) return FALSE;
+            if(!c->outlen) formatrx(c);
+            if(!c->outlen) break;
+        }
+        ssize_t l = send(c->fd, c->out + c->outpos, c->outlen - c->outpos, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if(l < 0) return (errno == EAGAIN || errno == EINTR);
+        c->outpos += l;
+    }
+    return TRUE;
+}
+
+static void *ctlthread(_U_ void *arg){
+    struct pollfd fds[CTL_MAXCLIENTS + 2];
+    int idx[CTL_MAXCLIENTS + 2];
+    while(!stopflag){
+        fds[0] = (struct pollfd){.fd = lsock, .events = POLLIN};
+        fds[1] = (struct pollfd){.fd = evfd, .events = POLLIN};
+        int n = 2;
+        for(int i = 0; i < CTL_MAXCLIENTS; ++i){
+            ctlclient *c = &clients[i];
+            if(c->fd < 0) continue;
+            int pending = (c->outpos < c->outlen) || (c->sub > -1 && c->rxlen);
+            // don't read new commands until waiting ones are run
+            fds[n] = (struct pollfd){.fd = c->fd, .events = (c->stalled ? 0 : POLLIN) | (pending ? POLLOUT : 0)};
+            idx[n++] = i;
+        }
+        if(poll(fds, n, 100) < 0){
+            if(errno == EINTR) continue;
+            WARN("poll()");
+            break;
+        }
+        if(fds[1].revents){
+            uint64_t v;
+            if(read(evfd, &v, sizeof(v)) < 0) DBG("read(evfd)");
+            pthread_mutex_lock(&ctlmutex);
+            wakeup = 0;
+            pthread_mutex_unlock(&ctlmutex);
+        }
+        for(int j = 2; j < n; ++j){
+            ctlclient *c = &clients[idx[j]];
+            int ok = TRUE;
+            if(fds[j].revents & (POLLIN | POLLHUP | POLLERR)) ok = readclient(c);
+            if(ok) ok = writeclient(c);
+            if(!ok){
+                DBG("Control client %d disconnected", idx[j]);
+                closeclient(c);
+            }
+        }
+        if(fds[0].revents & POLLIN){
+            int fd = accept(lsock, NULL, NULL);
+            if(fd > -1) newclient(fd);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief CtlStart - open control socket and start its thread
+ * @param d - device (for state info)
+ * @param path - path of UNIX socket
+ * @return FALSE if failed
+ */
+int CtlStart(const chardevice *d, const char *path){
+    if(!d || !path || lsock > -1) return FALSE;
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if(strlen(path) >= sizeof(addr.sun_path)){
+        WARNX(_("Too long socket name: %s"), path);
+        return FALSE;
+    }
+    strcpy(addr.sun_path, path);
+    lsock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(lsock < 0){
+        WARN("socket()");
+        return FALSE;
+    }
+    unlink(path); // remove socket of previous session
+    if(bind(lsock, (struct sockaddr*)&addr, sizeof(addr)) || listen(lsock, CTL_MAXCLIENTS)){
+        WARN(_("Can't bind control socket %s"), path);
+        close(lsock);
+        lsock = -1;
+        return FALSE;
+    }
+    evfd = eventfd(0, EFD_NONBLOCK);
+    for(int i = 0; i < CTL_MAXCLIENTS; ++i){
+        clients[i].fd = -1;
+        clients[i].sub = -1;
+    }
+    dev = d;
+    stopflag = 0;
+    if(evfd < 0 || pthread_create(&thread, NULL, ctlthread, NULL)){
+        WARN(_("Can't start control thread"));
+        if(evfd > -1) close(evfd);
+        close(lsock);
+        lsock = evfd = -1;
+        unlink(path);
+        return FALSE;
+    }
+    sockpath = strdup(path);
+    addrxhook(rxhook, NULL);
+    return TRUE;
+}
+
+/**
+ * @brief CtlStop - close control socket and all connections
+ */
+void CtlStop(){
+    if(!sockpath) return;
+    delrxhook(rxhook, NULL);
+    stopflag = 1;
+    pthread_join(thread, NULL);
+    for(int i = 0; i < CTL_MAXCLIENTS; ++i)
+        if(clients[i].fd > -1) closeclient(&clients[i]);
+    close(lsock);
+    close(evfd);
+    lsock = evfd = -1;
+    unlink(sockpath);
+    FREE(sockpath);
+}
@@ -0,0 +1,413 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Dump file with rotation. Records ("< "/"> " + data) are written under mutex and never split between
+ * segments: before the record which exceeds size limit (or after rotation period) current file is closed
+ * and atomically renamed to `path.YYYYmmdd-HHMMSS-NNN`, new `path` is opened. Closed segments are gzipped and
+ * old ones removed by thread with lowest CPU and I/O priority, so RX path only waits for rename().
+ * In pcapng format each segment starts from its own section header, each chunk is enhanced packet block
+ * with nanosecond timestamp and direction flag (inbound for RX, outbound for TX), LINKTYPE_USER0.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "dbg.h"
+#include "dumpfile.h"
+#include "timestamps.h"
+
+// max amount of closed segments waiting for compression
+#define QUEUEMAX    (64)
+// size of buffer for compression
+#define GZBUFSZ     (65536)
+// I/O priority of compressing thread: IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT
+#define IOPRIO_IDLE (3 << 13)
+
+// pcapng blocks, options and link type
+#define PCAPNG_SHB          (0x0A0D0D0A)
+#define PCAPNG_IDB          (0x00000001)
+#define PCAPNG_EPB          (0x00000006)
+#define PCAPNG_MAGIC        (0x1A2B3C4D)
+#define LINKTYPE_USER0      (147)
+#define OPT_ENDOFOPT        (0)
+#define OPT_SHB_USERAPPL    (4)
+#define OPT_IF_NAME         (2)
+#define OPT_IF_TSRESOL      (9)
+#define OPT_EPB_FLAGS       (2)
+#define EPB_INBOUND         (1)
+#define EPB_OUTBOUND        (2)
+// max length of interface name in pcapng header
+#define IFNAMEMAX           (255)
+// pcapng fields are aligned by 32 bits
+#define PAD4(x)             (((x) + 3) & ~(size_t)3)
+// size of enhanced packet block: header (28), data, epb_flags (8), end of options (4), length (4)
+#define EPBSIZE(l)          (44 + PAD4(l))
+
+struct dump{
+    pthread_mutex_t mutex;      // writing and rotation
+    FILE *file;
+    char *path;
+    size_t cursize;             // size of current segment
+    time_t tstart;              // time when current segment was opened
+    size_t hdrsize;             // size of pcapng headers in current segment
+    dumprot_t rotation;
+    dumpformat format;
+    char *ifname;               // device name for pcapng
+    // compressor of closed segments
+    pthread_t worker;
+    int workerrun, stopworker;
+    pthread_mutex_t qmutex;
+    pthread_cond_t qcond;
+    char *queue[QUEUEMAX];      // closed segments
+    int qlen;
+    char segdir[PATH_MAX];      // directory of dump file
+    char segprefix[PATH_MAX];   // "basename." of dump file (to find old segments)
+    size_t segprefixlen;
+};
+
+// gzip file into `name.gz` and remove it
+static int gzipfile(const char *name){
+    char tmp[PATH_MAX], gz[PATH_MAX];
+    snprintf(gz, PATH_MAX, "%s.gz", name);
+    snprintf(tmp, PATH_MAX, "%s.gz.tmp", name);
+    int fd = open(name, O_RDONLY);
+    if(fd < 0) return FALSE;
+    gzFile g = gzopen(tmp, "wb6");
+    if(!g){
+        close(fd);
+        return FALSE;
+    }
+    uint8_t buf[GZBUFSZ];
+    ssize_t l;
+    int ok = TRUE;
+    while((l = read(fd, buf, GZBUFSZ)) > 0){
+        if(gzwrite(g, buf, (unsigned)l) != (int)l){
+            ok = FALSE;
+            break;
+        }
+    }
+    if(l < 0) ok = FALSE;
+    close(fd);
+    if(gzclose(g) != Z_OK) ok = FALSE;
+    if(!ok || rename(tmp, gz)){
+        unlink(tmp);
+        return FALSE;
+    }
+    unlink(name);
+    return TRUE;
+}
+
+// old segments: "basename." + timestamp (not temporary files)
+static int issegment(const dump_t *d, const char *n){
+    if(strncmp(n, d->segprefix, d->segprefixlen) || n[d->segprefixlen] < '0' || n[d->segprefixlen] > '9') return FALSE;
+    size_t l = strlen(n);
+    return !(l > 4 && 0 == strcmp(n + l - 4, ".tmp"));
+}
+
+// remove oldest segments (timestamps in names are sorted in time order)
+static void cleanup(dump_t *d){
+    struct dirent **list;
+    int n = scandir(d->segdir, &list, NULL, alphasort);
+    if(n < 0) return;
+    int nseg = 0;
+    for(int i = 0; i < n; ++i) if(issegment(d, list[i]->d_name)) ++nseg;
+    for(int i = 0; i < n; ++i){
+        if(nseg > d->rotation.keep && issegment(d, list[i]->d_name)){
+            char path[PATH_MAX + NAME_MAX + 2];
+            snprintf(path, sizeof(path), "%s/%s", d->segdir, list[i]->d_name);
+            DBG("Remove old segment %s", path);
+            if(unlink(path)) WARN(_("Can't remove %s"), path);
+            --nseg;
+        }
+        free(list[i]);
+    }
+    free(list);
+}
+
+static void *compressor(void *arg){
+    dump_t *d = (dump_t*)arg;
+    // lowest priority for this thread only: RX path shouldn't feel compression
+    if(setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19)) DBG("setpriority() failed");
+    if(syscall(SYS_ioprio_set, 1, 0, IOPRIO_IDLE)) DBG("ioprio_set() failed"); // IOPRIO_WHO_PROCESS, current thread
+    pthread_mutex_lock(&d->qmutex);
+    while(1){
+        if(d->qlen == 0){
+            if(d->stopworker) break;
+            pthread_cond_wait(&d->qcond, &d->qmutex);
+            continue;
+        }
+        char *name = d->queue[0];
+        memmove(d->queue, d->queue + 1, --d->qlen * sizeof(char*));
+        pthread_mutex_unlock(&d->qmutex);
+        if(d->rotation.compress && !gzipfile(name)) WARNX(_("Can't compress %s"), name);
+        if(d->rotation.keep) cleanup(d);
+        FREE(name);
+        pthread_mutex_lock(&d->qmutex);
+    }
+    pthread_mutex_unlock(&d->qmutex);
+    return NULL;
+}
+
+// give closed segment to compressor
+static void enqueue(dump_t *d, char *name){
+    if(!d->workerrun){
+        FREE(name);
+        return;
+    }
+    pthread_mutex_lock(&d->qmutex);
+    if(d->qlen < QUEUEMAX){
+        d->queue[d->qlen++] = name;
+        name = NULL;
+        pthread_cond_signal(&d->qcond);
+    }
+    pthread_mutex_unlock(&d->qmutex);
+    if(name){
+        WARNX(_("Too many segments to compress, %s left as is"), name);
+        FREE(name);
+    }
+}
+
+static void put32(uint8_t *buf, uint32_t val){
+    memcpy(buf, &val, 4);
+}
+
+// add pcapng option at `pos` of `buf`, return position after it
+static size_t addopt(uint8_t *buf, size_t pos, uint16_t code, const void *val, uint16_t len){
+    memcpy(buf + pos, &code, 2);
+    memcpy(buf + pos + 2, &len, 2);
+    if(len) memcpy(buf + pos + 4, val, len);
+    memset(buf + pos + 4 + len, 0, PAD4(len) - len);
+    return pos + 4 + PAD4(len);
+}
+
+// fill type and lengths of pcapng block started at `start` with body ended at `pos`; return end of block
+static size_t closeblock(uint8_t *buf, size_t start, uint32_t type, size_t pos){
+    uint32_t len = (uint32_t)(pos + 4 - start);
+    put32(buf + start, type);
+    put32(buf + start + 4, len);
+    put32(buf + pos, len);
+    return pos + 4;
+}
+
+// write section header and interface description blocks (call with locked `d->mutex`)
+static size_t pcapng_header(dump_t *d){
+    uint8_t buf[512];
+    uint16_t ver[2] = {1, 0}, link[2] = {LINKTYPE_USER0, 0};
+    int64_t seclen = -1; // unknown
+    uint8_t tsresol = 9; // nanoseconds
+    put32(buf + 8, PCAPNG_MAGIC);
+    memcpy(buf + 12, ver, 4);
+    memcpy(buf + 16, &seclen, 8);
+    size_t pos = addopt(buf, 24, OPT_SHB_USERAPPL, "tty_term", 8);
+    pos = addopt(buf, pos, OPT_ENDOFOPT, NULL, 0);
+    size_t idb = closeblock(buf, 0, PCAPNG_SHB, pos);
+    memcpy(buf + idb + 8, link, 4);
+    put32(buf + idb + 12, 0); // no snaplen
+    pos = idb + 16;
+    if(d->ifname){
+        size_t l = strlen(d->ifname);
+        if(l > IFNAMEMAX) l = IFNAMEMAX;
+        pos = addopt(buf, pos, OPT_IF_NAME, d->ifname, (uint16_t)l);
+    }
+    pos = addopt(buf, pos, OPT_IF_TSRESOL, &tsresol, 1);
+    pos = addopt(buf, pos, OPT_ENDOFOPT, NULL, 0);
+    pos = closeblock(buf, idb, PCAPNG_IDB, pos);
+    if(pos != fwrite(buf, 1, pos, d->file)) WARN(_("Can't write %s"), d->path);
+    return pos;
+}
+
+// write enhanced packet block (call with locked `d->mutex`)
+static void pcapng_packet(dump_t *d, dumpdir dir, const struct timespec *ts, const uint8_t *data, size_t len){
+    static const uint8_t zeros[4] = {0};
+    uint8_t hdr[28], tail[20];
+    uint64_t t = (uint64_t)ts->tv_sec * 1000000000ULL + (uint64_t)ts->tv_nsec;
+    uint32_t flags = (dir == DUMP_RX) ? EPB_INBOUND : EPB_OUTBOUND;
+    // options are written after data, so block is filled by parts
+    size_t pos = addopt(tail, 0, OPT_EPB_FLAGS, &flags, 4);
+    pos = addopt(tail, pos, OPT_ENDOFOPT, NULL, 0);
+    uint32_t total = (uint32_t)EPBSIZE(len);
+    put32(hdr, PCAPNG_EPB);
+    put32(hdr + 4, total);
+    put32(hdr + 8, 0); // interface ID
+    put32(hdr + 12, (uint32_t)(t >> 32));
+    put32(hdr + 16, (uint32_t)t);
+    put32(hdr + 20, (uint32_t)len); // captured
+    put32(hdr + 24, (uint32_t)len); // original
+    put32(tail + pos, total);
+    fwrite(hdr, 1, sizeof(hdr), d->file);
+    fwrite(data, 1, len, d->file);
+    fwrite(zeros, 1, PAD4(len) - len, d->file);
+    fwrite(tail, 1, pos + 4, d->file);
+}
+
+// open current segment (call with locked `d->mutex`)
+static int opensegment(dump_t *d){
+    d->file = fopen(d->path, "a");
+    if(!d->file){
+        WARN(_("Can't open %s"), d->path);
+        return FALSE;
+    }
+    fseek(d->file, 0, SEEK_END);
+    long pos = ftell(d->file);
+    d->cursize = (pos > 0) ? (size_t)pos : 0;
+    d->tstart = time(NULL);
+    // each segment (or appended part of existing file) is a new pcapng section
+    d->hdrsize = (d->format == DUMP_PCAPNG) ? pcapng_header(d) : 0;
+    d->cursize += d->hdrsize;
+    return TRUE;
+}
+
+// close current segment and start new one (call with locked `d->mutex`)
+static void rotate(dump_t *d){
+    char name[PATH_MAX], gz[PATH_MAX + 4];
+    struct tm tm;
+    time_t t = time(NULL);
+    localtime_r(&t, &tm);
+    int l = snprintf(name, PATH_MAX, "%s.", d->path);
+    strftime(name + l, PATH_MAX - l, "%Y%m%d-%H%M%S", &tm);
+    l = strlen(name);
+    // each segment has number in its second: names are sorted in time order with and without ".gz"
+    for(int i = 0; i < 1000; ++i){
+        snprintf(name + l, PATH_MAX - l, "-%03d", i);
+        snprintf(gz, sizeof(gz), "%s.gz", name);
+        if(access(name, F_OK) && access(gz, F_OK)) break;
+    }
+    fclose(d->file);
+    d->file = NULL;
+    if(rename(d->path, name)){
+        WARN(_("Can't rename %s"), d->path);
+        opensegment(d); // continue old file
+        return;
+    }
+    DBG("Rotated to %s", name);
+    opensegment(d);
+    enqueue(d, strdup(name));
+}
+
+/**
+ * @brief dump_open - open dump file (data is appended to existing file)
+ * @param p - file name, format and rotation
+ * @param devname - device name (for pcapng interface description) or NULL
+ * @return dump or NULL if failed
+ */
+dump_t *dump_open(const dumppars_t *p, const char *devname){
+    if(!p || !p->path) return NULL;
+    dump_t *d = MALLOC(dump_t, 1);
+    pthread_mutex_init(&d->mutex, NULL);
+    pthread_mutex_init(&d->qmutex, NULL);
+    pthread_cond_init(&d->qcond, NULL);
+    d->path = strdup(p->path);
+    d->format = p->format;
+    d->rotation = p->rot;
+    if(devname) d->ifname = strdup(devname);
+    if(!opensegment(d)){
+        dump_close(&d);
+        return NULL;
+    }
+    char buf[PATH_MAX];
+    snprintf(buf, PATH_MAX, "%s", p->path);
+    d->segprefixlen = snprintf(d->segprefix, PATH_MAX, "%s.", basename(buf));
+    snprintf(buf, PATH_MAX, "%s", p->path);
+    snprintf(d->segdir, PATH_MAX, "%s", dirname(buf));
+    if((d->rotation.maxsize || d->rotation.period) && (d->rotation.compress || d->rotation.keep)){
+        if(pthread_create(&d->worker, NULL, compressor, d)) WARN("pthread_create()");
+        else d->workerrun = 1;
+    }
+    return d;
+}
+
+/**
+ * @brief dump_write - write record into dump file (rotate it if need)
+ * @param d - dump
+ * @param dir - direction: DUMP_RX or DUMP_TX (record prefix "< " or "> " in text format)
+ * @param data - data
+ * @param len - its length
+ */
+void dump_write(dump_t *d, dumpdir dir, const uint8_t *data, size_t len){
+    dump_writeat(d, dir, data, len, 0);
+}
+
+/**
+ * @brief dump_writeat - write record with given time of receiving (e.g. kernel timestamp of datagram)
+ * @param d - dump
+ * @param dir - direction
+ * @param data - data
+ * @param len - its length
+ * @param stamp - timestamp (see timestamps.h) or 0 for current time
+ */
+void dump_writeat(dump_t *d, dumpdir dir, const uint8_t *data, size_t len, int64_t stamp){
+    if(!d || !data) return;
+    struct timespec ts;
+    if(stamp){
+        int64_t us = ts_toreal(stamp);
+        ts.tv_sec = us / 1000000;
+        ts.tv_nsec = (us % 1000000) * 1000;
+    }else clock_gettime(CLOCK_REALTIME, &ts);
+    const char *prefix = (dir == DUMP_RX) ? "< " : "> ";
+    size_t reclen = (d->format == DUMP_PCAPNG) ? EPBSIZE(len) : 2 + len;
+    pthread_mutex_lock(&d->mutex);
+    if(d->file && d->cursize > d->hdrsize &&
+       ((d->rotation.maxsize && d->cursize + reclen > d->rotation.maxsize) ||
+        (d->rotation.period && time(NULL) - d->tstart >= d->rotation.period))) rotate(d);
+    if(d->file){
+        if(d->format == DUMP_PCAPNG) pcapng_packet(d, dir, &ts, data, len);
+        else{
+            fwrite(prefix, 1, 2, d->file);
+            fwrite(data, 1, len, d->file);
+        }
+        d->cursize += reclen;
+    }
+    pthread_mutex_unlock(&d->mutex);
+}
+
+/**
+ * @brief dump_close - close dump file and wait while all closed segments would be compressed
+ * @param d - dump (NULL after closing)
+ */
+void dump_close(dump_t **d){
+    if(!d || !*d) return;
+    dump_t *D = *d;
+    if(D->file) fclose(D->file);
+    if(D->workerrun){
+        pthread_mutex_lock(&D->qmutex);
+        D->stopworker = 1;
+        pthread_cond_signal(&D->qcond);
+        pthread_mutex_unlock(&D->qmutex);
+        pthread_join(D->worker, NULL);
+    }
+    pthread_mutex_destroy(&D->mutex);
+    pthread_mutex_destroy(&D->qmutex);
+    pthread_cond_destroy(&D->qcond);
+    FREE(D->path);
+    FREE(D->ifname);
+    FREE(*d);
+}
@@ -0,0 +1,58 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef DUMPFILE_H__
+#define DUMPFILE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct{
+    size_t maxsize;     // rotate file when it's larger than this, bytes (0 - never)
+    int period;         // rotate file each `period` seconds (0 - never)
+    int keep;           // max amount of old segments (0 - keep all)
+    int compress;       // gzip closed segments
+} dumprot_t;
+
+typedef enum{
+    DUMP_TEXT,          // raw data with "< "/"> " prefixes
+    DUMP_PCAPNG         // pcapng: one block per chunk with timestamp and direction
+} dumpformat;
+
+typedef enum{
+    DUMP_RX,            // received data
+    DUMP_TX             // sent data
+} dumpdir;
+
+// parameters of dump
+typedef struct{
+    const char *path;   // file name (NULL - no dump)
+    dumpformat format;  // DUMP_TEXT or DUMP_PCAPNG
+    dumprot_t rot;      // rotation (all zeros - never)
+} dumppars_t;
+
+// opened dump file (each device has its own)
+typedef struct dump dump_t;
+
+dump_t *dump_open(const dumppars_t *p, const char *devname);
+void dump_write(dump_t *d, dumpdir dir, const uint8_t *data, size_t len);
+void dump_writeat(dump_t *d, dumpdir dir, const uint8_t *data, size_t len, int64_t stamp);
+void dump_close(dump_t **d);
+
+#endif // DUMPFILE_H__
@@ -0,0 +1,322 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "dbg.h"
+#include "filesend.h"
+#include "ncurses_and_readline.h"
+#include "string_functions.h"
+#include "ttysocket.h"
+
+// size of file portion for non-paced sending
+#define SENDBLOCK   (65536)
+// interval of progress updating, seconds
+#define PROGRESS_INTERVAL   (0.2)
+
+typedef struct{
+    int fd;             // file descriptor
+    char *name;         // file name (for status)
+    size_t size;        // file size
+    size_t sent;        // bytes sent (or processed in converted mode)
+    size_t outbytes;    // bytes sent in converted mode
+    size_t lineno;      // current line number
+    double t0;          // start time
+    sendfile_pars pars; // sending parameters
+} sfjob;
+
+static sfjob *job = NULL;
+static volatile int stopflag = 0;
+static pthread_mutex_t jobmutex = PTHREAD_MUTEX_INITIALIZER;
+
+// prompt waiting
+static strmatch_t *prompt = NULL;
+static int promptfound = 0;
+static pthread_mutex_t promptmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t promptcond = PTHREAD_COND_INITIALIZER;
+
+static void rxhook(_U_ ttyterm_t *t, const uint8_t *data, int len, _U_ void *arg){
+    pthread_mutex_lock(&promptmutex);
+    if(prompt && !promptfound && strmatch_feed(prompt, data, len)){
+        promptfound = 1;
+        pthread_cond_signal(&promptcond);
+    }
+    pthread_mutex_unlock(&promptmutex);
+}
+
+// forget about previous prompts before sending next line
+static void arm_prompt(){
+    pthread_mutex_lock(&promptmutex);
+    promptfound = 0;
+    strmatch_reset(prompt);
+    pthread_mutex_unlock(&promptmutex);
+}
+
+/**
+ * @brief wait_prompt - wait for prompt after line sent
+ * @param tmout - timeout, ms
+ * @return FALSE if timeout or stop
+ */
+static int wait_prompt(int tmout){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += tmout / 1000;
+    ts.tv_nsec += (tmout % 1000) * 1000000L;
+    if(ts.tv_nsec > 999999999L){ ++ts.tv_sec; ts.tv_nsec -= 1000000000L; }
+    pthread_mutex_lock(&promptmutex);
+    int rc = 0;
+    while(!promptfound && !stopflag && rc == 0)
+        rc = pthread_cond_timedwait(&promptcond, &promptmutex, &ts);
+    int ret = promptfound;
+    pthread_mutex_unlock(&promptmutex);
+    return ret;
+}
+
+static void progress(int force){
+    static double tlast = 0.;
+    double t = dtime();
+    if(!force && t - tlast < PROGRESS_INTERVAL) return;
+    tlast = t;
+    double dt = t - job->t0, speed = (dt > 0.) ? job->sent / dt : 0.;
+    set_status("SEND %s: %zd/%zd (%d%%) %.1f kB/s", job->name, job->sent, job->size,
+        job->size ? (int)(100. * job->sent / job->size) : 100, speed / 1024.);
+}
+
+// send data portion, return FALSE if failed
+static int sendportion(const uint8_t *data, size_t len){
+    while(len){
+        int l = SendData(data, len);
+        if(l < 1) return FALSE;
+        data += l; len -= l;
+    }
+    return TRUE;
+}
+
+// send whole file without pacing
+static const char *sendfast(){
+    off_t offset = 0;
+    while(job->sent < job->size && !stopflag){
+        size_t rest = job->size - job->sent;
+        ssize_t l = SendFromFile(job->fd, &offset, (rest > SENDBLOCK) ? SENDBLOCK : rest);
+        if(l < 0) return "device disconnected";
+        if(l == 0) return "can't send data";
+        job->sent += l;
+        progress(0);
+    }
+    return NULL;
+}
+
+// send file by parts: bytes, lines or blocks with delays between them
+static const char *sendpaced(){
+    sendfile_pars *p = &job->pars;
+    int lines = (p->linedelay || p->prompt || p->eolconv);
+    int eollen;
+    const char *eol = geteol(&eollen);
+    size_t blockpos = 0;
+    uint8_t *buf = MALLOC(uint8_t, SENDBLOCK);
+    const char *err = NULL;
+    while(job->sent < job->size && !stopflag && !err){
+        ssize_t got = read(job->fd, buf, SENDBLOCK);
+        if(got < 1){ err = "can't read file"; break; }
+        uint8_t *ptr = buf;
+        while(got > 0 && !stopflag){
+            size_t cut = got;
+            if(p->bytedelay) cut = 1;
+            if(p->blocksize && cut > (size_t)p->blocksize - blockpos) cut = p->blocksize - blockpos;
+            int eoline = FALSE;
+            if(lines){
+                uint8_t *nl = memchr(ptr, '\n', cut);
+                if(nl){
+                    cut = nl - ptr + 1;
+                    eoline = TRUE;
+                }
+            }
+            if(eoline && p->prompt) arm_prompt();
+            if(eoline && p->eolconv){
+                if((cut > 1 && !sendportion(ptr, cut - 1)) || !sendportion((const uint8_t*)eol, eollen)){
+                    err = "can't send data"; break;
+                }
+            }else if(!sendportion(ptr, cut)){
+                err = "can't send data"; break;
+            }
+            ptr += cut; got -= cut;
+            job->sent += cut;
+            progress(0);
+            if(eoline){
+                ++job->lineno;
+                if(p->prompt && !wait_prompt(p->prompttmout)){
+                    if(!stopflag) err = "no prompt";
+                    break;
+                }
+                if(p->linedelay) usleep(p->linedelay * 1000);
+            }
+            if(p->blocksize && (blockpos += cut) == (size_t)p->blocksize){
+                blockpos = 0;
+                if(p->blockdelay) usleep(p->blockdelay * 1000);
+            }
+            if(p->bytedelay) usleep(p->bytedelay);
+        }
+    }
+    FREE(buf);
+    return err;
+}
+
+// convert RAW or HEX file contents by portions and send them as soon as converted
+static const char *sendconv(){
+    sendfile_pars *p = &job->pars;
+    char *in = MALLOC(char, SENDBLOCK + 1);
+    uint8_t *out = MALLOC(uint8_t, SENDBLOCK);
+    size_t inlen = 0, blockpos = 0;
+    const char *err = NULL;
+    int eof = FALSE;
+    while(!eof && !stopflag && !err){
+        ssize_t got = read(job->fd, in + inlen, SENDBLOCK - inlen);
+        if(got < 0){ err = "can't read file"; break; }
+        if(got == 0) eof = TRUE;
+        inlen += got;
+        in[inlen] = 0;
+        size_t outlen, used = parse_input(p->convmode, in, inlen, out, &outlen, eof);
+        uint8_t *ptr = out;
+        while(outlen && !stopflag){
+            size_t cut = outlen;
+            if(p->bytedelay) cut = 1;
+            if(p->blocksize && cut > (size_t)p->blocksize - blockpos) cut = p->blocksize - blockpos;
+            if(!sendportion(ptr, cut)){
+                err = "can't send data"; break;
+            }
+            ptr += cut; outlen -= cut;
+            job->outbytes += cut;
+            if(p->blocksize && (blockpos += cut) == (size_t)p->blocksize){
+                blockpos = 0;
+                if(p->blockdelay) usleep(p->blockdelay * 1000);
+            }
+            if(p->bytedelay) usleep(p->bytedelay);
+        }
+        if(err || stopflag) break;
+        job->sent += used;
+        progress(0);
+        inlen -= used;
+        memmove(in, in + used, inlen);
+    }
+    FREE(in);
+    FREE(out);
+    return err;
+}
+
+static void *sender(_U_ void *arg){
+    sendfile_pars *p = &job->pars;
+    int paced = (p->bytedelay || p->linedelay || (p->blocksize && p->blockdelay) || p->prompt || p->eolconv);
+    if(p->prompt){
+        pthread_mutex_lock(&promptmutex);
+        prompt = strmatch_new(p->prompt, p->promptlen);
+        pthread_mutex_unlock(&promptmutex);
+        addrxhook(rxhook, NULL);
+    }
+    DBG("Start sending %s, paced=%d", job->name, paced);
+    const char *err = p->convmode != DISP_TEXT ? sendconv() : (paced ? sendpaced() : sendfast());
+    if(p->prompt){
+        delrxhook(rxhook, NULL);
+        pthread_mutex_lock(&promptmutex);
+        strmatch_free(&prompt);
+        pthread_mutex_unlock(&promptmutex);
+    }
+    progress(1);
+    double dt = dtime() - job->t0;
+    if(err) set_status("SEND %s: %s @ byte %zd (line %zd)", job->name, err, job->sent, job->lineno + 1);
+    else if(stopflag) set_status("SEND %s: stopped @ byte %zd", job->name, job->sent);
+    else{
+        size_t n = (p->convmode != DISP_TEXT) ? job->outbytes : job->sent;
+        set_status("SEND %s: %zd bytes in %.2fs (%.1f kB/s)", job->name, n, dt, (dt > 0.) ? n / dt / 1024. : 0.);
+    }
+    pthread_mutex_lock(&jobmutex);
+    close(job->fd);
+    FREE(job->pars.prompt);
+    FREE(job->name);
+    FREE(job);
+    pthread_mutex_unlock(&jobmutex);
+    return NULL;
+}
+
+/**
+ * @brief SendFile - start sending of file in separate thread
+ * @param path - file name
+ * @param pars - parameters of sending
+ * @return FALSE if can't start
+ */
+int SendFile(const char *path, const sendfile_pars *pars){
+    if(!path || !pars) return FALSE;
+    if(pars->convmode != DISP_TEXT && pars->convmode != DISP_RAW && pars->convmode != DISP_HEX) return FALSE;
+    pthread_mutex_lock(&jobmutex);
+    if(job){
+        pthread_mutex_unlock(&jobmutex);
+        set_status("Previous transfer isn't over");
+        return FALSE;
+    }
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st)){
+        if(fd > -1) close(fd);
+        pthread_mutex_unlock(&jobmutex);
+        set_status("Can't open %s: %s", path, strerror(errno));
+        return FALSE;
+    }
+    job = MALLOC(sfjob, 1);
+    job->fd = fd;
+    job->name = strdup(path);
+    job->size = st.st_size;
+    job->pars = *pars;
+    if(pars->prompt){
+        job->pars.prompt = MALLOC(uint8_t, pars->promptlen);
+        memcpy(job->pars.prompt, pars->prompt, pars->promptlen);
+    }
+    if(job->pars.prompttmout < 1) job->pars.prompttmout = 1000;
+    job->t0 = dtime();
+    stopflag = 0;
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, sender, NULL)){
+        close(fd);
+        FREE(job->pars.prompt);
+        FREE(job->name);
+        FREE(job);
+        pthread_mutex_unlock(&jobmutex);
+        set_status("Can't run sending thread");
+        return FALSE;
+    }
+    pthread_detach(thread);
+    pthread_mutex_unlock(&jobmutex);
+    return TRUE;
+}
+
+// stop current transfer
+void SendFileStop(){
+    stopflag = 1;
+    pthread_mutex_lock(&promptmutex);
+    pthread_cond_signal(&promptcond);
+    pthread_mutex_unlock(&promptmutex);
+}
+
+int SendFileActive(){
+    pthread_mutex_lock(&jobmutex);
+    int r = (job != NULL);
+    pthread_mutex_unlock(&jobmutex);
+    return r;
+}
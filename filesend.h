@@ -0,0 +1,43 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef FILESEND_H__
+#define FILESEND_H__
+
+#include <stdint.h>
+
+#include "ncurses_and_readline.h"
+
+typedef struct{
+    int bytedelay;      // delay after each byte, us
+    int linedelay;      // delay after each line, ms
+    int blocksize;      // size of block for `blockdelay`, bytes
+    int blockdelay;     // delay after each block, ms
+    uint8_t *prompt;    // wait for this pattern after each line (or NULL)
+    size_t promptlen;   // length of `prompt`
+    int prompttmout;    // timeout of prompt waiting, ms
+    int eolconv;        // convert '\n' in file into current EOL
+    disptype convmode;  // DISP_RAW or DISP_HEX: send file contents converted like user input (DISP_TEXT - as is)
+} sendfile_pars;
+
+int SendFile(const char *path, const sendfile_pars *pars);
+void SendFileStop();
+int SendFileActive();
+
+#endif // FILESEND_H__
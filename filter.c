@@ -0,0 +1,98 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Filter of displayed lines: each line is checked once when it's finished, so the list of
+ * matching lines is always ready.
+ */
+
+#define _GNU_SOURCE // memmem()
+#include <string.h>
+
+#include "dbg.h"
+#include "filter.h"
+#include "string_functions.h"
+
+/**
+ * @brief filter_new - make new filter
+ * @param type - type of pattern
+ * @param pattern - substring, regex or bytes (with escapes like in TEXT mode)
+ * @param invert - TRUE to get lines which don't match
+ * @return filter or NULL if pattern is wrong
+ */
+filter_t *filter_new(filtertype type, const char *pattern, int invert){
+    if(!pattern || !*pattern) return NULL;
+    filter_t *f = MALLOC(filter_t, 1);
+    f->type = type;
+    f->invert = invert;
+    switch(type){
+        case FILTER_SUBSTR:
+        break;
+        case FILTER_REGEX:
+            if(regcomp(&f->re, pattern, REG_EXTENDED | REG_NOSUB)){
+                FREE(f);
+                return NULL;
+            }
+        break;
+        case FILTER_BYTES:
+            f->bytes = unescape(pattern, &f->nbytes);
+            if(!f->bytes || !f->nbytes){
+                FREE(f->bytes);
+                FREE(f);
+                return NULL;
+            }
+        break;
+        default:
+            FREE(f);
+            return NULL;
+    }
+    f->pattern = strdup(pattern);
+    return f;
+}
+
+void filter_free(filter_t **f){
+    if(!f || !*f) return;
+    if((*f)->type == FILTER_REGEX) regfree(&(*f)->re);
+    FREE((*f)->bytes);
+    FREE((*f)->pattern);
+    FREE(*f);
+}
+
+/**
+ * @brief filter_match - check line
+ * @param f - filter
+ * @param line - displayed line (zero-terminated)
+ * @param raw - received data shown in this line
+ * @param rawlen - its length
+ * @return TRUE if line should be shown
+ */
+int filter_match(const filter_t *f, const char *line, const uint8_t *raw, size_t rawlen){
+    int found = FALSE;
+    switch(f->type){
+        case FILTER_SUBSTR:
+            found = (NULL != strstr(line, f->pattern));
+        break;
+        case FILTER_REGEX:
+            found = (0 == regexec(&f->re, line, 0, NULL, 0));
+        break;
+        case FILTER_BYTES:
+            found = (rawlen >= f->nbytes && NULL != memmem(raw, rawlen, f->bytes, f->nbytes));
+        break;
+    }
+    return f->invert ? !found : found;
+}
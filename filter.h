@@ -0,0 +1,46 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef FILTER_H__
+#define FILTER_H__
+
+#include <regex.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum{ // what to search in line
+    FILTER_SUBSTR,  // substring of displayed line
+    FILTER_REGEX,   // extended regular expression (in displayed line)
+    FILTER_BYTES    // byte sequence in received data of line (written with escapes like in TEXT mode)
+} filtertype;
+
+typedef struct{
+    filtertype type;
+    int invert;         // show lines which don't match
+    char *pattern;      // pattern as it was entered
+    regex_t re;         // compiled regex
+    uint8_t *bytes;     // byte sequence
+    size_t nbytes;      // and its length
+} filter_t;
+
+filter_t *filter_new(filtertype type, const char *pattern, int invert);
+void filter_free(filter_t **f);
+int filter_match(const filter_t *f, const char *line, const uint8_t *raw, size_t rawlen);
+
+#endif // FILTER_H__
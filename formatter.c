@@ -0,0 +1,510 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Formatting of raw data like it is shown in scrollback (without curses), export into file.
+ * Export splits data into segments which could be formatted independently: each segment starts
+ * from new line (after '\n' in TEXT, at line boundary of current chunk in RAW and HEX, or at chunk start).
+ * Segments are formatted by worker threads and written in order by caller.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wchar.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "dbg.h"
+#include "formatter.h"
+
+// nominal size of data segment for one worker job
+#define SEGSZ       (4*1024*1024)
+// max amount of worker threads
+#define MAXTHREADS  (32)
+
+static const char hexdig[] = "0123456789ABCDEF";
+
+/**
+ * @brief fmt_linelen - get max amount of symbols in line
+ * @param type - display type
+ * @param cols - screen width
+ * @return amount of columns in TEXT/RAW or amount of bytes in HEX line
+ */
+size_t fmt_linelen(disptype type, int cols){
+    int maxcols = (cols > MAXCOLS) ? MAXCOLS : cols;
+    if(type != DISP_HEX) return (maxcols > 0) ? maxcols : 1;
+    int n = maxcols - HEXDSPACES; // space for data
+    n -= n/8; // spaces after each 8 symbols
+    n /= 4; // hex XX + space + symbol view
+    // n should be 1..4, 8 or 16x
+    if(n < 1) n = 1; // minimal - one symbol per string
+    else if(n > 4){
+        if(n < 8) n = 4;
+        //else if(n < 16) n = 8;
+        else n -= n % 8;
+    }
+    return n;
+}
+
+/**
+ * @brief fmt_hexline - format one hexdump line
+ * @param buf - output buffer (zero-terminated)
+ * @param data - data
+ * @param n - its length (not more than `linelen`)
+ * @param linelen - max bytes in line
+ * @param address - address of first byte
+ * @return length of line
+ */
+int fmt_hexline(char *buf, const uint8_t *data, size_t n, size_t linelen, size_t address){
+    char *ptr = buf;
+    int nd = 8; // address is "%-10.8zX"
+    while(nd < 16 && (address >> (4*nd))) ++nd;
+    for(int i = nd - 1; i > -1; --i) *ptr++ = hexdig[(address >> (4*i)) & 0xf];
+    for(; nd < 10; ++nd) *ptr++ = ' ';
+    char *ascii = ptr + 3*linelen + (linelen + 7)/8 + 1; // ASCII view after hex
+    for(size_t i = 0; i < n; ++i){
+        if(0 == (i % 8)) *ptr++ = ' ';
+        uint8_t c = data[i];
+        *ptr++ = hexdig[c >> 4];
+        *ptr++ = hexdig[c & 0xf];
+        *ptr++ = ' ';
+        ascii[i] = (c > 31 && c < 127) ? c : '.';
+    }
+    int emptyvals = (int)(linelen - n);
+    for(int i = 3*emptyvals + emptyvals/8; i > 0; --i) *ptr++ = ' ';
+    *ptr++ = '|';
+    if(ptr != ascii) memmove(ptr, ascii, n); // there's less spaces than we reserved
+    ptr += n;
+    for(size_t i = n; i < linelen; ++i) *ptr++ = ' ';
+    *ptr++ = '|';
+    *ptr = 0;
+    return (int)(ptr - buf);
+}
+
+/**
+ * @brief fmt_label - copy label replacing non-printable symbols by '?'
+ * @param buf - output buffer (zero-terminated)
+ * @param label - label
+ * @param max - max length
+ * @return length of label in `buf`
+ */
+size_t fmt_label(char *buf, const char *label, size_t max){
+    size_t n = 0;
+    if(label) for(; n < max && label[n]; ++n)
+        buf[n] = (label[n] < 32 || label[n] > 126) ? '?' : label[n];
+    buf[n] = 0;
+    return n;
+}
+
+/**
+ * @brief fmt_ascii_run - get length of printable ASCII symbols sequence
+ * @param s - data
+ * @param len - its length
+ * @return amount of printable ASCII symbols from start of `s`
+ */
+int fmt_ascii_run(const uint8_t *s, int len){
+    int n = 0;
+#ifdef __SSE2__
+    const __m128i lo = _mm_set1_epi8(31), hi = _mm_set1_epi8(127);
+    for(; n + 16 <= len; n += 16){ // bytes > 127 are negative in signed comparison
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + n));
+        int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi)));
+        if(mask != 0xffff) return n + __builtin_ctz(~mask);
+    }
+#endif
+    for(; n < len; ++n) if(s[n] < 32 || s[n] > 126) break;
+    return n;
+}
+
+/**
+ * @brief fmt_utf8_decode - check and decode UTF-8 symbol
+ * @param s - data
+ * @param len - its length
+ * @param wc (o) - symbol code
+ * @return length of symbol, 0 if it is incomplete or -1 if it is wrong
+ */
+int fmt_utf8_decode(const uint8_t *s, int len, uint32_t *wc){
+    uint8_t c = *s, min = 0x80, max = 0xBF;
+    int n;
+    if(c < 0xC2) return -1; // ASCII, continuation byte or overlong
+    else if(c < 0xE0){ n = 2; *wc = c & 0x1F; }
+    else if(c < 0xF0){
+        n = 3; *wc = c & 0x0F;
+        if(c == 0xE0) min = 0xA0; // overlong
+        else if(c == 0xED) max = 0x9F; // surrogates
+    }else if(c < 0xF5){
+        n = 4; *wc = c & 0x07;
+        if(c == 0xF0) min = 0x90; // overlong
+        else if(c == 0xF4) max = 0x8F; // > U+10FFFF
+    }else return -1;
+    for(int i = 1; i < n; ++i){
+        if(i == len) return 0;
+        c = s[i];
+        if(c < min || c > max) return -1;
+        min = 0x80; max = 0xBF;
+        *wc = (*wc << 6) | (c & 0x3F);
+    }
+    return n;
+}
+
+/**
+ * @brief fmt_textline - format one line in TEXT mode (rules are the same as for scrollback)
+ * @param p - parameters
+ * @param data - data from line start
+ * @param len - its length
+ * @param col - amount of columns (and bytes) already occupied by label
+ * @param l (o) - formatted line
+ * @return amount of bytes used (incomplete UTF-8 symbol at the end is shown as wrong)
+ */
+size_t fmt_textline(const fmtpars_t *p, const uint8_t *data, size_t len, size_t col, fmtline_t *l){
+    const uint8_t *start = data;
+    size_t maxbytes = MAXLINEBYTES - 2 - col;
+    l->len = 0;
+    l->width = col;
+    l->full = FALSE;
+    while(len){
+        if(l->width == p->linelen){
+            l->full = TRUE;
+            break;
+        }
+        size_t n = fmt_ascii_run(data, (len > MAXLINEBYTES) ? MAXLINEBYTES : (int)len); // line can't be longer
+        if(n){ // copy printable ASCII up to end of line
+            size_t ncp = (l->width < p->linelen) ? p->linelen - l->width : 0;
+            if(maxbytes - l->len < ncp) ncp = maxbytes - l->len;
+            if(n < ncp) ncp = n;
+            if(ncp < 1){
+                l->full = TRUE;
+                break;
+            }
+            memcpy(l->buf + l->len, data, ncp);
+            l->len += ncp;
+            l->width += ncp;
+            data += ncp; len -= ncp;
+            continue;
+        }
+        if(*data == '\n'){
+            ++data;
+            l->full = TRUE;
+            break;
+        }
+        uint32_t wc;
+        int w = -1, nb = p->utf8 ? fmt_utf8_decode(data, (len > 4) ? 4 : (int)len, &wc) : -1;
+        if(nb > 0) w = wcwidth((wchar_t)wc);
+        const uint8_t *sym = data;
+        size_t used = nb; // amount of input bytes
+        char hex[4];
+        if(w < 0){ // control symbol, wrong or incomplete sequence
+            hex[0] = '\\'; hex[1] = 'x'; hex[2] = hexdig[*data >> 4]; hex[3] = hexdig[*data & 0xf];
+            sym = (const uint8_t*)hex;
+            nb = 4; w = 4;
+            used = 1;
+        }
+        if(l->width && (l->width + w > p->linelen || l->len + nb > maxbytes)){
+            l->full = TRUE;
+            break;
+        }
+        memcpy(l->buf + l->len, sym, nb);
+        l->len += nb;
+        l->width += w;
+        data += used; len -= used;
+    }
+    l->buf[l->len] = 0;
+    return data - start;
+}
+
+/**
+ * @brief fmt_rawline - format bytes in RAW mode
+ * @param buf - output buffer (zero-terminated)
+ * @param data - data
+ * @param n - its length
+ * @return length of line
+ */
+int fmt_rawline(char *buf, const uint8_t *data, size_t n){
+    char *ptr = buf;
+    for(size_t i = 0; i < n; ++i){
+        *ptr++ = hexdig[data[i] >> 4];
+        *ptr++ = hexdig[data[i] & 0xf];
+        *ptr++ = ' ';
+    }
+    *ptr = 0;
+    return (int)(ptr - buf);
+}
+
+// formatted output of one segment
+typedef struct{
+    const fmtpars_t *p;
+    char *buf;              // formatted data
+    size_t len;             // its length
+    size_t size;            // size of `buf`
+    size_t lastlen;         // amount of symbols in last line
+} fmtctx_t;
+
+static void reserve(fmtctx_t *c, size_t n){
+    if(c->size - c->len >= n) return;
+    c->size = (c->size + n) * 2;
+    c->buf = realloc(c->buf, c->size);
+    if(!c->buf) ERR("realloc()");
+}
+
+static void newline(fmtctx_t *c){
+    reserve(c, 1);
+    c->buf[c->len++] = '\n';
+    c->lastlen = 0;
+}
+
+static void text_range(fmtctx_t *c, const uint8_t *data, size_t len){
+    fmtline_t l;
+    while(len){
+        size_t n = fmt_textline(c->p, data, len, c->lastlen, &l);
+        reserve(c, l.len);
+        memcpy(c->buf + c->len, l.buf, l.len);
+        c->len += l.len;
+        c->lastlen = l.width;
+        if(l.full) newline(c);
+        data += n; len -= n;
+    }
+}
+
+// RAW: "XX " for each byte
+static void raw_range(fmtctx_t *c, const uint8_t *data, size_t len){
+    while(len){
+        size_t n = (c->p->linelen - c->lastlen) / 3;
+        if(n == 0){
+            if(c->lastlen){
+                newline(c);
+                continue;
+            }
+            n = 1; // too narrow screen
+        }
+        if(n > len) n = len;
+        reserve(c, 3*n + 1);
+        c->len += fmt_rawline(c->buf + c->len, data, n);
+        c->lastlen += 3*n;
+        data += n; len -= n;
+        if(c->lastlen == c->p->linelen) newline(c);
+    }
+}
+
+// HEX: `offset` - offset of `data` in its chunk (multiple of `linelen`)
+static void hex_range(fmtctx_t *c, const uint8_t *data, size_t len, size_t offset){
+    size_t linelen = c->p->linelen;
+    while(len){
+        size_t n = (len > linelen) ? linelen : len;
+        reserve(c, MAXLINEBYTES);
+        c->len += fmt_hexline(c->buf + c->len, data, n, linelen, offset);
+        newline(c);
+        data += n; len -= n; offset += n;
+    }
+}
+
+static void format_range(fmtctx_t *c, const uint8_t *data, size_t len, size_t offset){
+    switch(c->p->type){
+        case DISP_TEXT: text_range(c, data, len); break;
+        case DISP_RAW:  raw_range(c, data, len); break;
+        case DISP_HEX:  hex_range(c, data, len, offset); break;
+        default: break;
+    }
+}
+
+static void startchunk(fmtctx_t *c, const char *label){
+    if(c->lastlen) newline(c);
+    if(!label || !*label) return;
+    size_t max = (c->p->type == DISP_HEX) ? c->p->cols : c->p->linelen;
+    if(max > MAXCOLS) max = MAXCOLS;
+    reserve(c, max + 2);
+    size_t n = fmt_label(c->buf + c->len, label, max);
+    c->len += n;
+    if(c->p->type == DISP_HEX) newline(c); // hexdump lines are full: label is on its own line
+    else c->lastlen = n;
+}
+
+typedef struct{
+    const fmtpars_t *p;
+    const uint8_t *data;    // all raw data
+    size_t len;             // its length
+    const rawmark_t *marks; // chunks
+    size_t nmarks;          // their amount
+    size_t *splits;         // segment `i` is [splits[i], splits[i+1])
+    size_t nseg;            // amount of segments
+    fmtctx_t *out;          // formatted segments
+    uint8_t *done;          // segment is formatted
+    size_t next;            // next segment to format
+    size_t written;         // amount of segments written by caller
+    size_t window;          // max amount of formatted but not written segments
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} fmtjob_t;
+
+// index of first mark with offset > pos (or >= pos if `incl`)
+static size_t findmark(const fmtjob_t *j, size_t pos, int incl){
+    size_t lo = 0, hi = j->nmarks;
+    while(lo < hi){
+        size_t mid = (lo + hi) / 2;
+        if(j->marks[mid].offset < pos || (!incl && j->marks[mid].offset == pos)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// first position >= pos where line starts
+static size_t nextsplit(const fmtjob_t *j, size_t pos){
+    size_t m = findmark(j, pos, FALSE);
+    size_t cs = m ? j->marks[m-1].offset : 0, next = (m < j->nmarks) ? j->marks[m].offset : j->len;
+    size_t linelen = j->p->linelen, off = pos - cs, res = next;
+    switch(j->p->type){
+        case DISP_TEXT:{
+            const uint8_t *nl = memchr(j->data + pos, '\n', next - pos);
+            if(nl) res = nl - j->data + 1;
+        }
+        break;
+        case DISP_RAW:{
+            size_t b = linelen / 3, f = b;
+            if(m && *j->marks[m-1].label){ // first line of chunk is shortened by its label
+                char lbl[LABELSZ];
+                f = (linelen - fmt_label(lbl, j->marks[m-1].label, linelen)) / 3;
+            }
+            if(b == 0) break;
+            if(off <= f) res = cs + f;
+            else res = cs + f + (off - f + b - 1) / b * b;
+        }
+        break;
+        case DISP_HEX:
+            res = cs + (off + linelen - 1) / linelen * linelen;
+        break;
+        default:
+        break;
+    }
+    return (res < next) ? res : next;
+}
+
+// format segment `i`
+static void format_segment(fmtjob_t *j, size_t i){
+    fmtctx_t *c = &j->out[i];
+    c->p = j->p;
+    size_t s = j->splits[i], e = j->splits[i+1];
+    size_t m = findmark(j, s, TRUE); // first chunk started in this segment
+    size_t cs = m ? j->marks[m-1].offset : 0, pos = s;
+    while(1){
+        int last = (m >= j->nmarks || j->marks[m].offset > e || (j->marks[m].offset == e && e != j->len));
+        size_t end = last ? e : j->marks[m].offset;
+        format_range(c, j->data + pos, end - pos, pos - cs);
+        if(last) break;
+        startchunk(c, j->marks[m].label);
+        cs = pos = end;
+        ++m;
+    }
+    if(c->lastlen) newline(c);
+}
+
+static void *worker(void *arg){
+    fmtjob_t *j = (fmtjob_t*)arg;
+    pthread_mutex_lock(&j->mutex);
+    while(j->next < j->nseg){
+        if(j->next >= j->written + j->window){ // caller is too slow
+            pthread_cond_wait(&j->cond, &j->mutex);
+            continue;
+        }
+        size_t i = j->next++;
+        pthread_mutex_unlock(&j->mutex);
+        format_segment(j, i);
+        pthread_mutex_lock(&j->mutex);
+        j->done[i] = 1;
+        pthread_cond_broadcast(&j->cond);
+    }
+    pthread_mutex_unlock(&j->mutex);
+    return NULL;
+}
+
+/**
+ * @brief fmt_export - format all data like it is shown in scrollback and save it
+ * @param path - output file
+ * @param p - formatting parameters
+ * @param data - raw data
+ * @param len - its length
+ * @param marks - chunks of data
+ * @param nmarks - their amount
+ * @param nthreads - amount of worker threads (0 - by amount of CPUs)
+ * @return FALSE if failed
+ */
+int fmt_export(const char *path, const fmtpars_t *p, const uint8_t *data, size_t len,
+               const rawmark_t *marks, size_t nmarks, int nthreads){
+    if(!path || !p || p->type > DISP_HEX || p->linelen < 1) return FALSE;
+    FILE *f = fopen(path, "w");
+    if(!f){
+        WARN("Can't create %s", path);
+        return FALSE;
+    }
+    fmtjob_t j = {.p = p, .data = data, .len = len, .marks = marks, .nmarks = nmarks};
+    size_t nsplits = len / SEGSZ + 2;
+    j.splits = MALLOC(size_t, nsplits);
+    size_t pos = 0;
+    do{
+        j.splits[j.nseg++] = pos;
+        size_t nom = pos + SEGSZ;
+        pos = (nom >= len) ? len : nextsplit(&j, nom); // all segments except last are >= SEGSZ
+    }while(pos < len);
+    j.splits[j.nseg] = len;
+    j.out = MALLOC(fmtctx_t, j.nseg);
+    j.done = MALLOC(uint8_t, j.nseg);
+    if(nthreads < 1) nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(nthreads < 1) nthreads = 1;
+    else if(nthreads > MAXTHREADS) nthreads = MAXTHREADS;
+    if((size_t)nthreads > j.nseg) nthreads = (int)j.nseg;
+    j.window = 2 * nthreads;
+    DBG("Export %zd bytes: %zd segments, %d threads", len, j.nseg, nthreads);
+    pthread_mutex_init(&j.mutex, NULL);
+    pthread_cond_init(&j.cond, NULL);
+    pthread_t threads[MAXTHREADS];
+    int nrun = 0;
+    if(nthreads > 1) for(; nrun < nthreads; ++nrun)
+        if(pthread_create(&threads[nrun], NULL, worker, &j)){
+            WARN("pthread_create()");
+            break;
+        }
+    int ret = TRUE;
+    for(size_t i = 0; i < j.nseg; ++i){
+        if(nrun == 0) format_segment(&j, i); // single-threaded
+        else{
+            pthread_mutex_lock(&j.mutex);
+            while(!j.done[i]) pthread_cond_wait(&j.cond, &j.mutex);
+            pthread_mutex_unlock(&j.mutex);
+        }
+        fmtctx_t *c = &j.out[i];
+        if(ret && c->len && fwrite(c->buf, 1, c->len, f) != c->len){
+            WARN("Can't write %s", path);
+            ret = FALSE;
+        }
+        FREE(c->buf);
+        pthread_mutex_lock(&j.mutex);
+        j.written = i + 1;
+        pthread_cond_broadcast(&j.cond);
+        pthread_mutex_unlock(&j.mutex);
+    }
+    for(int i = 0; i < nrun; ++i) pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&j.mutex);
+    pthread_cond_destroy(&j.cond);
+    if(fclose(f)) ret = FALSE;
+    FREE(j.splits);
+    FREE(j.out);
+    FREE(j.done);
+    return ret;
+}
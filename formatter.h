@@ -0,0 +1,68 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef FORMATTER_H__
+#define FORMATTER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ttyterm.h"
+
+// maximal columns in line
+#define MAXCOLS      (512)
+// maximal length of line in bytes (UTF-8 symbols could be up to 4 bytes per column)
+#define MAXLINEBYTES (MAXCOLS*4)
+// amount of spaces and delimeters in hexview string (address + 2 lines + 3 additional spaces)
+#define HEXDSPACES   (13)
+
+// mark of chunk (e.g. datagram) in raw data: it starts from new line with label
+#define LABELSZ     (96)
+typedef struct{
+    size_t offset;          // position in raw data
+    char label[LABELSZ];    // text to show before data
+    chunktype type;         // type of chunk
+    int64_t stamp;          // its time (see timestamps.h)
+} rawmark_t;
+
+typedef struct{
+    disptype type;          // DISP_TEXT, DISP_RAW or DISP_HEX
+    size_t cols;            // screen width
+    size_t linelen;         // max symbols in line (see `fmt_linelen()`)
+    int utf8;               // decode UTF-8 in TEXT mode
+} fmtpars_t;
+
+typedef struct{
+    char buf[MAXLINEBYTES]; // formatted line
+    size_t len;             // its length in bytes
+    size_t width;           // its width on screen (including label)
+    int full;               // line is over (next data should be shown from new line)
+} fmtline_t;
+
+size_t fmt_linelen(disptype type, int cols);
+int fmt_hexline(char *buf, const uint8_t *data, size_t n, size_t linelen, size_t address);
+size_t fmt_textline(const fmtpars_t *p, const uint8_t *data, size_t len, size_t col, fmtline_t *l);
+int fmt_rawline(char *buf, const uint8_t *data, size_t n);
+size_t fmt_label(char *buf, const char *label, size_t max);
+int fmt_ascii_run(const uint8_t *s, int len);
+int fmt_utf8_decode(const uint8_t *s, int len, uint32_t *wc);
+int fmt_export(const char *path, const fmtpars_t *p, const uint8_t *data, size_t len,
+               const rawmark_t *marks, size_t nmarks, int nthreads);
+
+#endif // FORMATTER_H__
@@ -19,9 +19,22 @@
 #include <signal.h>
 #include <stdio.h>
 #include <string.h> // strcmp
+#include <sys/socket.h> // SOCK_DGRAM
+#include <unistd.h> // write
+#include "autobaud.h"
+#include "checksum.h"
 #include "cmdlnopts.h"
+#include "ctlsock.h"
+#include "dumpfile.h"
+#include "modbus.h"
 #include "ncurses_and_readline.h"
+#include "oneshot.h"
+#include "ptybridge.h"
+#include "script.h"
+#include "sniffer.h"
+#include "string_functions.h"
 #include "ttysocket.h"
+#include "viewer.h"
 
 #include "dbg.h"
 
@@ -29,6 +42,10 @@ static chardevice conndev = {.dev = NULL, .mutex = PTHREAD_MUTEX_INITIALIZER, .n
 
 void signals(int signo){
     signal(signo, SIG_IGN);
+    PtyBridgeStop();
+    SnifferStop();
+    CtlStop();
+    ViewerStop();
     closedev();
     deinit_ncurses();
     deinit_readline();
@@ -44,6 +61,11 @@ int main(int argc, char **argv){
 #endif
     G = parse_args(argc, argv);
     if(G->tmoutms < 0) ERRX("Timeout should be >= 0");
+    if(G->view){ // offline viewer
+        signal(SIGTERM, signals);
+        signal(SIGHUP, signals);
+        return ViewFile(G->view) ? 0 : 1;
+    }
     const char *EOL = "\n", *seol = "\\n";
     if(strcasecmp(G->eol, "n")){
         if(strcasecmp(G->eol, "r") == 0){ EOL = "\r"; seol = "\\r"; }
@@ -66,38 +88,126 @@ int main(int argc, char **argv){
             conndev.port = strdup(G->port);
             conndev.type = DEV_NETSOCKET;
         }
+        if(G->dgram && G->seqpacket) ERRX("Point only one of --dgram and --seqpacket");
+        if(G->dgram) conndev.socktype = SOCK_DGRAM;
+        else if(G->seqpacket) conndev.socktype = SOCK_SEQPACKET;
+        else if(G->bindsock) ERRX("--bind works only with --dgram or --seqpacket");
+        conndev.bindsock = G->bindsock;
+        conndev.rcvbuf = G->rcvbuf;
         DBG("socket port=%s, type=%d", conndev.port, conndev.type);
     }else{
+        if(G->dgram || G->seqpacket || G->bindsock || G->rcvbuf) ERRX("Datagram options are only for sockets");
         conndev.speed = G->speed;
         conndev.port = strdup(G->serformat); // `port` of tty is serial format
         DBG("speed=%d, format=%s", conndev.speed, conndev.port);
     }
-    if(!opendev(&conndev, G->dumpfile)){
+    dumppars_t dump = {.path = G->dumpfile, .format = DUMP_TEXT};
+    if(G->dumpsize < 0 || G->dumptime < 0 || G->dumpkeep < 0) ERRX("Dump rotation parameters should be >= 0");
+    if(G->dumpsize || G->dumptime){
+        if(!G->dumpfile) ERRX("Point dump file for rotation");
+        dump.rot = (dumprot_t){.maxsize = (size_t)G->dumpsize * 1024 * 1024, .period = G->dumptime,
+                         .keep = G->dumpkeep, .compress = G->dumpgzip};
+    }else if(G->dumpkeep || G->dumpgzip) ERRX("--dumpkeep and --dumpgzip work only with rotation");
+    if(G->pcapng){
+        if(!G->dumpfile) ERRX("Point dump file for pcapng");
+        dump.format = DUMP_PCAPNG;
+    }
+    if(!opendev(&conndev, &dump)){
         signals(0);
     }
+    if(G->autobaud){
+        if(conndev.type != DEV_TTY) ERRX("Autobaud works only for serial devices");
+        autobaud_pars ab = {.extra = G->baudlist, .budget = G->abtime};
+        ab.probe = unescape(G->probe, &ab.probelen);
+        ab.expect = unescape(G->expect, &ab.expectlen);
+        int speed = Autobaud(&ab, conndev.speed);
+        if(speed) conndev.speed = speed;
+        FREE(ab.probe);
+        FREE(ab.expect);
+    }
+    if(G->packets){
+        if(G->packets < 0 || !SetFrameGap(G->packets)) ERRX("--packets should be > 0 and works only for serial devices");
+    }
+    if(G->pty && G->sniff) ERRX("Point only one of --pty and --sniff");
+    if(G->exec && (G->script || G->pty || G->sniff || G->ctlsock))
+        ERRX("--exec can't be used with --script, --pty, --sniff or --ctlsock");
+    if(G->pty && !PtyBridgeStart(G->pty)) signals(0);
+    if(G->sniff){
+        if(conndev.type != DEV_TTY) ERRX("Sniffer works only with serial devices");
+        if(!SnifferStart(&conndev, G->sniff, G->framegap)) signals(0);
+    }
+    if(G->ctlsock && !CtlStart(&conndev, G->ctlsock)) signals(0);
+    if(!TrackModbus(set_status)) WARNX(_("Can't add Modbus decoder")); // show decoded responses in status string
+    if(G->cksum){
+        cspars_t cs;
+        if(!cs_parse(G->cksum, &cs)) ERRX("Wrong checksum: %s", G->cksum);
+        SetTxChecksum(&cs);
+        if(!SetRxChecksum(&cs)) // checksum of sent data is set anyway
+            WARNX(_("Received data isn't checked: it works only with datagram sockets or --packets"));
+    }
+    if(G->exec){ // one-shot transaction without UI
+        exec_pars ep = {.data = G->exec, .wait = G->wait};
+        ep.mode = str2mode(G->execmode);
+        if(ep.mode == DISP_UNCHANGED) ERRX("Wrong --execmode: %s", G->execmode);
+        if(ep.wait < 0) ERRX("--wait should be >= 0");
+        ep.until = unescape(G->until, &ep.untillen);
+        signal(SIGTERM, signals);
+        signal(SIGINT, signals);
+        signal(SIGPIPE, SIG_IGN);
+        int ret = ExecOnce(&ep);
+        FREE(ep.until);
+        closedev();
+        return ret;
+    }
+    if(G->script){ // run script without UI: all received data goes to stdout
+        if(!script_run(G->script, G->scriptlog, TRUE)) signals(1);
+        signal(SIGTERM, signals);
+        signal(SIGINT, signals);
+        signal(SIGPIPE, SIG_IGN);
+        int t;
+        while((t = script_poll()) > -1 || script_active()){
+            settimeout((t > -1 && t < G->tmoutms) ? t : G->tmoutms);
+            int l;
+            uint8_t *buf = ReadData(&l);
+            if(buf && l > 0){
+                if(write(STDOUT_FILENO, buf, l) != l) WARN("write()");
+            }else if(l < 0) ERRX("Device disconnected");
+        }
+        CtlStop();
+        closedev();
+        return script_result();
+    }
     init_ncurses();
-    init_readline();
+    init_readline(G->pastesend);
     signal(SIGTERM, signals); // kill (-15) - quit
     signal(SIGHUP, signals);  // hup - quit
     signal(SIGINT, signals);  // ctrl+C - quit
     signal(SIGQUIT, signals); // ctrl+\ - quit
     signal(SIGTSTP, SIG_IGN); // ignore ctrl+Z
+    signal(SIGPIPE, SIG_IGN); // sendfile() to closed socket
     pthread_t writer;
     if(pthread_create(&writer, NULL, cmdline, (void*)&conndev)) ERR("pthread_create()");
     settimeout(G->tmoutms);
     while(1){
+        int t = script_poll(); // don't sleep in select() longer than script needs
+        int l = 0;
+        settimeout((t > -1 && t < G->tmoutms) ? t : G->tmoutms);
         if(0 == pthread_mutex_lock(&conndev.mutex)){
-            int l;
             uint8_t *buf = ReadData(&l);
-            if(buf && l > 0){
-                AddData(buf, l);
-            }else if(l < 0){
+            const dgram_t *dg;
+            int n = GetDgrams(&dg);
+            if(n > 0) AddDgrams(dg, n); // one line per datagram
+            else if(buf && l > 0){
+                if(GetFrameGap()) AddFrame(buf, l, GetRxStamp(), GetRxGap()); // one line per frame
+                else AddData(buf, l, GetRxStamp());
+            }else if(l < 0 || !PtyBridgeFlush() || !SnifferFlush()){ // PTY bridge or sniffer reads device by itself
                 pthread_mutex_unlock(&conndev.mutex);
                 ERRX("Device disconnected");
             }
             pthread_mutex_unlock(&conndev.mutex);
         }
-        usleep(1000);
+        // in packet mode frames are read by separate thread: take all of them without delay
+        if(l < 1 || !GetFrameGap()) usleep(1000);
     }
     // never reached
     return 0;
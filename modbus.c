@@ -0,0 +1,315 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Modbus ASCII (':' + hex + LRC + CRLF) and Modbus TCP (MBAP header) framing of requests entered
+ * as `ID data` (like RTU). Tracker of device (see `tt_mbtrack()`) remembers requests by transaction
+ * ID (TCP) or as one pending request (ASCII), decodes responses from received stream, matches them
+ * to requests and shows result by its report function (status string in UI), so many TCP requests
+ * can be in flight.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "dbg.h"
+#include "modbus.h"
+
+// size of MBAP header
+#define MBAP_SZ         (7)
+// max amount of TCP requests in flight (transaction IDs modulo this value)
+#define MB_MAXPENDING   (1024)
+// max length of ASCII frame: ':' + 2 * (ADU + LRC) + CRLF
+#define MB_ASCIIMAX     (1 + 2*(MB_MAXADU + 1) + 2)
+
+typedef struct{
+    uint16_t tid;           // transaction ID
+    uint8_t unit;           // unit ID
+    uint8_t func;           // function code
+    int active;             // waiting for response
+    double t;               // time of sending
+} mbreq_t;
+
+struct mbtrack{
+    pthread_mutex_t mutex;
+    mbreq_t pending[MB_MAXPENDING];
+    mbreq_t asciireq;       // last ASCII request
+    mbstat_t st;
+    int tcpused, asciiused; // what kind of requests were sent
+    // receiving buffers
+    uint8_t tcpbuf[MBAP_SZ + MB_MAXADU];
+    size_t tcplen;
+    char asciibuf[MB_ASCIIMAX];
+    size_t asciilen;
+    int asciiframe;         // got ':'
+    mbreport_t report;      // where to show decoded responses
+};
+
+#define REPORT(...)  do{ if(m->report) m->report(__VA_ARGS__); }while(0)
+
+static const char hexdig[] = "0123456789ABCDEF";
+
+static int hex2i(char c){
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// show response and update statistics (call with locked `m->mutex`)
+static void response(mbtrack_t *m, const char *proto, int tid, const mbreq_t *req, const uint8_t *adu, size_t len){
+    char tidstr[16] = "";
+    if(tid > -1) snprintf(tidstr, sizeof(tidstr), " #%d", tid);
+    if(len < 2){
+        ++m->st.badframes;
+        REPORT("Modbus %s%s: too short response", proto, tidstr);
+        return;
+    }
+    uint8_t func = adu[1];
+    char excstr[32] = "";
+    if(func & 0x80){
+        ++m->st.exceptions;
+        snprintf(excstr, sizeof(excstr), ", exception %d", (len > 2) ? adu[2] : -1);
+    }
+    if(!req){
+        ++m->st.unknown;
+        REPORT("Modbus %s%s: unit %d, func %d%s - unknown request", proto, tidstr, adu[0], func & 0x7f, excstr);
+        return;
+    }
+    ++m->st.answered;
+    m->st.lastrtt = dtime() - req->t;
+    if(req->unit != adu[0] || req->func != (func & 0x7f)) snprintf(excstr + strlen(excstr), sizeof(excstr) - strlen(excstr), ", mismatch");
+    REPORT("Modbus %s%s: unit %d, func %d, %zd bytes%s, %.1f ms (in flight: %d)", proto, tidstr, adu[0], func & 0x7f,
+               len - 2, excstr, m->st.lastrtt * 1e3, m->st.inflight);
+}
+
+// decode MBAP frames from stream (call with locked `m->mutex`)
+static void tcp_rx(mbtrack_t *m, const uint8_t *data, size_t len){
+    uint8_t *tcpbuf = m->tcpbuf;
+    while(len){
+        size_t need = 6; // header without unit ID, then all data
+        if(m->tcplen >= 6) need = 6 + ((tcpbuf[4] << 8) | tcpbuf[5]);
+        size_t n = need - m->tcplen;
+        if(n > len) n = len;
+        memcpy(tcpbuf + m->tcplen, data, n);
+        m->tcplen += n; data += n; len -= n;
+        if(m->tcplen == 6){ // check header: protocol ID is 0, length is 2..254
+            size_t l = (tcpbuf[4] << 8) | tcpbuf[5];
+            if(tcpbuf[2] || tcpbuf[3] || l < 2 || l > MB_MAXADU){
+                ++m->st.badframes;
+                REPORT("Modbus TCP: wrong MBAP header");
+                m->tcplen = 0; // resync: drop until next portion
+                return;
+            }
+        }
+        if(m->tcplen < need || m->tcplen < MBAP_SZ) continue;
+        uint16_t tid = (tcpbuf[0] << 8) | tcpbuf[1];
+        mbreq_t *r = &m->pending[tid % MB_MAXPENDING];
+        const mbreq_t *req = NULL;
+        if(r->active && r->tid == tid){
+            r->active = FALSE;
+            --m->st.inflight;
+            req = r;
+        }
+        response(m, "TCP", tid, req, tcpbuf + 6, m->tcplen - 6);
+        m->tcplen = 0;
+    }
+}
+
+// decode ASCII frames from stream (call with locked `m->mutex`)
+static void ascii_rx(mbtrack_t *m, const uint8_t *data, size_t len){
+    char *asciibuf = m->asciibuf;
+    for(size_t i = 0; i < len; ++i){
+        char c = (char)data[i];
+        if(c == ':'){
+            m->asciiframe = TRUE;
+            m->asciilen = 0;
+            continue;
+        }
+        if(!m->asciiframe) continue;
+        if(c != '\n'){
+            if(m->asciilen < MB_ASCIIMAX) asciibuf[m->asciilen++] = c;
+            else m->asciiframe = FALSE;
+            continue;
+        }
+        m->asciiframe = FALSE;
+        size_t asciilen = m->asciilen;
+        if(asciilen && asciibuf[asciilen-1] == '\r') --asciilen;
+        uint8_t adu[MB_MAXADU + 1], lrc = 0;
+        size_t n = asciilen / 2;
+        int ok = (asciilen % 2 == 0 && n > 1 && n <= sizeof(adu));
+        for(size_t j = 0; ok && j < n; ++j){
+            int h = hex2i(asciibuf[2*j]), l = hex2i(asciibuf[2*j+1]);
+            if(h < 0 || l < 0) ok = FALSE;
+            else lrc += (adu[j] = (uint8_t)(h << 4 | l));
+        }
+        if(!ok || lrc){ // sum of data and LRC should be zero
+            ++m->st.badframes;
+            REPORT("Modbus ASCII: wrong frame or LRC");
+            continue;
+        }
+        const mbreq_t *req = NULL;
+        if(m->asciireq.active){
+            m->asciireq.active = FALSE;
+            --m->st.inflight;
+            req = &m->asciireq;
+        }
+        response(m, "ASCII", -1, req, adu, n - 1);
+    }
+}
+
+/**
+ * @brief mb_tracknew - create tracker of Modbus requests
+ * @param r - function to show decoded responses and errors, e.g. status string (NULL - don't show)
+ * @return tracker
+ */
+mbtrack_t *mb_tracknew(mbreport_t r){
+    mbtrack_t *m = MALLOC(mbtrack_t, 1);
+    pthread_mutex_init(&m->mutex, NULL);
+    m->report = r;
+    return m;
+}
+
+void mb_trackfree(mbtrack_t **m){
+    if(!m || !*m) return;
+    pthread_mutex_destroy(&(*m)->mutex);
+    FREE(*m);
+}
+
+// change report function of tracker
+void mb_setreport(mbtrack_t *m, mbreport_t r){
+    if(!m) return;
+    pthread_mutex_lock(&m->mutex);
+    m->report = r;
+    pthread_mutex_unlock(&m->mutex);
+}
+
+/**
+ * @brief mb_rx - decode responses from data received
+ * @param m - tracker
+ * @param data - data
+ * @param len - its length
+ */
+void mb_rx(mbtrack_t *m, const uint8_t *data, size_t len){
+    if(!m || !data || !len) return;
+    pthread_mutex_lock(&m->mutex);
+    // the same stream could contain only one type of frames, but we don't know which was sent last
+    if(m->asciiused) ascii_rx(m, data, len);
+    if(m->tcpused) tcp_rx(m, data, len);
+    pthread_mutex_unlock(&m->mutex);
+}
+
+/**
+ * @brief mb_ascii_frame - convert `ID data` into Modbus ASCII frame (in place) without request tracking
+ * @param buf - data; its size should be not less than 2*len + 5
+ * @param len - length of data
+ * @return length of frame
+ */
+size_t mb_ascii_frame(uint8_t *buf, size_t len){
+    if(!buf || !len) return 0;
+    uint8_t lrc = 0;
+    for(size_t i = 0; i < len; ++i) lrc += buf[i];
+    lrc = (uint8_t)(-lrc);
+    size_t flen = 1 + 2*(len + 1) + 2;
+    buf[flen - 1] = '\n';
+    buf[flen - 2] = '\r';
+    buf[flen - 3] = hexdig[lrc & 0xf];
+    buf[flen - 4] = hexdig[lrc >> 4];
+    for(size_t i = len; i > 0; --i){ // from the end: data is expanded in place
+        uint8_t c = buf[i-1];
+        buf[2*i] = hexdig[c & 0xf];
+        buf[2*i-1] = hexdig[c >> 4];
+    }
+    buf[0] = ':';
+    return flen;
+}
+
+/**
+ * @brief mb_tcp_frame - add MBAP header to `ID data` without request tracking
+ * @param buf - data; its size should be not less than len + 6
+ * @param len - length of data
+ * @param tid - transaction ID
+ * @return length of frame
+ */
+size_t mb_tcp_frame(uint8_t *buf, size_t len, uint16_t tid){
+    if(!buf || !len || len > MB_MAXADU) return 0;
+    memmove(buf + 6, buf, len);
+    buf[0] = tid >> 8;
+    buf[1] = tid & 0xff;
+    buf[2] = buf[3] = 0; // protocol ID
+    buf[4] = len >> 8;
+    buf[5] = len & 0xff;
+    return len + 6;
+}
+
+/**
+ * @brief mb_ascii_pack - convert `ID data` into Modbus ASCII frame (in place) and wait for response
+ * @param m - tracker
+ * @param buf - data; its size should be not less than 2*len + 5
+ * @param len - length of data
+ * @return length of frame
+ */
+size_t mb_ascii_pack(mbtrack_t *m, uint8_t *buf, size_t len){
+    if(!m || !buf || !len) return 0;
+    mbreq_t req = {.unit = buf[0], .func = (len > 1) ? buf[1] : 0, .active = TRUE, .t = dtime()};
+    size_t flen = mb_ascii_frame(buf, len);
+    pthread_mutex_lock(&m->mutex);
+    if(m->asciireq.active) ++m->st.lost;
+    else ++m->st.inflight;
+    m->asciireq = req;
+    m->asciiused = TRUE;
+    ++m->st.sent;
+    pthread_mutex_unlock(&m->mutex);
+    return flen;
+}
+
+/**
+ * @brief mb_tcp_pack - add MBAP header with given transaction ID to `ID data` and wait for response
+ * @param m - tracker
+ * @param buf - data; its size should be not less than len + 6
+ * @param len - length of data
+ * @param tid - transaction ID
+ * @return length of frame
+ */
+size_t mb_tcp_pack(mbtrack_t *m, uint8_t *buf, size_t len, uint16_t tid){
+    if(!m || !buf || !len || len > MB_MAXADU) return 0;
+    pthread_mutex_lock(&m->mutex);
+    m->tcpused = TRUE;
+    mbreq_t *r = &m->pending[tid % MB_MAXPENDING];
+    if(r->active) ++m->st.lost;
+    else ++m->st.inflight;
+    *r = (mbreq_t){.tid = tid, .unit = buf[0], .func = (len > 1) ? buf[1] : 0, .active = TRUE, .t = dtime()};
+    ++m->st.sent;
+    pthread_mutex_unlock(&m->mutex);
+    return mb_tcp_frame(buf, len, tid);
+}
+
+/**
+ * @brief mb_stat - get statistics of Modbus transactions
+ * @param m - tracker
+ * @param s (o) - statistics
+ * @return FALSE if there was no Modbus TCP/ASCII requests
+ */
+int mb_stat(mbtrack_t *m, mbstat_t *s){
+    if(!m || !s) return FALSE;
+    pthread_mutex_lock(&m->mutex);
+    *s = m->st;
+    pthread_mutex_unlock(&m->mutex);
+    return (s->sent > 0);
+}
@@ -0,0 +1,56 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef MODBUS_H__
+#define MODBUS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// max size of Modbus ADU data (unit ID + PDU)
+#define MB_MAXADU       (254)
+
+typedef struct{
+    size_t sent;            // requests sent (Modbus TCP and ASCII)
+    size_t answered;        // responses matched to requests
+    size_t unknown;         // TCP responses with unknown transaction ID
+    size_t exceptions;      // exception responses
+    size_t badframes;       // wrong frames (LRC or MBAP header)
+    size_t lost;            // requests without response (their transaction ID reused)
+    int inflight;           // requests waiting for response
+    double lastrtt;         // time of last transaction, s
+} mbstat_t;
+
+// function to show decoded responses (printf-like)
+typedef void (*mbreport_t)(const char *fmt, ...);
+
+// tracker of requests and responses of one device
+typedef struct mbtrack mbtrack_t;
+
+mbtrack_t *mb_tracknew(mbreport_t r);
+void mb_trackfree(mbtrack_t **m);
+void mb_setreport(mbtrack_t *m, mbreport_t r);
+void mb_rx(mbtrack_t *m, const uint8_t *data, size_t len);
+size_t mb_ascii_frame(uint8_t *buf, size_t len);
+size_t mb_tcp_frame(uint8_t *buf, size_t len, uint16_t tid);
+size_t mb_ascii_pack(mbtrack_t *m, uint8_t *buf, size_t len);
+size_t mb_tcp_pack(mbtrack_t *m, uint8_t *buf, size_t len, uint16_t tid);
+int mb_stat(mbtrack_t *m, mbstat_t *s);
+
+#endif // MODBUS_H__
@@ -23,27 +23,36 @@
 // SPDX-License-Identifier: ISC
 
 #include <curses.h>
+#include <langinfo.h>
 #include <readline/history.h>
 #include <readline/readline.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <wchar.h>
 
 //#include <signal.h>
 
+#include "commands.h"
 #include "dbg.h"
+#include "filter.h"
+#include "formatter.h"
 #include "ttysocket.h"
 #include "ncurses_and_readline.h"
 #include "popup_msg.h"
 #include "string_functions.h"
+#include "timestamps.h"
 
 enum { // using colors
     BKG_NO = 1,   // normal status string
     BKGMARKED_NO, // marked status string
     NORMAL_NO,    // normal output
     MARKED_NO,    // marked output
-    ERROR_NO      // error displayed
+    ERROR_NO,     // error displayed
+    RXDATA_NO,    // received data (CHUNK_RX)
+    TXDATA_NO     // transmitted data (CHUNK_TX)
 };
 #define COLOR(x)  COLOR_PAIR(x ## _NO)
 
@@ -53,13 +62,31 @@ static bool visual_mode = false;
 // insert commands when true; roll upper screen when false
 static bool insert_mode = true;
 static bool should_exit = false;
+// run entered line as command instead of sending it
+static bool cmd_mode = false;
+// send complete lines of pasted text at once (not through input line)
+static bool paste_send = false;
+
+// key codes of bracketed paste start and end
+#define KEY_PASTE_BEGIN     (KEY_MAX + 1)
+#define KEY_PASTE_END       (KEY_MAX + 2)
+// max time of waiting for the end of pasted text, ms
+#define PASTE_TMOUT         (1000)
 
-static disptype disp_type = DISP_TEXT;  // type of displaying data
 static disptype input_type = DISP_TEXT; // parsing type of input data
-const char *dispnames[DISP_SIZE] = {"TEXT", "RAW", "HEX", "RTU (RAW)", "RTU (HEX)", "Error"};
+const char *dispnames[DISP_SIZE] = {"TEXT", "RAW", "HEX", "RTU (RAW)", "RTU (HEX)", "Modbus ASCII", "Modbus TCP", "Error"};
 
 static chardevice *dtty = NULL;
 
+// additional text of status string (e.g. progress of file transfer)
+static char status_text[256] = {0};
+static bool status_changed = false;
+static pthread_mutex_t status_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// device statistics (refreshed once per STAT_INTERVAL seconds)
+#define STAT_INTERVAL   (1.)
+static devstat_t devstat = {0};
+
 static void fail_exit(const char *msg){
     // Make sure endwin() is only called in visual mode. As a note, calling it
     // twice does not seem to be supported and messed with the cursor position.
@@ -68,7 +95,8 @@ static void fail_exit(const char *msg){
     exit(EXIT_FAILURE);
 }
 
-static WINDOW *msg_win; // Message window
+static WINDOW *msg_win; // Message window (area of views)
+static WINDOW *split_win; // Line between views
 static WINDOW *sep_win; // Separator line above the command (readline) window
 static WINDOW *cmd_win; // Command (readline) window
 
@@ -79,26 +107,68 @@ static WINDOW *cmd_win; // Command (readline) window
 #define FBUFSIZ     30
 // raw buffer initial size
 #define RBUFSIZ     30
-// amount of spaces and delimeters in hexview string (address + 2 lines + 3 additional spaces)
-#define HEXDSPACES   (13)
-// maximal columns in line
-#define MAXCOLS      (512)
 
 typedef struct{
     char *formatted_buffer; // formatted buffer, ptrtobuf(i) returns i'th string
     size_t fbuf_size;       // size of `formatted_buffer` in bytes (zero-terminated lines)
     size_t fbuf_curr;       // current size of data in buffer
     size_t *line_array_idx; // indexes of starting symbols of each line in `formatted_buffer`
+    uint8_t *line_type;     // chunktype of each line
     size_t lnarr_size;      // full size of `line_array_idx`
     size_t lnarr_curr;      // current index in `line_array_idx` (last string)
     size_t linelen;         // max length of one line (excluding terminated 0)
     size_t lastlen;         // length of last string
 } linebuf_t;
 
-static linebuf_t *linebuffer = NULL; // string buffer for current representation
 static uint8_t *raw_buffer = NULL; // raw buffer for incoming data
 static size_t rawbufsz = 0, rawbufcur = 0; // full raw buffer size and current bytes amount
-static size_t firstdisplineno = 0; // current first displayed line number (when scrolling)
+static rawmark_t *marks = NULL; // chunks in `raw_buffer`
+static size_t nmarks = 0, marksz = 0; // amount of marks and size of `marks`
+// `raw_buffer` and `marks` are reallocated under write lock: export reads them without device lock
+static pthread_rwlock_t rawlock = PTHREAD_RWLOCK_INITIALIZER;
+static bool hold_redisplay = false; // don't redisplay after each line while adding batch of data
+static bool utf8_locale = false; // terminal works in UTF-8: show multibyte symbols in TEXT mode
+
+// timestamps of lines in left margin
+typedef enum{
+    TSMARGIN_NONE,      // don't show
+    TSMARGIN_ABS,       // local time
+    TSMARGIN_DELTA,     // interval from previous line
+    TSMARGIN_AMOUNT
+} tsmargin_t;
+// width of margin with timestamp
+#define TSMARGINW   (16)
+static tsmargin_t tsmargin = TSMARGIN_NONE;
+static tsarr_t rawoffs = {0}, rawtimes = {0}; // offsets of data portions in `raw_buffer` and their times
+static int64_t curstamp = 0; // time of data being formatted
+
+// representation of received data; all views are formatted from the same `raw_buffer`
+typedef struct{
+    WINDOW *win;            // its window
+    int rows, cols;         // and size
+    disptype type;          // type of displaying data
+    linebuf_t *lb;          // formatted lines
+    size_t firstline;       // current first displayed line number (when scrolling)
+    size_t chunkline;       // first line of current chunk (addresses in hexdump are relative to it)
+    chunktype curtype;      // type of current chunk
+    size_t pos;             // offset of first byte not formatted yet
+    int utf8_pending;       // length of incomplete UTF-8 symbol at the end of last formatted portion
+    tsarr_t linetimes;      // time of each finished line (time of its first symbol)
+    tsarr_t lineoffs;       // offset in `raw_buffer` of each line start (to scroll views synchronously)
+    int64_t linestamp;      // time of last (unfinished) line
+    size_t linestart;       // offset of last (unfinished) line start
+    size_t *match;          // numbers of finished lines passing filter
+    size_t nmatch, matchsz; // their amount and size of `match`
+} view_t;
+
+#define NVIEWS      (2)
+static view_t views[NVIEWS] = {{.type = DISP_TEXT}, {.type = DISP_HEX}};
+static view_t *V = &views[0]; // view being formatted
+static int nviews = 1; // amount of shown views
+static int active = 0; // view switched by Fx and scrolled by keys
+static splitmode_t splitmode = SPLIT_NONE;
+static filter_t *linefilter = NULL; // filter of lines (`match` of views is filled while it's set)
+static bool filtered = false; // show only lines passing filter
 
 static unsigned char input; // Input character for readline
 
@@ -140,14 +210,25 @@ static void show_err(const char *text){
  * @return pointer to n'th string in formatted buffer
  */
 static char *ptrtobuf(size_t lineno){
-    if(!linebuffer->line_array_idx){
+    if(!V->lb->line_array_idx){
         show_err("line_array_idx not inited");
         return NULL;
     }
-    if(lineno > linebuffer->lnarr_curr) return NULL;
-    size_t idx = linebuffer->line_array_idx[lineno];
-    if(idx > linebuffer->fbuf_curr) return NULL;
-    return (linebuffer->formatted_buffer + idx);
+    if(lineno > V->lb->lnarr_curr) return NULL;
+    size_t idx = V->lb->line_array_idx[lineno];
+    if(idx > V->lb->fbuf_curr) return NULL;
+    return (V->lb->formatted_buffer + idx);
+}
+
+// time of line `lineno` of view `v`
+static int64_t linetime(view_t *v, size_t lineno){
+    if(lineno < v->linetimes.n) return tsarr_get(&v->linetimes, lineno);
+    return v->linestamp;
+}
+
+// width of left margin
+static int marginw(){
+    return (tsmargin == TSMARGIN_NONE) ? 0 : TSMARGINW;
 }
 
 #if 0
@@ -176,27 +257,183 @@ static char *hex_putchar(char *next){
 }
 #endif
 
+// index of first line of `v` starting not before `off` in `raw_buffer`
+static size_t line_from(view_t *v, int64_t off){
+    size_t l = 0, r = v->lineoffs.n;
+    while(l < r){
+        size_t m = (l + r) / 2;
+        if(tsarr_get(&v->lineoffs, m) < off) l = m + 1;
+        else r = m;
+    }
+    return l;
+}
+
+// position in `match` of first line of `v` passing filter with number not less than `lineno`
+static size_t matchpos(view_t *v, size_t lineno){
+    size_t l = 0, r = v->nmatch;
+    while(l < r){
+        size_t m = (l + r) / 2;
+        if(v->match[m] < lineno) l = m + 1;
+        else r = m;
+    }
+    return l;
+}
+
+// last (unfinished) line of `v` passes filter
+static bool lastmatch(view_t *v){
+    linebuf_t *lb = v->lb;
+    if(!linefilter || lb->fbuf_curr <= lb->line_array_idx[lb->lnarr_curr]) return false; // no filter or empty line
+    return filter_match(linefilter, lb->formatted_buffer + lb->line_array_idx[lb->lnarr_curr],
+                        raw_buffer + v->linestart, v->pos - v->linestart);
+}
+
 /**
- * @brief msg_win_redisplay - redisplay message window
- * @param group_refresh - true for grouping refresh (don't call doupdate())
+ * @brief filtfirst - get first shown line of filtered view
+ * @param v - view
+ * @param n (o) - amount of lines passing filter (including last unfinished line)
+ * @return its position in `match` (`nmatch` for last unfinished line)
  */
-static void msg_win_redisplay(bool group_refresh){
-    if(!linebuffer) return;
-    werase(msg_win);
-    int linemax = LINES - 2;
-    if(firstdisplineno >= linebuffer->lnarr_curr){
+static size_t filtfirst(view_t *v, size_t *n){
+    size_t total = v->nmatch + (lastmatch(v) ? 1 : 0), k = matchpos(v, v->firstline);
+    if(k + v->rows > total) k = (total > (size_t)v->rows) ? total - v->rows : 0; // last page
+    if(n) *n = total;
+    return k;
+}
+
+/**
+ * @brief addmatch - check finished line of view by filter and add it to `match`
+ * @param v - view
+ * @param lineno - line number
+ * @param start, end - offsets of its data in `raw_buffer`
+ */
+static void addmatch(view_t *v, size_t lineno, size_t start, size_t end){
+    if(!filter_match(linefilter, v->lb->formatted_buffer + v->lb->line_array_idx[lineno], raw_buffer + start, end - start))
+        return;
+    if(v->nmatch == v->matchsz){
+        v->matchsz = v->matchsz ? v->matchsz * 2 : 1024;
+        v->match = realloc(v->match, v->matchsz * sizeof(size_t));
+    }
+    v->match[v->nmatch++] = lineno;
+    if(!filtered || v->nmatch <= (size_t)v->rows) return;
+    size_t k = matchpos(v, v->firstline);
+    if(k + v->rows == v->nmatch - 1) v->firstline = v->match[k + 1]; // last line was shown: scroll by one line
+}
+
+/**
+ * @brief buildmatch - fill `match` of view by all its finished lines
+ * @param v - view
+ */
+static void buildmatch(view_t *v){
+    v->nmatch = 0;
+    if(!linefilter || !v->lb) return;
+    size_t start = 0;
+    for(size_t l = 0; l < v->lb->lnarr_curr; ++l){
+        size_t end = tsarr_get(&v->lineoffs, l + 1);
+        addmatch(v, l, start, end);
+        start = end;
+    }
+}
+
+/**
+ * @brief syncviews - scroll other views to data shown in active view
+ *      (when active view follows new data, others show their last lines too)
+ */
+static void syncviews(){
+    view_t *a = &views[active];
+    if(!a->lb) return;
+    size_t top = a->firstline;
+    bool tail;
+    if(filtered && linefilter){
+        size_t n, k = filtfirst(a, &n);
+        tail = (k + a->rows >= n);
+        top = (k < a->nmatch) ? a->match[k] : a->lb->lnarr_curr;
+    }else tail = (a->firstline + a->rows > a->lb->lnarr_curr);
+    int64_t off = tail ? 0 : tsarr_get(&a->lineoffs, top);
+    for(int i = 0; i < nviews; ++i){
+        view_t *v = &views[i];
+        if(v == a || !v->lb) continue;
+        if(tail){
+            v->firstline = (v->lb->lnarr_curr + 1 > (size_t)v->rows) ? v->lb->lnarr_curr + 1 - v->rows : 0;
+            continue;
+        }
+        size_t l = line_from(v, off + 1); // first line after the one containing `off`
+        if(l) l = line_from(v, tsarr_get(&v->lineoffs, l - 1)); // show label of chunk too
+        v->firstline = l;
+    }
+}
+
+/**
+ * @brief drawline - draw line of view
+ * @param v - view
+ * @param y - row in window
+ * @param curline - line number
+ */
+static void drawline(view_t *v, int y, size_t curline){
+    linebuf_t *lb = v->lb;
+    int attr = 0;
+    switch(lb->line_type[curline]){
+        case CHUNK_RX: attr = COLOR(RXDATA); break;
+        case CHUNK_TX: attr = COLOR(TXDATA); break;
+        default: break;
+    }
+    if(tsmargin != TSMARGIN_NONE){
+        char m[32] = {0};
+        // last line has no time until its first symbol
+        if(curline < lb->lnarr_curr || lb->fbuf_curr > lb->line_array_idx[curline]){
+            int64_t t = linetime(v, curline);
+            if(tsmargin == TSMARGIN_ABS) ts_format(m, sizeof(m), t);
+            else snprintf(m, sizeof(m), "%+15.6f", curline ? (t - linetime(v, curline - 1)) / 1e6 : 0.);
+        }
+        mvwprintw(v->win, y, 0, "%-*s", TSMARGINW, m);
+    }else wmove(v->win, y, 0);
+    if(attr) wattron(v->win, attr);
+    wprintw(v->win, "%s", lb->formatted_buffer + lb->line_array_idx[curline]);
+    if(attr) wattroff(v->win, attr);
+}
+
+/**
+ * @brief view_redisplay - redisplay window of view
+ * @param v - view
+ */
+static void view_redisplay(view_t *v){
+    linebuf_t *lb = v->lb;
+    if(!lb || !v->win) return;
+    werase(v->win);
+    int linemax = v->rows;
+    if(filtered && linefilter){ // only lines passing filter
+        size_t n, k = filtfirst(v, &n);
+        for(int i = 0; i < linemax && k < n; ++i, ++k)
+            drawline(v, i, (k < v->nmatch) ? v->match[k] : lb->lnarr_curr);
+        wnoutrefresh(v->win);
+        return;
+    }
+    if(v->firstline >= lb->lnarr_curr){
         size_t l = (linemax > 1) ? linemax / 2 : 1;
-        if(linebuffer->lnarr_curr < l) firstdisplineno = 0;
-        else firstdisplineno = linebuffer->lnarr_curr - l;
+        if(lb->lnarr_curr < l) v->firstline = 0;
+        else v->firstline = lb->lnarr_curr - l;
     }
-    size_t lastl = firstdisplineno + linemax;
-    if(lastl > linebuffer->lnarr_curr+1) lastl = linebuffer->lnarr_curr+1;
+    size_t lastl = v->firstline + linemax;
+    if(lastl > lb->lnarr_curr+1) lastl = lb->lnarr_curr+1;
     int i = 0;
-    for(size_t curline = firstdisplineno; curline < lastl; ++curline, ++i){
-        mvwprintw(msg_win, i, 0, "%s", linebuffer->formatted_buffer + linebuffer->line_array_idx[curline]);
+    for(size_t curline = v->firstline; curline < lastl; ++curline, ++i) drawline(v, i, curline);
+    wnoutrefresh(v->win);
+}
+
+/**
+ * @brief msg_win_redisplay - redisplay all views
+ * @param group_refresh - true for grouping refresh (don't call doupdate())
+ */
+static void msg_win_redisplay(bool group_refresh){
+    if(!views[0].lb) return;
+    syncviews();
+    for(int i = 0; i < nviews; ++i) view_redisplay(&views[i]);
+    if(nviews > 1 && split_win){
+        werase(split_win);
+        if(splitmode == SPLIT_HORIZONTAL) whline(split_win, ACS_HLINE, views[0].cols);
+        else wvline(split_win, ACS_VLINE, views[0].rows);
+        wnoutrefresh(split_win);
     }
-    if(group_refresh) wnoutrefresh(msg_win);
-    else wrefresh(msg_win);
+    if(!group_refresh) doupdate();
 }
 
 /**
@@ -204,16 +441,20 @@ static void msg_win_redisplay(bool group_refresh){
  * @param group_refresh - true for grouping refresh (don't call doupdate())
  */
 static void cmd_win_redisplay(bool group_refresh){
-    int cursor_col = 3 + strlen(dispnames[input_type]) + rl_point; // " > " width is 3
+    char prompt[32];
+    int plen = snprintf(prompt, sizeof(prompt), "%s > ", cmd_mode ? "CMD" : dispnames[input_type]);
+    int cursor_col = plen + rl_point;
     werase(cmd_win);
     int x = 0, maxw = COLS-2;
     if(cursor_col > maxw){
         x = cursor_col - maxw;
         cursor_col = maxw;
     }
-    char abuf[4096];
-    snprintf(abuf, 4096, "%s > %s", dispnames[input_type], rl_line_buffer);
-    waddstr(cmd_win, abuf+x);
+    // only visible part of line
+    if(x < plen){
+        waddstr(cmd_win, prompt + x);
+        waddnstr(cmd_win, rl_line_buffer, maxw + 1);
+    }else waddnstr(cmd_win, rl_line_buffer + x - plen, maxw + 1);
     wmove(cmd_win, 0, cursor_col);
     if(group_refresh) wnoutrefresh(cmd_win);
     else wrefresh(cmd_win);
@@ -262,126 +503,276 @@ static void show_mode(bool group_refresh){
         snprintf(buf, 127, "SCROLL (F1 - help) ENDLINE: %s", dtty?dtty->seol:"n");
     }
     wattron(sep_win, COLOR(BKGMARKED));
-    wprintw(sep_win, "%s ", dispnames[disp_type]);
+    if(nviews > 1){ // active view in brackets
+        for(int i = 0; i < nviews; ++i)
+            wprintw(sep_win, (i == active) ? "[%s]" : " %s ", dispnames[views[i].type]);
+        waddch(sep_win, ' ');
+    }else wprintw(sep_win, "%s ", dispnames[views[0].type]);
+    if(filtered && linefilter) wprintw(sep_win, "FILTER ");
     wattroff(sep_win, COLOR(BKGMARKED));
     wprintw(sep_win, "%s", buf);
+    if(devstat.hwcounters && (devstat.overrun || devstat.buf_overrun || devstat.frame || devstat.parity || devstat.brk)){
+        wattron(sep_win, COLOR(BKGMARKED));
+        wprintw(sep_win, " ERR: OVR %d/%d FRM %d PAR %d BRK %d", devstat.overrun, devstat.buf_overrun,
+            devstat.frame, devstat.parity, devstat.brk);
+        wattroff(sep_win, COLOR(BKGMARKED));
+    }
+    pthread_mutex_lock(&status_mutex);
+    if(*status_text) wprintw(sep_win, " | %s", status_text);
+    status_changed = false;
+    pthread_mutex_unlock(&status_mutex);
     if(group_refresh) wnoutrefresh(sep_win);
     else wrefresh(sep_win);
     cmd_win_redisplay(group_refresh);
 }
 
+/**
+ * @brief set_status - set additional text of status string (could be called from any thread)
+ * @param fmt - printf-like format
+ */
+void set_status(const char *fmt, ...){
+    va_list ar;
+    pthread_mutex_lock(&status_mutex);
+    va_start(ar, fmt);
+    vsnprintf(status_text, sizeof(status_text), fmt, ar);
+    va_end(ar);
+    status_changed = true;
+    pthread_mutex_unlock(&status_mutex);
+}
+
+/**
+ * @brief chkstat - refresh device statistics and redisplay status string if UART errors changed
+ */
+static void chkstat(){
+    static double tlast = 0.;
+    double t = dtime();
+    if(t - tlast < STAT_INTERVAL) return;
+    tlast = t;
+    devstat_t s;
+    if(!GetDevStat(&s)) return;
+    bool changed = (s.overrun != devstat.overrun || s.buf_overrun != devstat.buf_overrun ||
+                    s.frame != devstat.frame || s.parity != devstat.parity || s.brk != devstat.brk);
+    devstat = s;
+    if(changed) show_mode(false);
+}
+
 /**
  * @brief redisplay_addline - redisplay after line adding
  * @param group_refresh - true for grouping refresh (don't call doupdate())
  */
 static void redisplay_addline(){
-    // redisplay only if previous line was on screen
-    size_t lastno = firstdisplineno + LINES - 2; // number of first line out of screen
-    if(lastno < linebuffer->lnarr_curr){
-        return;
-    }
-    else if(lastno == linebuffer->lnarr_curr){ // scroll text by one line up
-        ++firstdisplineno;
+    if(!filtered || !linefilter){ // filtered view is scrolled by `addmatch`
+        // redisplay only if previous line was on screen
+        size_t lastno = V->firstline + V->rows; // number of first line out of screen
+        if(lastno < V->lb->lnarr_curr){
+            return;
+        }
+        else if(lastno == V->lb->lnarr_curr){ // scroll text by one line up
+            ++V->firstline;
+        }
     }
+    if(hold_redisplay) return;
     msg_win_redisplay(true);
     show_mode(true);
     doupdate();
 }
 
 /**
- * @brief linebuf_free - clear memory of `linebuffer`
+ * @brief linebuf_free - clear memory of lines of current view
  */
 static void linebuf_free(){
-    if(!linebuffer) return;
-    FREE(linebuffer->formatted_buffer);
-    FREE(linebuffer->line_array_idx);
-    FREE(linebuffer);
+    if(!V->lb) return;
+    FREE(V->lb->formatted_buffer);
+    FREE(V->lb->line_array_idx);
+    FREE(V->lb->line_type);
+    FREE(V->lb);
+    FREE(V->match);
+    V->nmatch = V->matchsz = 0;
+    tsarr_clear(&V->linetimes);
+    tsarr_clear(&V->lineoffs);
 }
 
 /**
  * @brief chksizes - check sizes of buffers and enlarge them if need
  */
 static void chksizes(){
-    size_t addportion = MAXCOLS*3;
+    size_t addportion = MAXLINEBYTES;
     if(rawbufsz - rawbufcur < addportion){ // raw buffer always should be big enough
         rawbufsz += (addportion > RBUFSIZ) ? addportion : RBUFSIZ;
         DBG("Enlarge raw buffer to %zd", rawbufsz);
+        pthread_rwlock_wrlock(&rawlock);
         raw_buffer = realloc(raw_buffer, rawbufsz);
+        pthread_rwlock_unlock(&rawlock);
     }
-    if(linebuffer->fbuf_size - linebuffer->fbuf_curr < addportion){ // realloc buffer if need
-        linebuffer->fbuf_size += (addportion > FBUFSIZ) ? addportion : FBUFSIZ;
-        DBG("Enlarge formatted buffer to %zd", linebuffer->fbuf_size);
-        linebuffer->formatted_buffer = realloc(linebuffer->formatted_buffer, linebuffer->fbuf_size);
+    if(V->lb->fbuf_size - V->lb->fbuf_curr < addportion){ // realloc buffer if need
+        V->lb->fbuf_size += (addportion > FBUFSIZ) ? addportion : FBUFSIZ;
+        DBG("Enlarge formatted buffer to %zd", V->lb->fbuf_size);
+        V->lb->formatted_buffer = realloc(V->lb->formatted_buffer, V->lb->fbuf_size);
     }
-    if(linebuffer->lnarr_size - linebuffer->lnarr_curr < 3){
-        linebuffer->lnarr_size += LINEARRSZ;
-        DBG("Enlarge line array buffer to %zd", linebuffer->lnarr_size);
-        linebuffer->line_array_idx = realloc(linebuffer->line_array_idx, linebuffer->lnarr_size * sizeof(size_t));
+    if(V->lb->lnarr_size - V->lb->lnarr_curr < 3){
+        V->lb->lnarr_size += LINEARRSZ;
+        DBG("Enlarge line array buffer to %zd", V->lb->lnarr_size);
+        V->lb->line_array_idx = realloc(V->lb->line_array_idx, V->lb->lnarr_size * sizeof(size_t));
+        V->lb->line_type = realloc(V->lb->line_type, V->lb->lnarr_size);
     }
 }
 
 /**
- * @brief linebuf_new - allocate data for new linebuffer
+ * @brief linebuf_new - allocate data for new lines of current view
  */
 static void linebuf_new(){
     linebuf_free();
-    linebuffer = MALLOC(linebuf_t, 1);
-    linebuffer->fbuf_size = FBUFSIZ;
-    linebuffer->formatted_buffer = MALLOC(char, linebuffer->fbuf_size);
-    linebuffer->lnarr_size = LINEARRSZ;
-    linebuffer->line_array_idx = MALLOC(size_t, linebuffer->lnarr_size);
-    linebuffer->fbuf_curr = 0;
-    linebuffer->lnarr_curr = 0;
-    linebuffer->lastlen = 0;
-    int maxcols = (COLS > MAXCOLS) ? MAXCOLS : COLS;
+    V->lb = MALLOC(linebuf_t, 1);
+    V->lb->fbuf_size = FBUFSIZ;
+    V->lb->formatted_buffer = MALLOC(char, V->lb->fbuf_size);
+    V->lb->lnarr_size = LINEARRSZ;
+    V->lb->line_array_idx = MALLOC(size_t, V->lb->lnarr_size);
+    V->lb->line_type = MALLOC(uint8_t, V->lb->lnarr_size);
+    V->lb->fbuf_curr = 0;
+    V->lb->lnarr_curr = 0;
+    V->lb->lastlen = 0;
     // in hexdump view linelen is amount of symbols in one string, lastlen - amount of already printed symbols
-    if(disp_type == DISP_HEX){ // calculate minimal line width and ;
-        int n = maxcols - HEXDSPACES; // space for data
-        n -= n/8; // spaces after each 8 symbols
-        n /= 4; // hex XX + space + symbol view
-        // n should be 1..4, 8 or 16x
-        if(n < 1) n = 1; // minimal - one symbol per string
-        else if(n > 4){
-            if(n < 8) n = 4;
-            //else if(n < 16) n = 8;
-            else n -= n % 8;
-        }
-        linebuffer->linelen = n;
-    }else linebuffer->linelen = maxcols;
-    DBG("=====>> COLS=%d, maxcols=%d, linelen=%zd", COLS, maxcols, linebuffer->linelen);
-    linebuffer->line_array_idx[0] = 0; // initialize first line
+    V->lb->linelen = fmt_linelen(V->type, V->cols - marginw());
+    DBG("=====>> cols=%d, linelen=%zd", V->cols, V->lb->linelen);
+    tsarr_push(&V->lineoffs, 0); // first line starts from beginning of data
+    V->pos = 0;
+    V->linestart = 0;
+    V->nmatch = 0;
+    V->linestamp = 0;
+    V->lb->line_array_idx[0] = 0; // initialize first line
+    V->lb->line_type[0] = V->curtype = CHUNK_PLAIN;
+    V->chunkline = 0;
+    V->utf8_pending = 0;
     chksizes();
 }
 
 /**
- * @brief finalize_line - finalize last line in linebuffer & increase buffer sizes if nesessary
+ * @brief finalize_line - finalize last line of current view & increase buffer sizes if nesessary
+ * @param next - offset of first byte of next line in `raw_buffer`
  */
-static void finalize_line(){
+static void finalize_line(size_t next){
     chksizes();
-    linebuffer->formatted_buffer[linebuffer->fbuf_curr++] = 0; // finalize line
-    linebuffer->formatted_buffer[linebuffer->fbuf_curr] = 0; // and clear new line (`realloc` can generate some trash)
-    DBG("Current line is %s, no=%zd, len=%zd", linebuffer->formatted_buffer + linebuffer->line_array_idx[linebuffer->lnarr_curr], linebuffer->lnarr_curr, linebuffer->lastlen);
-    ++linebuffer->lnarr_curr;
-    linebuffer->lastlen = 0;
-    linebuffer->line_array_idx[linebuffer->lnarr_curr] = linebuffer->fbuf_curr;
+    V->lb->formatted_buffer[V->lb->fbuf_curr++] = 0; // finalize line
+    V->lb->formatted_buffer[V->lb->fbuf_curr] = 0; // and clear new line (`realloc` can generate some trash)
+    DBG("Current line is %s, no=%zd, len=%zd", V->lb->formatted_buffer + V->lb->line_array_idx[V->lb->lnarr_curr], V->lb->lnarr_curr, V->lb->lastlen);
+    tsarr_push(&V->linetimes, V->linestamp);
+    V->linestamp = curstamp; // next line starts in the same data portion (or it will be changed by next portion)
+    tsarr_push(&V->lineoffs, next);
+    if(linefilter) addmatch(V, V->lb->lnarr_curr, V->linestart, next);
+    V->linestart = next;
+    ++V->lb->lnarr_curr;
+    V->lb->lastlen = 0;
+    V->lb->line_array_idx[V->lb->lnarr_curr] = V->lb->fbuf_curr;
+    V->lb->line_type[V->lb->lnarr_curr] = V->curtype;
     redisplay_addline();
 }
 
+// amount of bytes in last line
+static size_t linebytes(){
+    return V->lb->fbuf_curr - V->lb->line_array_idx[V->lb->lnarr_curr];
+}
+
+/**
+ * @brief addsymbol - add symbol to last line (start new line if it don't fit)
+ * @param s - symbol
+ * @param n - its length in bytes
+ * @param width - its width on screen
+ * @param raw - offset of its bytes in `raw_buffer`
+ * @param nraw - and their amount
+ */
+static void addsymbol(const void *s, int n, int width, size_t raw, int nraw){
+    if(V->lb->lastlen && (V->lb->lastlen + width > V->lb->linelen || linebytes() + n > MAXLINEBYTES - 2))
+        finalize_line(raw);
+    memcpy(V->lb->formatted_buffer + V->lb->fbuf_curr, s, n);
+    V->lb->fbuf_curr += n;
+    V->lb->lastlen += width;
+    if(V->lb->lastlen == V->lb->linelen) finalize_line(raw + nraw);
+}
+
+// show byte `raw_buffer[off]` as `\xXX`
+static void addhex(size_t off){
+    char hex[5];
+    snprintf(hex, 5, "\\x%.2X", raw_buffer[off]);
+    addsymbol(hex, 4, 4, off, 1);
+}
+
+// show incomplete UTF-8 symbol left from previous data portion (e.g. before new chunk)
+static void flush_utf8(){
+    size_t tail = V->pos - V->utf8_pending; // it's just before not formatted data
+    for(int i = 0; i < V->utf8_pending; ++i) addhex(tail + i);
+    V->utf8_pending = 0;
+}
+
+/**
+ * @brief format_text - format data in TEXT mode with UTF-8 symbols
+ * @param data - data start pointer in `raw_buffer` (incomplete symbol from previous portion is just before it)
+ * @param len  - length of data portion
+ */
+static void format_text(const uint8_t *data, int len){
+    data -= V->utf8_pending; // continue incomplete symbol
+    len += V->utf8_pending;
+    V->utf8_pending = 0;
+    while(len > 0){
+        int n = fmt_ascii_run(data, len);
+        while(n){ // copy printable ASCII by pieces up to end of line
+            int ncp = V->lb->linelen - V->lb->lastlen;
+            int nb = MAXLINEBYTES - 2 - (int)linebytes();
+            if(nb < ncp) ncp = nb;
+            if(n < ncp) ncp = n;
+            if(ncp < 1){
+                finalize_line(data - raw_buffer);
+                continue;
+            }
+            memcpy(V->lb->formatted_buffer + V->lb->fbuf_curr, data, ncp);
+            V->lb->fbuf_curr += ncp;
+            V->lb->lastlen += ncp;
+            data += ncp; len -= ncp; n -= ncp;
+            if(V->lb->lastlen == V->lb->linelen) finalize_line(data - raw_buffer);
+        }
+        if(len < 1) break;
+        if(*data == '\n'){
+            finalize_line(data + 1 - raw_buffer);
+            ++data; --len;
+            continue;
+        }
+        uint32_t wc;
+        int l = fmt_utf8_decode(data, len, &wc), w = -1;
+        if(l == 0){ // wait for the rest of symbol (it stays in `raw_buffer`)
+            V->utf8_pending = len;
+            break;
+        }
+        if(l > 0) w = wcwidth((wchar_t)wc);
+        if(w < 0){ // control symbol or wrong sequence
+            addhex(data - raw_buffer);
+            ++data; --len;
+        }else{
+            addsymbol(data, l, w, data - raw_buffer, l);
+            data += l; len -= l;
+        }
+    }
+}
+
 /**
  * @brief FormatData - get new data portion and format it into displayed buffer
  * @param data - data start pointer in `raw_buffer`
  * @param len  - length of data portion
  */
-void FormatData(const uint8_t *data, int len){
+static void FormatData(const uint8_t *data, int len){
     if(COLS > MAXCOLS-1) ERRX("Too wide column");
     if(!data || len < 1) return;
     chksizes();
+    V->pos = data + len - raw_buffer;
+    if(!linebytes()) V->linestamp = curstamp; // first symbols of line
+    if(V->type == DISP_TEXT && utf8_locale){
+        format_text(data, len);
+        return;
+    }
     DBG("Got %d bytes to process", len);
     while(len){
         // count amount of symbols in `data` to display until line is over
         int Nsymbols = 0, curidx = 0;
-        int nrest = linebuffer->linelen - linebuffer->lastlen; // n symbols left in string for text/raw
-        switch(disp_type){
+        int nrest = V->lb->linelen - V->lb->lastlen; // n symbols left in string for text/raw
+        switch(V->type){
             case DISP_TEXT: // 1 or 4 bytes per symbol
                 while(nrest > 0 && curidx < len){
                     uint8_t c = data[curidx++];
@@ -406,20 +797,20 @@ void FormatData(const uint8_t *data, int len){
         if(Nsymbols > len) Nsymbols = len;
         if(Nsymbols == 0){
             DBG("No more plase in line - finalize");
-            finalize_line();
+            finalize_line(data - raw_buffer);
             continue;
         }
         DBG("Process %d symbols", Nsymbols);
-        if(disp_type != DISP_HEX){
-            char *curptr = linebuffer->formatted_buffer+linebuffer->fbuf_curr;
+        if(V->type != DISP_HEX){
+            char *curptr = V->lb->formatted_buffer+V->lb->fbuf_curr;
             for(int i = 0; i < Nsymbols; ++i){
                 uint8_t c = data[i];
                 int nadd = 0;
-                switch(disp_type){
+                switch(V->type){
                     case DISP_TEXT:
                         if(c == '\n'){ // finish line
                             DBG("Finish line, nadd=%d, i=%d!", nadd, i);
-                            finalize_line();
+                            finalize_line(data + i + 1 - raw_buffer);
                             break;
                         }
                         if(c < 32 || c > 126) nadd = sprintf(curptr, "\\x%.2X", c);
@@ -434,60 +825,303 @@ void FormatData(const uint8_t *data, int len){
                     default:
                     break;
                 }
-                linebuffer->fbuf_curr += nadd;
-                linebuffer->lastlen += nadd;
+                V->lb->fbuf_curr += nadd;
+                V->lb->lastlen += nadd;
                 curptr += nadd;
             }
         }else{ // HEXDUMP: refill full string buffer
-            char ascii[MAXCOLS]; // buffer for ASCII printing
-            char *ptr = ptrtobuf(linebuffer->lnarr_curr);
+            char *ptr = ptrtobuf(V->lb->lnarr_curr);
             if(!ptr) ERRX("Can't get current line");
-            size_t address = linebuffer->linelen * linebuffer->lnarr_curr; // string starting address
-            const uint8_t *start = data - linebuffer->lastlen; // starting byte in hexdump string
-            linebuffer->lastlen += Nsymbols;
-            int nadd = sprintf(ptr, "%-10.8zX", address);
-            ptr += nadd;
-            size_t i = 0;
-            for(; i < linebuffer->lastlen; ++i){
-                if(0 == (i % 8)){
-                    sprintf(ptr, " "); ++ptr; ++nadd;
-                }
-                uint8_t c = start[i];
-                int x = sprintf(ptr, "%-3.2X", c);
-                if(c > 31 && c < 127) ascii[i] = c;
-                else ascii[i] = '.';
-                ptr += x;
-                nadd += x;
-            }
-            ascii[i] = 0;
-            int emptyvals = (int)(linebuffer->linelen - linebuffer->lastlen);
-            nadd += sprintf(ptr, "%*s|%*s|", 3*emptyvals+emptyvals/8, "", -((int)linebuffer->linelen), ascii);
-            linebuffer->fbuf_curr = linebuffer->line_array_idx[linebuffer->lnarr_curr] + nadd;
-            DBG("---- Total added symbols: %zd, fbuf_curr=%zd (%zd + %zd)", nadd, linebuffer->fbuf_curr,
-                linebuffer->line_array_idx[linebuffer->lnarr_curr], nadd);
+            size_t address = V->lb->linelen * (V->lb->lnarr_curr - V->chunkline); // string starting address
+            const uint8_t *start = data - V->lb->lastlen; // starting byte in hexdump string
+            V->lb->lastlen += Nsymbols;
+            int nadd = fmt_hexline(ptr, start, V->lb->lastlen, V->lb->linelen, address);
+            V->lb->fbuf_curr = V->lb->line_array_idx[V->lb->lnarr_curr] + nadd;
+            DBG("---- Total added symbols: %zd, fbuf_curr=%zd (%zd + %zd)", nadd, V->lb->fbuf_curr,
+                V->lb->line_array_idx[V->lb->lnarr_curr], nadd);
         }
-        DBG("last=%d, line=%d", linebuffer->lastlen, linebuffer->linelen);
-        if(linebuffer->lastlen == linebuffer->linelen) finalize_line();
+        DBG("last=%d, line=%d", V->lb->lastlen, V->lb->linelen);
+        if(V->lb->lastlen == V->lb->linelen) finalize_line(data + Nsymbols - raw_buffer);
         len -= Nsymbols;
         data += Nsymbols;
     }
 }
 
 /**
- * @brief AddData - add new data buffer to global buffer and last displayed string
+ * @brief startchunk - start new line of current view for next chunk and print its label
+ * @param m - mark of chunk
+ */
+static void startchunk(const rawmark_t *m){
+    flush_utf8();
+    if(V->lb->lastlen) finalize_line(m->offset);
+    V->linestamp = curstamp;
+    V->chunkline = V->lb->lnarr_curr;
+    V->lb->line_type[V->chunkline] = V->curtype = m->type;
+    if(!*m->label) return;
+    chksizes();
+    size_t max = (V->type == DISP_HEX) ? (size_t)(V->cols - marginw()) : V->lb->linelen;
+    if(max > MAXCOLS) max = MAXCOLS;
+    size_t n = fmt_label(V->lb->formatted_buffer + V->lb->fbuf_curr, m->label, max);
+    V->lb->fbuf_curr += n;
+    if(V->type == DISP_HEX){ // hexdump lines are full: label is on its own line
+        finalize_line(m->offset);
+        V->chunkline = V->lb->lnarr_curr;
+    }else V->lb->lastlen = n;
+}
+
+// reformat all data in `raw_buffer` with its chunks and times in current view
+static void format_all(){
+    size_t pos = 0, m = 0, s = 0;
+    while(pos < rawbufcur || m < nmarks){
+        size_t next = rawbufcur;
+        if(m < nmarks && marks[m].offset < next) next = marks[m].offset;
+        if(s < rawoffs.n && (size_t)tsarr_get(&rawoffs, s) < next) next = tsarr_get(&rawoffs, s);
+        FormatData(raw_buffer + pos, next - pos);
+        pos = next;
+        for(; m < nmarks && marks[m].offset == pos; ++m){ // chunks start before their data
+            curstamp = marks[m].stamp;
+            startchunk(&marks[m]);
+        }
+        for(; s < rawoffs.n && (size_t)tsarr_get(&rawoffs, s) == pos; ++s) curstamp = tsarr_get(&rawtimes, s);
+    }
+}
+
+/**
+ * @brief AddData - add new data buffer to global buffer and last displayed string of each view
  * @param data - data
  * @param len  - length of `data`
+ * @param stamp - time of data receiving (see timestamps.h)
  */
-void AddData(const uint8_t *data, int len){
+void AddData(const uint8_t *data, int len, int64_t stamp){
     // now print all symbols into buff
+    if(rawbufsz - rawbufcur < (size_t)len + MAXCOLS*3){ // `FormatData` shouldn't realloc raw buffer
+        rawbufsz = rawbufcur + len + MAXCOLS*3;
+        pthread_rwlock_wrlock(&rawlock);
+        raw_buffer = realloc(raw_buffer, rawbufsz);
+        pthread_rwlock_unlock(&rawlock);
+    }
     chksizes();
+    if(!rawtimes.n || stamp != rawtimes.last){
+        tsarr_push(&rawoffs, rawbufcur);
+        tsarr_push(&rawtimes, stamp);
+    }
+    curstamp = stamp;
     memcpy(raw_buffer + rawbufcur, data, len);
     DBG("Got %d bytes, now buffer have %d", len, rawbufcur+len);
-    FormatData(raw_buffer + rawbufcur, len);
+    bool hold = hold_redisplay;
+    hold_redisplay = true; // redisplay once when all views are ready
+    for(int i = 0; i < nviews; ++i){
+        V = &views[i];
+        FormatData(raw_buffer + rawbufcur, len);
+    }
+    hold_redisplay = hold;
     rawbufcur += len;
     redisplay_addline(); // display last symbols if can
 }
 
+/**
+ * @brief AddChunk - add data which should be displayed from new line with label (e.g. datagram)
+ * @param data - data
+ * @param len - its length
+ * @param label - text to show before data
+ * @param type - type of data
+ * @param stamp - time of data receiving
+ */
+void AddChunk(const uint8_t *data, int len, const char *label, chunktype type, int64_t stamp){
+    if(nmarks == marksz){
+        marksz = marksz ? marksz * 2 : 256;
+        pthread_rwlock_wrlock(&rawlock);
+        marks = realloc(marks, marksz * sizeof(rawmark_t));
+        pthread_rwlock_unlock(&rawlock);
+    }
+    rawmark_t *m = &marks[nmarks++];
+    m->offset = rawbufcur;
+    snprintf(m->label, LABELSZ, "%s", label ? label : "");
+    m->type = type;
+    m->stamp = curstamp = stamp;
+    for(int i = 0; i < nviews; ++i){
+        V = &views[i];
+        startchunk(m);
+    }
+    if(len > 0) AddData(data, len, stamp);
+    else redisplay_addline();
+}
+
+/**
+ * @brief AddDgrams - add batch of datagrams (one line per datagram) and redisplay once
+ * @param d - datagrams
+ * @param n - their amount
+ */
+void AddDgrams(const dgram_t *d, int n){
+    char label[LABELSZ];
+    hold_redisplay = true;
+    for(int i = 0; i < n; ++i){
+        snprintf(label, LABELSZ, "%s [%d%s]: ", d[i].src, d[i].len, d[i].trunc ? "+" : "");
+        AddChunk(d[i].data, d[i].len, label, CHUNK_PLAIN, d[i].stamp);
+    }
+    hold_redisplay = false;
+    redisplay_addline();
+}
+
+/**
+ * @brief AddFrame - add frame (in packet mode) from new line with its length and idle time before it
+ * @param data - data
+ * @param len - its length
+ * @param stamp - time of receiving
+ * @param gap - idle time before frame, us (-1 if unknown)
+ */
+void AddFrame(const uint8_t *data, int len, int64_t stamp, int64_t gap){
+    char label[LABELSZ];
+    if(gap < 0) snprintf(label, LABELSZ, "[%d]: ", len);
+    else snprintf(label, LABELSZ, "[%d] +%.3fms: ", len, gap / 1000.);
+    AddChunk(data, len, label, CHUNK_PLAIN, stamp);
+}
+
+/**
+ * @brief GetScrollback - get size of scrollback
+ * @param bytes (o) - amount of received data in it
+ * @param lines (o) - amount of formatted lines
+ */
+void GetScrollback(size_t *bytes, size_t *lines){
+    size_t b = 0, l = 0;
+    if(dtty){
+        pthread_mutex_lock(&dtty->mutex);
+        b = rawbufcur;
+        if(views[active].lb) l = views[active].lb->lnarr_curr;
+        pthread_mutex_unlock(&dtty->mutex);
+    }
+    if(bytes) *bytes = b;
+    if(lines) *lines = l;
+}
+
+/**
+ * @brief FormatReset - clear scrollback and start formatting from scratch without screen (for benchmarks)
+ * @param type - display type
+ * @param utf8 - decode UTF-8 in TEXT mode
+ * @param cols, rows - size of view
+ */
+void FormatReset(disptype type, bool utf8, int cols, int rows){
+    hold_redisplay = true; // nothing is drawn
+    V = &views[0];
+    V->type = type;
+    V->cols = cols;
+    V->rows = rows;
+    utf8_locale = utf8;
+    rawbufcur = 0;
+    nmarks = 0;
+    tsarr_clear(&rawoffs);
+    tsarr_clear(&rawtimes);
+    linebuf_new();
+}
+
+/**
+ * @brief FormatChunks - add data to scrollback and format it by portions like they were read by parts
+ * @param data - data
+ * @param len - its length
+ * @param chunk - length of portions
+ */
+void FormatChunks(const uint8_t *data, size_t len, size_t chunk){
+    if(!data || !len || !chunk) return;
+    if(rawbufsz - rawbufcur < len + MAXCOLS*3){ // `FormatData` shouldn't realloc raw buffer
+        rawbufsz = rawbufcur + len + MAXCOLS*3;
+        pthread_rwlock_wrlock(&rawlock);
+        raw_buffer = realloc(raw_buffer, rawbufsz);
+        pthread_rwlock_unlock(&rawlock);
+    }
+    uint8_t *start = raw_buffer + rawbufcur;
+    memcpy(start, data, len);
+    for(size_t pos = 0; pos < len; pos += chunk){
+        size_t l = len - pos;
+        if(l > chunk) l = chunk;
+        FormatData(start + pos, l);
+    }
+    rawbufcur += len;
+}
+
+/**
+ * @brief FormatStat - get sizes of scrollback buffers of first view
+ * @param bytes (o) - amount of data in scrollback
+ * @param lines (o) - amount of formatted lines
+ * @param fbufsz (o) - size of formatted buffer
+ * @param lnarrsz (o) - size of line index
+ */
+void FormatStat(size_t *bytes, size_t *lines, size_t *fbufsz, size_t *lnarrsz){
+    linebuf_t *lb = views[0].lb;
+    if(bytes) *bytes = rawbufcur;
+    if(lines) *lines = lb ? lb->lnarr_curr : 0;
+    if(fbufsz) *fbufsz = lb ? lb->fbuf_size : 0;
+    if(lnarrsz) *lnarrsz = lb ? lb->lnarr_size : 0;
+}
+
+/**
+ * @brief ExportBuffer - save all received data formatted like in scrollback
+ * @param path - output file
+ * @param type - display type (DISP_UNCHANGED for current of active view)
+ * @param cols - screen width (0 for width of active view without timestamp margin)
+ * @param nthreads - amount of worker threads (0 - by amount of CPUs)
+ * @return FALSE if failed
+ */
+int ExportBuffer(const char *path, disptype type, int cols, int nthreads){
+    if(!dtty || !raw_buffer) return FALSE;
+    fmtpars_t p = {.type = (type == DISP_UNCHANGED) ? views[active].type : type, .utf8 = utf8_locale};
+    if(p.type > DISP_HEX) return FALSE;
+    p.cols = (cols > 0) ? cols : views[active].cols - marginw(); // like scrollback: without timestamp margin
+    p.linelen = fmt_linelen(p.type, p.cols);
+    // data and marks before snapshot never change: new data is appended after them, so only their
+    // reallocation should wait for export end
+    pthread_mutex_lock(&dtty->mutex);
+    size_t len = rawbufcur, nm = nmarks;
+    pthread_rwlock_rdlock(&rawlock);
+    pthread_mutex_unlock(&dtty->mutex);
+    int ret = fmt_export(path, &p, raw_buffer, len, marks, nm, nthreads);
+    pthread_rwlock_unlock(&rawlock);
+    return ret;
+}
+
+/**
+ * @brief placewin - (re)create window with given size and position
+ * @param win (io) - window
+ * @param rows, cols - its size
+ * @param y, x - position of upper left corner
+ */
+static void placewin(WINDOW **win, int rows, int cols, int y, int x){
+    if(*win) delwin(*win);
+    *win = newwin(rows, cols, y, x);
+    if(!*win) fail_exit("Failed to allocate windows");
+}
+
+/**
+ * @brief layout - place windows of views in message area
+ */
+static void layout(){
+    int rows = (LINES > 2) ? LINES - 2 : 1, cols = COLS;
+    splitmode_t mode = splitmode;
+    if((mode == SPLIT_HORIZONTAL && rows < 3) || (mode == SPLIT_VERTICAL && cols < 3)) mode = SPLIT_NONE; // too small
+    view_t *a = &views[0], *b = &views[1];
+    a->rows = rows; a->cols = cols;
+    switch(mode){
+        case SPLIT_HORIZONTAL:
+            a->rows = (rows - 1) / 2;
+            b->rows = rows - 1 - a->rows; b->cols = cols;
+            placewin(&split_win, 1, cols, a->rows, 0);
+            placewin(&b->win, b->rows, b->cols, a->rows + 1, 0);
+        break;
+        case SPLIT_VERTICAL:
+            a->cols = (cols - 1) / 2;
+            b->rows = rows; b->cols = cols - 1 - a->cols;
+            placewin(&split_win, rows, 1, 0, a->cols);
+            placewin(&b->win, b->rows, b->cols, 0, a->cols + 1);
+        break;
+        default:
+            if(split_win){ delwin(split_win); split_win = NULL; }
+            if(b->win){ delwin(b->win); b->win = NULL; }
+        break;
+    }
+    placewin(&a->win, a->rows, a->cols, 0, 0);
+    nviews = (mode == SPLIT_NONE) ? 1 : 2;
+    if(active >= nviews) active = 0;
+}
+
 static void resize(){
     DBG("RESIZE WINDOW");
     if(LINES > 2){
@@ -498,13 +1132,82 @@ static void resize(){
         mvwin(cmd_win, LINES - 1, 0);
     }
     pthread_mutex_lock(&dtty->mutex);
-    linebuf_new(); // free old and alloc new
-    FormatData(raw_buffer, rawbufcur); // reformat all data
+    layout();
+    for(int i = 0; i < NVIEWS; ++i){
+        V = &views[i];
+        if(i >= nviews){ // hidden view
+            linebuf_free();
+            continue;
+        }
+        linebuf_new(); // free old and alloc new
+        format_all(); // reformat all data
+    }
+    V = &views[0];
+    pthread_mutex_unlock(&dtty->mutex);
+    msg_win_redisplay(true);
+    show_mode(true);
+    doupdate();
+}
+
+/**
+ * @brief SplitViews - show the same data in two views or join them
+ * @param mode - how to place views
+ * @param type - display type of second view (DISP_UNCHANGED to keep old)
+ */
+void SplitViews(splitmode_t mode, disptype type){
+    if(mode < SPLIT_NONE || mode >= SPLIT_AMOUNT) return;
+    if(type >= DISP_TEXT && type <= DISP_HEX) views[1].type = type;
+    splitmode = mode;
+    resize();
+}
+
+/**
+ * @brief SetFilter - set filter of lines and show only lines passing it
+ * @param f - new filter (it will be freed here) or NULL to remove old and show all lines
+ */
+void SetFilter(filter_t *f){
+    pthread_mutex_lock(&dtty->mutex);
+    filter_free(&linefilter);
+    linefilter = f;
+    for(int i = 0; i < nviews; ++i) buildmatch(&views[i]);
+    filtered = (f != NULL);
+    pthread_mutex_unlock(&dtty->mutex);
+    msg_win_redisplay(true);
+    show_mode(true);
+    doupdate();
+}
+
+/**
+ * @brief ShowFiltered - switch between lines passing filter and all lines (position is the same)
+ * @param on - TRUE to show only lines passing filter
+ * @return FALSE if there's no filter
+ */
+int ShowFiltered(int on){
+    if(!linefilter) return FALSE;
+    pthread_mutex_lock(&dtty->mutex);
+    if(!on && filtered){ // keep first shown line (or follow new data)
+        view_t *v = &views[active];
+        size_t n, k = filtfirst(v, &n);
+        if(k + v->rows >= n) v->firstline = (v->lb->lnarr_curr + 1 > (size_t)v->rows) ? v->lb->lnarr_curr + 1 - v->rows : 0;
+        else v->firstline = v->match[k];
+    }
+    filtered = on;
     pthread_mutex_unlock(&dtty->mutex);
     msg_win_redisplay(true);
     show_mode(true);
     doupdate();
+    return TRUE;
+}
+
+/**
+ * @brief show_popup - show popup message (e.g. from commands)
+ * @param msg - NULL-terminated array of lines
+ */
+void show_popup(const char *const *msg){
+    popup_msg(msg_win, msg);
+    resize();
 }
+
 /*
 void swinch(_U_ int sig){
     //signal(SIGWINCH, swinch);
@@ -515,6 +1218,7 @@ void init_ncurses(){
     if (!initscr())
         fail_exit("Failed to initialize ncurses");
     visual_mode = true;
+    utf8_locale = (0 == strcmp(nl_langinfo(CODESET), "UTF-8"));
     if(has_colors()){
         start_color();
         use_default_colors();
@@ -536,6 +1240,7 @@ void init_ncurses(){
     }
     if(!msg_win || !sep_win || !cmd_win)
         fail_exit("Failed to allocate windows");
+    layout();
     wtimeout(cmd_win, 5);
     keypad(cmd_win, TRUE);
     if(has_colors()){
@@ -544,28 +1249,45 @@ void init_ncurses(){
         init_pair(ERROR_NO, COLOR_BLACK, 1);
         init_pair(NORMAL_NO, COLOR_WHITE, COLOR_BLACK);
         init_pair(MARKED_NO, COLOR_CYAN, COLOR_BLACK);
+        init_pair(RXDATA_NO, COLOR_GREEN, COLOR_BLACK);
+        init_pair(TXDATA_NO, COLOR_YELLOW, COLOR_BLACK);
         wbkgd(sep_win, COLOR(BKG));
     }else{
         wbkgd(sep_win, A_STANDOUT);
     }
     show_mode(false);
     mousemask(BUTTON4_PRESSED|BUTTON5_PRESSED, NULL);
+    // bracketed paste: terminal marks pasted text, so it could be inserted at once
+    define_key("\033[200~", KEY_PASTE_BEGIN);
+    define_key("\033[201~", KEY_PASTE_END);
+    printf("\033[?2004h");
+    fflush(stdout);
     DBG("INIT raw buffer");
     rawbufsz = RBUFSIZ;
     raw_buffer = MALLOC(uint8_t, rawbufsz);
+    V = &views[0];
     linebuf_new();
     //signal(SIGWINCH, swinch);
 }
 
 void deinit_ncurses(){
+    if(!visual_mode) return;
     visual_mode = false;
-    linebuf_free();
+    for(int i = 0; i < NVIEWS; ++i){
+        V = &views[i];
+        linebuf_free();
+        if(V->win) delwin(V->win);
+    }
+    if(split_win) delwin(split_win);
     delwin(msg_win);
     delwin(sep_win);
     delwin(cmd_win);
+    printf("\033[?2004l");
+    fflush(stdout);
     endwin();
 }
 
+static bool rl_inited = false; // readline callback is installed
 static char *previous_line = NULL; // previous line in readline input
 static void got_command(char *line){
     if(!line) // Ctrl-D pressed on empty line
@@ -574,14 +1296,24 @@ static void got_command(char *line){
         if(!*line) return; // zero length
         if(!previous_line || strcmp(previous_line, line)) add_history(line); // omit repeats
         FREE(previous_line);
+        previous_line = line;
+        if(cmd_mode){
+            run_command(line);
+            show_mode(false);
+            return;
+        }
         int res = convert_and_send(input_type, line);
         if(res == 0) show_err("Wrong data format");
         else if(res == -1) ERRX("Device disconnected");
-        previous_line = line;
     }
 }
 
-void init_readline(){
+/**
+ * @brief init_readline - init readline in callback mode
+ * @param pastesend - TRUE to send complete lines of pasted text at once
+ */
+void init_readline(int pastesend){
+    paste_send = pastesend;
     rl_catch_signals = 0;
     rl_catch_sigwinch = 0;
     rl_deprep_term_function = NULL;
@@ -591,6 +1323,7 @@ void init_readline(){
     rl_input_available_hook = readline_input_avail;
     rl_redisplay_function = readline_redisplay;
     rl_callback_handler_install("", got_command);
+    rl_inited = true;
 }
 
 /**
@@ -602,8 +1335,8 @@ static void change_disp(disptype in, disptype out){
         input_type = in;
         DBG("input -> %s", dispnames[in]);
     }
-    if(out >= DISP_TEXT && out <= DISP_HEX && out != disp_type){
-        disp_type = out;
+    if(out >= DISP_TEXT && out <= DISP_HEX && out != views[active].type){
+        views[active].type = out;
         DBG("output -> %s", dispnames[out]);
         resize(); // reformat everything
     }
@@ -611,35 +1344,52 @@ static void change_disp(disptype in, disptype out){
 }
 
 void deinit_readline(){
+    if(!rl_inited) return;
+    rl_inited = false;
     rl_callback_handler_remove();
 }
 
 /**
- * @brief rolldown/rollup - roll text by `N` strings
+ * @brief rolldown/rollup - roll text of active view by `N` strings (other views follow it)
  * @param N - amount of strings
  */
 static void rolldown(size_t N){ // if N==0 goto first line
-    DBG("rolldown for %zd, first was %zd", N, firstdisplineno);
-    size_t old = firstdisplineno;
-    if(firstdisplineno < N || N == 0) firstdisplineno = 0;
-    else firstdisplineno -= N;
-    DBG("old was %zd, become %zd", old, firstdisplineno);
-    if(old == firstdisplineno) return;
+    view_t *v = &views[active];
+    DBG("rolldown for %zd, first was %zd", N, v->firstline);
+    size_t old = v->firstline;
+    if(filtered && linefilter){ // roll by lines passing filter
+        size_t k = filtfirst(v, NULL);
+        k = (k < N || N == 0) ? 0 : k - N;
+        v->firstline = (k < v->nmatch) ? v->match[k] : v->lb->lnarr_curr;
+    }else if(v->firstline < N || N == 0) v->firstline = 0;
+    else v->firstline -= N;
+    DBG("old was %zd, become %zd", old, v->firstline);
+    if(old == v->firstline) return;
     msg_win_redisplay(false);
     //msg_win_redisplay(true); show_mode(true); doupdate();
 }
 static void rollup(size_t N){ // if N==0 goto last line
+    view_t *v = &views[active];
     DBG("scroll up for %d", N);
-    size_t half = (LINES+1)/2;
-    if(firstdisplineno + half >= linebuffer->lnarr_curr){
-        DBG("Don't need: %zd+%zd >= %zd", firstdisplineno, half, linebuffer->lnarr_curr);
+    if(filtered && linefilter){
+        size_t n, k = filtfirst(v, &n), old = v->firstline;
+        if(k + v->rows >= n) return; // last page is shown
+        k += N;
+        if(N == 0 || k + v->rows > n) k = n - v->rows;
+        v->firstline = (k < v->nmatch) ? v->match[k] : v->lb->lnarr_curr;
+        if(old != v->firstline) msg_win_redisplay(false);
+        return;
+    }
+    size_t half = (v->rows+3)/2;
+    if(!v->lb || v->firstline + half >= v->lb->lnarr_curr){
+        DBG("Don't need: %zd+%zd >= %zd", v->firstline, half, v->lb ? v->lb->lnarr_curr : 0);
         return; // don't scroll over a half of viewed area
     }
-    size_t old = firstdisplineno;
-    firstdisplineno += N;
-    if(firstdisplineno + half > linebuffer->lnarr_curr || N == 0) firstdisplineno = linebuffer->lnarr_curr - half;
-    DBG("old was %zd, become %zd", old, firstdisplineno);
-    if(old == firstdisplineno) return;
+    size_t old = v->firstline;
+    v->firstline += N;
+    if(v->firstline + half > v->lb->lnarr_curr || N == 0) v->firstline = v->lb->lnarr_curr - half;
+    DBG("old was %zd, become %zd", old, v->firstline);
+    if(old == v->firstline) return;
     msg_win_redisplay(false);
     //msg_win_redisplay(true); show_mode(true); doupdate();
 }
@@ -652,8 +1402,15 @@ static const char *help[] = {
     "  F4             - hexdump mode (like hexdump output)",
     "  F5             - modbus RTU mode (only for sending), input like RAW: ID data",
     "  F6             - modbus RTU mode (only for sending), input like HEX: ID data",
+    "  F7             - switch between data and command input",
+    "  F8             - modbus ASCII mode (only for sending), input like HEX: ID data",
+    "  F9             - modbus TCP mode (only for sending), input like HEX: ID data",
+    "  F10            - timestamps of lines: none, local time or interval from previous line",
+    "  F11            - split view: one view, two views one above other or side by side",
+    "  F12            - switch active view (changed by F2-F4 and scrolled) when split",
     "  mouse scroll   - scroll text output",
     "  q,^c,^d        - quit",
+    "  f              - (in scroll mode) show only lines passing filter or all lines (see `filter` command)",
     "  TAB            - switch between scroll and edit modes",
     "    to change display/input (text/raw/hex) press Fx when scroll/edit",
     "    in scroll mode keys are almost the same like for this help"
@@ -670,9 +1427,88 @@ static const char *help[] = {
     "  ^F,<PageDn>    - scroll to the next page",
     "  ^B,<PageUp>    - scroll to the previous page",
     "  e,<End>        - scroll the viewport to end of file",
+    "",
+    "Commands (F7):",
     0
 };
 
+// build full help: keys + commands
+static const char *const *fullhelp(){
+    static const char **full = NULL;
+    if(full) return full;
+    const char *const *cmds = commands_help();
+    int nh = 0, nc = 0;
+    while(help[nh]) ++nh;
+    while(cmds[nc]) ++nc;
+    full = MALLOC(const char*, nh + nc + 1);
+    memcpy(full, help, nh * sizeof(char*));
+    memcpy(full + nh, cmds, (nc + 1) * sizeof(char*));
+    return full;
+}
+
+/**
+ * @brief getpaste - read bracketed paste after its start code
+ * @param len (o) - length of text
+ * @return allocated zero-terminated text (should be free'd)
+ */
+static char *getpaste(size_t *len){
+    size_t sz = 256, l = 0;
+    char *buf = MALLOC(char, sz);
+    double t0 = dtime();
+    while(dtime() - t0 < PASTE_TMOUT / 1000.){
+        int c = wgetch(cmd_win);
+        if(c == KEY_PASTE_END) break;
+        if(c < 0 || c > 255) continue; // timeout or some function key in pasted text
+        if(l == sz - 1){
+            sz *= 2;
+            buf = realloc(buf, sz);
+        }
+        buf[l++] = (char)c;
+    }
+    buf[l] = 0;
+    *len = l;
+    return buf;
+}
+
+/**
+ * @brief paste - insert pasted text into input line by one step and redisplay once;
+ *      each complete line is entered like by <Enter> or (with `paste_send`) sent at once
+ * @param text (io) - text (would be modified)
+ * @param len - its length
+ */
+static void paste(char *text, size_t len){
+    char *line = text, *end = text + len;
+    int nsent = 0;
+    while(line < end){
+        char *eol = line;
+        while(eol < end && *eol != '\r' && *eol != '\n') ++eol;
+        if(eol == end){ // last incomplete line: leave it for editing
+            rl_insert_text(line);
+            break;
+        }
+        char *next = eol + 1;
+        if(*eol == '\r' && next < end && *next == '\n') ++next; // CR+LF
+        *eol = 0;
+        rl_insert_text(line);
+        if(paste_send && !cmd_mode){
+            if(*rl_line_buffer){
+                int res = convert_and_send(input_type, rl_line_buffer);
+                if(res == -1) ERRX("Device disconnected");
+                if(res == 0){
+                    show_err("Wrong data format");
+                    break; // leave wrong line in input
+                }
+                ++nsent;
+            }
+            rl_replace_line("", 0);
+            rl_point = 0;
+        }else forward_to_readline('\r'); // enter line
+        line = next;
+    }
+    if(nsent) set_status("Sent %d pasted lines", nsent);
+    cmd_win_redisplay(false);
+}
+
 /**
  * @brief cmdline - console reading process; runs as separate thread
  * @param arg - tty/socket device to write strings entered by user
@@ -684,14 +1520,18 @@ void *cmdline(void* arg){
     show_mode(false);
     do{
         int c = wgetch(cmd_win);
-        if(c < 0) continue;
+        if(c < 0){
+            if(status_changed) show_mode(false);
+            chkstat();
+            continue;
+        }
         bool processed = true;
         DBG("wgetch got %d", c);
         disptype dt = DISP_UNCHANGED;
         switch(c){ // common keys for both modes
             case KEY_F(1): // help
                 DBG("\n\nASK for help\n\n");
-                popup_msg(msg_win, help);
+                popup_msg(msg_win, fullhelp());
                 resize(); // call `resize` to enshure that no problems would be later
             break;
             case KEY_F(2): // TEXT mode
@@ -714,6 +1554,34 @@ void *cmdline(void* arg){
                 DBG("\n\nIN RTU HEX mode\n\n");
                 dt = DISP_RTUHEX;
             break;
+            case KEY_F(7): // command mode
+                cmd_mode = !cmd_mode;
+                show_mode(false);
+            break;
+            case KEY_F(8): // Modbus ASCII mode
+                DBG("\n\nIN Modbus ASCII mode\n\n");
+                dt = DISP_MBASCII;
+            break;
+            case KEY_F(9): // Modbus TCP mode
+                DBG("\n\nIN Modbus TCP mode\n\n");
+                dt = DISP_MBTCP;
+            break;
+            case KEY_F(10): // timestamps
+                tsmargin = (tsmargin + 1) % TSMARGIN_AMOUNT;
+                resize(); // reformat with new line width
+            break;
+            case KEY_F(11): // split view
+                if(splitmode == SPLIT_NONE && views[1].type == views[0].type) // show something different
+                    views[1].type = (views[0].type == DISP_HEX) ? DISP_TEXT : DISP_HEX;
+                splitmode = (splitmode + 1) % SPLIT_AMOUNT;
+                resize();
+            break;
+            case KEY_F(12): // other view
+                if(nviews > 1){
+                    active = (active + 1) % nviews;
+                    show_mode(false);
+                }
+            break;
             case KEY_MOUSE:
                 if(getmouse(&event) == OK){
                     if(event.bstate & (BUTTON4_PRESSED)) rolldown(1); // wheel up
@@ -727,6 +1595,15 @@ void *cmdline(void* arg){
             case KEY_RESIZE:
                 resize();
             break;
+            case KEY_PASTE_BEGIN:{
+                size_t len;
+                char *text = getpaste(&len);
+                if(insert_mode) paste(text, len); // in scroll mode pasted text is ignored
+                FREE(text);
+            }
+            break;
+            case KEY_PASTE_END: // end of paste without beginning
+            break;
             default:
                 processed = false;
         }
@@ -796,10 +1673,13 @@ void *cmdline(void* arg){
                     rollup(1);
                 break;
                 case KEY_PPAGE: // PageUp: roll down for 2/3 of screen
-                    rolldown((2*LINES)/3);
+                    rolldown((2*views[active].rows)/3);
                 break;
                 case KEY_NPAGE: // PageUp: roll up for 2/3 of screen
-                    rollup((2*LINES)/3);
+                    rollup((2*views[active].rows)/3);
+                break;
+                case 'f': // filter on/off
+                    ShowFiltered(!filtered);
                 break;
                 default:
                     if(c == 'q' || c == 'Q') should_exit = true; // quit
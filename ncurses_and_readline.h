@@ -20,23 +20,35 @@
 #define NCURSES_AND_READLINE_H__
 
 #include "dbg.h"
-#include "ttysocket.h"
+#include "filter.h"
+#include "ttyterm.h"
 
-typedef enum{ // display/input data as
-    DISP_TEXT,      // text (non-ASCII input and output as \xxx)
-    DISP_RAW,       // hex output as xx xx xx, input in as numbers in bin (0bxx), oct(0xx), hex (0xxx||0Xxx) or dec and letters
-    DISP_HEX,       // hexdump output, input in hex only (with or without spaces)
-    DISP_RTURAW,    // modbus RTU (only to send): first number is node address, all other - data; CRC calculated
-    DISP_RTUHEX,    // RTU, input in hex (in raw - like RAW)
-    DISP_UNCHANGED, // old
-    DISP_SIZE       // sizeof
-} disptype;
+typedef enum{ // placement of views
+    SPLIT_NONE,         // one view
+    SPLIT_HORIZONTAL,   // two views one above other
+    SPLIT_VERTICAL,     // two views side by side
+    SPLIT_AMOUNT
+} splitmode_t;
 
-void init_readline();
+void init_readline(int pastesend);
 void deinit_readline();
 void init_ncurses();
 void deinit_ncurses();
 void *cmdline(void* arg);
-void AddData(const uint8_t *data, int len);
+void AddData(const uint8_t *data, int len, int64_t stamp);
+void AddChunk(const uint8_t *data, int len, const char *label, chunktype type, int64_t stamp);
+void AddDgrams(const dgram_t *d, int n);
+void AddFrame(const uint8_t *data, int len, int64_t stamp, int64_t gap);
+void set_status(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void show_popup(const char *const *msg);
+int ExportBuffer(const char *path, disptype type, int cols, int nthreads);
+void GetScrollback(size_t *bytes, size_t *lines);
+void SplitViews(splitmode_t mode, disptype type);
+void SetFilter(filter_t *f);
+int ShowFiltered(int on);
+// formatting without screen (for benchmarks)
+void FormatReset(disptype type, bool utf8, int cols, int rows);
+void FormatChunks(const uint8_t *data, size_t len, size_t chunk);
+void FormatStat(size_t *bytes, size_t *lines, size_t *fbufsz, size_t *lnarrsz);
 
 #endif // NCURSES_AND_READLINE_H__
@@ -0,0 +1,75 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * One-shot transaction without UI: send data (converted like user input), print reply until
+ * terminator or timeout. Device is read directly (like autobaud does), so reply is got as soon
+ * as it comes without any gap waiting.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "dbg.h"
+#include "oneshot.h"
+#include "string_functions.h"
+#include "ttysocket.h"
+
+/**
+ * @brief ExecOnce - send data and print reply to stdout
+ * @param pars - parameters
+ * @return exit status: EXEC_OK if terminator found (or any reply got when there's no terminator),
+ *          EXEC_TIMEOUT if no (full) reply during `wait` ms, EXEC_SENDERR or EXEC_DISCONN
+ */
+int ExecOnce(const exec_pars *pars){
+    if(!pars || !pars->data || !ClaimDevice()) return EXEC_SENDERR;
+    strmatch_t *m = strmatch_new(pars->until, pars->untillen);
+    int ret = EXEC_TIMEOUT;
+    double tend = dtime() + pars->wait / 1000.;
+    int r = convert_and_send(pars->mode, pars->data);
+    if(r < 0) ret = EXEC_DISCONN;
+    else if(r == 0) ret = EXEC_SENDERR;
+    uint8_t buf[BUFSIZ];
+    size_t got = 0;
+    while(ret == EXEC_TIMEOUT){
+        int rest = (int)((tend - dtime()) * 1000. + 0.5);
+        if(rest < 1) break;
+        int l = ReadRaw(buf, sizeof(buf), rest);
+        if(l < 0){
+            ret = EXEC_DISCONN;
+            break;
+        }
+        if(l == 0) continue;
+        size_t n = (size_t)l;
+        if(m){
+            size_t e = strmatch_feed(m, buf, n);
+            if(e){ // don't print anything after terminator
+                n = e;
+                ret = EXEC_OK;
+            }
+        }
+        if(write(STDOUT_FILENO, buf, n) != (ssize_t)n) WARN("write()");
+        got += n;
+    }
+    if(!m && got && ret == EXEC_TIMEOUT) ret = EXEC_OK;
+    strmatch_free(&m);
+    ReleaseDevice();
+    DBG("Exec: %zd bytes got, status %d", got, ret);
+    return ret;
+}
@@ -0,0 +1,46 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef ONESHOT_H__
+#define ONESHOT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ttyterm.h" // disptype
+
+// exit status of one-shot transaction
+enum{
+    EXEC_OK = 0,        // got reply
+    EXEC_TIMEOUT,       // no reply or no terminator
+    EXEC_SENDERR,       // can't send data
+    EXEC_DISCONN        // device disconnected
+};
+
+typedef struct{
+    disptype mode;          // input mode for `data`
+    const char *data;       // data to send
+    uint8_t *until;         // reply terminator (or NULL)
+    size_t untillen;        // its length
+    int wait;               // max time to wait for reply, ms
+} exec_pars;
+
+int ExecOnce(const exec_pars *pars);
+
+#endif // ONESHOT_H__
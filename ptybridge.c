@@ -0,0 +1,252 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * PTY bridge: other programs work with device through pseudo-terminal, we relay data in both
+ * directions in separate thread and show it in scrollback. Relay thread never waits for display:
+ * data is put into queue which is read from main loop by `PtyBridgeFlush()`. If other program doesn't
+ * read pty, device isn't read too until pty takes the rest of previous portion (nothing is dropped).
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "chunkqueue.h"
+#include "dbg.h"
+#include "ncurses_and_readline.h"
+#include "ptybridge.h"
+#include "timestamps.h"
+#include "ttysocket.h"
+
+// max size of display queue
+#define QUEUESZ     (4*1024*1024)
+
+typedef enum{
+    DIR_RX,         // device -> pty
+    DIR_TX          // pty -> device
+} direction;
+
+static int master = -1, slave = -1; // pty fds (we hold slave opened to avoid EIO on master)
+static char *linkname = NULL;       // symlink to pty
+static volatile int stopflag = 0, devlost = 0;
+static pthread_t thread;
+static bridgestat_t bstat = {0};
+static size_t nlat = 0;             // amount of latency measurements
+static double sumlat = 0.;
+
+static chunkqueue_t *queue = NULL; // data to display
+
+// portion read from device which pty haven't taken yet
+static uint8_t pend[BUFSIZ];
+static size_t pendlen = 0, pendoff = 0;
+static double pendt0 = 0.;          // time of its reading
+
+static void latency(double t0){
+    double dt = ts_now() / 1e6 - t0;
+    sumlat += dt;
+    ++nlat;
+    if(dt > bstat.maxlat) bstat.maxlat = dt;
+}
+
+// write to pty as much of pending portion as it takes; return FALSE if something left
+static int writepty(){
+    while(pendoff < pendlen){
+        ssize_t l = write(master, pend + pendoff, pendlen - pendoff);
+        if(l < 0){
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN) return FALSE;
+            bstat.dropped += pendlen - pendoff; // pty is broken
+            break;
+        }
+        pendoff += l;
+    }
+    if(pendoff == pendlen) latency(pendt0);
+    pendlen = pendoff = 0;
+    return TRUE;
+}
+
+static void *relay(_U_ void *arg){
+    int devfd = GetDeviceFD();
+    struct pollfd fds[2] = {{.fd = devfd, .events = POLLIN}, {.fd = master, .events = POLLIN}};
+    uint8_t buf[BUFSIZ];
+    while(!stopflag){
+        // backpressure: device isn't polled until pty takes previous portion
+        fds[0].fd = pendlen ? -1 : devfd;
+        fds[1].events = pendlen ? (POLLIN | POLLOUT) : POLLIN;
+        int n = poll(fds, 2, 100);
+        if(n < 0){
+            if(errno == EINTR) continue;
+            WARN("poll()");
+            break;
+        }
+        if(n == 0) continue;
+        if(fds[1].revents & POLLOUT) writepty();
+        if(fds[0].revents){ // device -> pty
+            double t0 = ts_now() / 1e6; // monotonic: it's timestamp of data in scrollback
+            int l = ReadRaw(pend, sizeof(pend), 0);
+            if(l < 0){
+                devlost = 1;
+                break;
+            }
+            if(l > 0){
+                bstat.rx += l;
+                cq_put(queue, DIR_RX, t0, pend, l);
+                pendlen = l;
+                pendt0 = t0;
+                writepty();
+            }
+        }
+        if(fds[1].revents & POLLIN){ // pty -> device
+            double t0 = ts_now() / 1e6;
+            ssize_t l = read(master, buf, sizeof(buf));
+            if(l > 0){
+                if(SendData(buf, l) < 0){
+                    devlost = 1;
+                    break;
+                }
+                latency(t0);
+                bstat.tx += l;
+                cq_put(queue, DIR_TX, t0, buf, l);
+            }
+        }
+    }
+    DBG("relay thread ends");
+    return NULL;
+}
+
+// make pty raw (like opened tty)
+static int setraw(int fd){
+    struct termios2 tty;
+    if(ioctl(fd, TCGETS2, &tty)) return FALSE;
+    tty.c_lflag = 0;
+    tty.c_iflag = 0;
+    tty.c_oflag = 0;
+    tty.c_cflag = (tty.c_cflag & ~(CSIZE|PARENB|CSTOPB)) | CS8 | CREAD | CLOCAL;
+    tty.c_cc[VMIN] = 1;
+    tty.c_cc[VTIME] = 0;
+    return (0 == ioctl(fd, TCSETS2, &tty));
+}
+
+/**
+ * @brief PtyBridgeStart - create pty, symlink it to `link` and start relaying data between it and device
+ * @param link - path to symlink
+ * @return FALSE if failed
+ */
+int PtyBridgeStart(const char *link){
+    if(!link || master > -1) return FALSE;
+    struct stat st;
+    if(0 == lstat(link, &st)){
+        if(!S_ISLNK(st.st_mode)){
+            WARNX(_("%s exists and isn't a symlink"), link);
+            return FALSE;
+        }
+        unlink(link); // old link
+    }
+    if((master = posix_openpt(O_RDWR | O_NOCTTY)) < 0 || grantpt(master) || unlockpt(master)){
+        WARN("posix_openpt()");
+        goto someerr;
+    }
+    const char *name = ptsname(master);
+    if(!name || (slave = open(name, O_RDWR | O_NOCTTY)) < 0){
+        WARN(_("Can't open pty"));
+        goto someerr;
+    }
+    if(!setraw(slave)) WARN(_("Can't set pty attributes"));
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    if(symlink(name, link)){
+        WARN(_("Can't create symlink %s"), link);
+        goto someerr;
+    }
+    linkname = strdup(link);
+    if(!ClaimDevice()){
+        WARNX(_("Device is busy"));
+        goto someerr;
+    }
+    queue = cq_new(QUEUESZ);
+    if(pthread_create(&thread, NULL, relay, NULL)){
+        WARN("pthread_create()");
+        cq_free(&queue);
+        ReleaseDevice();
+        goto someerr;
+    }
+    green(_("Device is available as %s (%s)\n"), link, name);
+    return TRUE;
+someerr:
+    PtyBridgeStop();
+    return FALSE;
+}
+
+// stop relaying, remove symlink and close pty
+void PtyBridgeStop(){
+    if(queue){ // thread is running
+        stopflag = 1;
+        pthread_join(thread, NULL);
+        ReleaseDevice();
+    }
+    if(linkname){
+        unlink(linkname);
+        FREE(linkname);
+    }
+    if(slave > -1) close(slave);
+    if(master > -1) close(master);
+    slave = master = -1;
+    cq_free(&queue);
+}
+
+// show data portion in scrollback: new line with tag on each direction change; received data goes
+// to RX hooks too (control socket, scripts, decoders)
+static void showchunk(const chunkhdr_t *h, const uint8_t *data){
+    static int lastdir = -1;
+    if(h->dir == DIR_RX) RunRxHooks(data, h->len);
+    if((int)h->dir != lastdir){
+        AddChunk(data, h->len, (h->dir == DIR_RX) ? "RX: " : "TX: ", (h->dir == DIR_RX) ? CHUNK_RX : CHUNK_TX,
+                 (int64_t)(h->t * 1e6));
+        lastdir = h->dir;
+    }else AddData(data, h->len, (int64_t)(h->t * 1e6));
+}
+
+/**
+ * @brief PtyBridgeFlush - show relayed data in scrollback (should be called from main loop with locked device)
+ * @return FALSE if device disconnected
+ */
+int PtyBridgeFlush(){
+    if(!queue) return TRUE;
+    cq_flush(queue, showchunk);
+    return !devlost;
+}
+
+/**
+ * @brief PtyBridgeStat - get relay statistics
+ * @param s (o) - statistics
+ * @return FALSE if bridge isn't running
+ */
+int PtyBridgeStat(bridgestat_t *s){
+    if(!queue || !s) return FALSE;
+    *s = bstat;
+    s->lost = cq_lost(queue);
+    s->meanlat = nlat ? sumlat / nlat : 0.;
+    return TRUE;
+}
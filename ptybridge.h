@@ -0,0 +1,39 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef PTYBRIDGE_H__
+#define PTYBRIDGE_H__
+
+#include <stddef.h>
+
+typedef struct{
+    size_t rx;          // bytes relayed from device to pty
+    size_t tx;          // bytes relayed from pty to device
+    size_t dropped;     // bytes which pty didn't accept due to error
+    size_t lost;        // bytes not shown because display queue was full
+    double maxlat;      // max time from read() to write() end, s
+    double meanlat;     // mean of it
+} bridgestat_t;
+
+int PtyBridgeStart(const char *link);
+void PtyBridgeStop();
+int PtyBridgeFlush();
+int PtyBridgeStat(bridgestat_t *s);
+
+#endif // PTYBRIDGE_H__
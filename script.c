@@ -0,0 +1,675 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Simple send/expect scripts. Script is a text file with one command per line:
+ *   # comment
+ *   label:                 - label for jumps
+ *   mode text|raw|hex|rturaw|rtuhex|ascii|tcp - input format for `send` (default: text)
+ *   send data              - convert data like user input in current mode and send it
+ *   expect [-t ms] regex   - wait for regex in received data, stop script with error if timeout
+ *   check [-t ms] regex    - the same, but only set "ok" flag (matched or not)
+ *   ifok label, iffail label - jump to label if last `check` succeed/failed
+ *   goto label             - unconditional jump
+ *   timeout ms             - default timeout for `expect` and `check` (1000ms)
+ *   set var value          - set variable (value could contain other variables)
+ *   inc var, dec var       - increment/decrement variable
+ *   loop var label         - decrement variable and jump to label if it's still > 0
+ *   flush                  - forget all received data
+ *   sleep ms               - pause
+ *   print text             - show text
+ *   fail text              - stop script with error
+ *   exit [code]            - stop script with given exit code (default: 0)
+ * Variables in arguments: $var or ${var}; $0 - last matched string, $1..$9 - its subexpressions; $$ - '$'.
+ * All steps are done by `script_poll()` from main loop, so there's no any sleeping here.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "dbg.h"
+#include "ncurses_and_readline.h"
+#include "script.h"
+#include "string_functions.h"
+#include "ttysocket.h"
+
+// max size of received data buffer for `expect`
+#define RXBUFSZ         (65536)
+// max amount of variables
+#define MAXVARS         (64)
+// amount of captures ($0..$9)
+#define NCAPTURES       (10)
+// max amount of non-waiting steps in one `script_poll()` call (to protect from endless loops)
+#define MAXSTEPS        (1024)
+// default timeout for `expect`, ms
+#define DEFTMOUT        (1000)
+
+typedef enum{
+    S_SEND,
+    S_EXPECT,
+    S_CHECK,
+    S_IFOK,
+    S_IFFAIL,
+    S_GOTO,
+    S_TIMEOUT,
+    S_SET,
+    S_INC,
+    S_DEC,
+    S_LOOP,
+    S_MODE,
+    S_FLUSH,
+    S_SLEEP,
+    S_PRINT,
+    S_FAIL,
+    S_EXIT,
+    S_AMOUNT
+} stepcmd;
+
+// names of commands (by stepcmd order)
+static const char *cmdnames[S_AMOUNT] = {
+    "send", "expect", "check", "ifok", "iffail", "goto", "timeout", "set", "inc", "dec",
+    "loop", "mode", "flush", "sleep", "print", "fail", "exit"
+};
+
+typedef struct{
+    stepcmd cmd;        // command
+    int lineno;         // line number in script
+    char *arg;          // text argument (data to send, text to print, variable name)
+    char *label;        // label to jump
+    int target;         // index of step to jump
+    int num;            // numeric argument (timeout, mode, exit code)
+    regex_t *re;        // compiled regex for expect/check
+    size_t nexec;       // amount of executions
+    double ttotal;      // total time of execution
+    double tmax;        // max time of execution
+} step_t;
+
+typedef struct{
+    char *name;
+    char *value;
+} var_t;
+
+typedef struct{
+    char *name;         // script name
+    step_t *steps;      // all steps
+    int nsteps;         // their amount
+    int cur;            // current step
+    int started;        // current step is started (waiting for data or time)
+    double tstep;       // time of current step start
+    double tend;        // deadline of current step
+    double t0;          // script start time
+    int okflag;         // result of last `check`
+    int result;         // script result (exit code)
+    int tmout;          // default timeout for `expect`
+    disptype mode;      // input mode for `send`
+    var_t vars[MAXVARS];// variables
+    int nvars;
+    char *captures[NCAPTURES]; // last matched data
+    char *rxbuf;        // received data
+    size_t rxlen;       // its length
+    FILE *log;          // timing log
+    int headless;       // running without UI
+} script_t;
+
+static script_t *script = NULL;
+static int lastresult = 0;
+static pthread_mutex_t scriptmutex = PTHREAD_MUTEX_INITIALIZER;
+
+// show message: in UI - in status line, else - on stderr
+static void __attribute__((format(printf, 2, 3))) message(int headless, const char *fmt, ...){
+    char buf[256];
+    va_list ar;
+    va_start(ar, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ar);
+    va_end(ar);
+    if(headless) fprintf(stderr, "%s\n", buf);
+    else set_status("%s", buf);
+}
+
+static void rxhook(_U_ ttyterm_t *t, const uint8_t *data, int len, _U_ void *arg){
+    pthread_mutex_lock(&scriptmutex);
+    if(script && len > 0){
+        if((size_t)len > RXBUFSZ){ // store only tail
+            data += len - RXBUFSZ;
+            len = RXBUFSZ;
+        }
+        if(script->rxlen + len > RXBUFSZ){ // remove oldest data
+            size_t rest = RXBUFSZ - len;
+            memmove(script->rxbuf, script->rxbuf + script->rxlen - rest, rest);
+            script->rxlen = rest;
+        }
+        memcpy(script->rxbuf + script->rxlen, data, len);
+        script->rxlen += len;
+        script->rxbuf[script->rxlen] = 0;
+    }
+    pthread_mutex_unlock(&scriptmutex);
+}
+
+static void script_free(script_t **s){
+    if(!s || !*s) return;
+    script_t *S = *s;
+    for(int i = 0; i < S->nsteps; ++i){
+        step_t *st = &S->steps[i];
+        FREE(st->arg);
+        FREE(st->label);
+        if(st->re){
+            regfree(st->re);
+            FREE(st->re);
+        }
+    }
+    FREE(S->steps);
+    for(int i = 0; i < S->nvars; ++i){
+        FREE(S->vars[i].name);
+        FREE(S->vars[i].value);
+    }
+    for(int i = 0; i < NCAPTURES; ++i) FREE(S->captures[i]);
+    FREE(S->rxbuf);
+    FREE(S->name);
+    if(S->log) fclose(S->log);
+    FREE(*s);
+}
+
+static var_t *getvar(script_t *S, const char *name, size_t len){
+    for(int i = 0; i < S->nvars; ++i)
+        if(strlen(S->vars[i].name) == len && strncmp(S->vars[i].name, name, len) == 0) return &S->vars[i];
+    return NULL;
+}
+
+static int setvar(script_t *S, const char *name, const char *value){
+    var_t *v = getvar(S, name, strlen(name));
+    if(!v){
+        if(S->nvars == MAXVARS) return FALSE;
+        v = &S->vars[S->nvars++];
+        v->name = strdup(name);
+    }
+    FREE(v->value);
+    v->value = strdup(value);
+    return TRUE;
+}
+
+/**
+ * @brief substitute - change all $var, ${var} and $N in `str` by their values
+ * @param S - script
+ * @param str - input string
+ * @return allocated string (should be free'd)
+ */
+static char *substitute(script_t *S, const char *str){
+    size_t bufsz = strlen(str) + 1, len = 0;
+    char *buf = MALLOC(char, bufsz);
+    while(*str){
+        const char *val = NULL;
+        char ch[2] = {*str, 0};
+        if(*str != '$'){
+            val = ch;
+            ++str;
+        }else{
+            ++str;
+            if(*str == '$'){ val = "$"; ++str; }
+            else if(*str >= '0' && *str <= '9'){
+                val = S->captures[*str - '0'];
+                ++str;
+            }else{
+                int braces = (*str == '{');
+                const char *name = str + braces, *e = name;
+                while(isalnum(*e) || *e == '_') ++e;
+                if(braces && *e == '}') str = e + 1;
+                else str = e;
+                var_t *v = getvar(S, name, e - name);
+                if(v) val = v->value;
+                else if(e == name) val = "$"; // single '$'
+            }
+        }
+        if(!val) continue;
+        size_t l = strlen(val);
+        if(len + l + 1 > bufsz){
+            bufsz = (len + l + 1) * 2;
+            buf = realloc(buf, bufsz);
+        }
+        memcpy(buf + len, val, l);
+        len += l;
+    }
+    buf[len] = 0;
+    return buf;
+}
+
+// find label in array of labels
+static int findlabel(char **labels, int *idx, int nlabels, const char *name){
+    for(int i = 0; i < nlabels; ++i)
+        if(strcmp(labels[i], name) == 0) return idx[i];
+    return -1;
+}
+
+/**
+ * @brief parse_step - parse one line of script
+ * @param st (o) - step
+ * @param line - line (without leading spaces)
+ * @param errmsg (o) - error message
+ * @return FALSE if failed
+ */
+static int parse_step(step_t *st, char *line, const char **errmsg){
+    char *arg = line;
+    while(*arg && !isspace(*arg)) ++arg;
+    if(*arg) *arg++ = 0;
+    while(isspace(*arg)) ++arg;
+    char *e = arg + strlen(arg);
+    while(e > arg && isspace(e[-1])) *--e = 0;
+    int cmd = 0;
+    for(; cmd < S_AMOUNT; ++cmd) if(strcmp(cmdnames[cmd], line) == 0) break;
+    if(cmd == S_AMOUNT){ *errmsg = "unknown command"; return FALSE; }
+    st->cmd = cmd;
+    char *eptr;
+    switch(st->cmd){
+        case S_SEND:
+        case S_PRINT:
+        case S_FAIL:
+            st->arg = strdup(arg);
+        break;
+        case S_EXPECT:
+        case S_CHECK:
+            st->num = -1;
+            if(strncmp(arg, "-t", 2) == 0 && isspace(arg[2])){
+                long l = strtol(arg + 3, &eptr, 0);
+                if(eptr == arg + 3 || !isspace(*eptr) || l < 0){ *errmsg = "wrong timeout"; return FALSE; }
+                st->num = (int)l;
+                arg = eptr;
+                while(isspace(*arg)) ++arg;
+            }
+            if(!*arg){ *errmsg = "no pattern"; return FALSE; }
+            st->re = MALLOC(regex_t, 1);
+            if(regcomp(st->re, arg, REG_EXTENDED)){
+                FREE(st->re);
+                *errmsg = "wrong regex";
+                return FALSE;
+            }
+            st->arg = strdup(arg);
+        break;
+        case S_IFOK:
+        case S_IFFAIL:
+        case S_GOTO:
+            if(!*arg){ *errmsg = "no label"; return FALSE; }
+            st->label = strdup(arg);
+        break;
+        case S_TIMEOUT:
+        case S_SLEEP:
+        case S_EXIT:
+            if(!*arg && st->cmd == S_EXIT) break;
+            st->num = (int)strtol(arg, &eptr, 0);
+            if(eptr == arg || *eptr || st->num < 0){ *errmsg = "wrong number"; return FALSE; }
+        break;
+        case S_SET:
+        case S_LOOP:
+            e = arg;
+            while(*e && !isspace(*e)) ++e;
+            if(*e) *e++ = 0;
+            while(isspace(*e)) ++e;
+            if(!*arg || !*e){ *errmsg = "need two arguments"; return FALSE; }
+            st->arg = strdup(arg);
+            st->label = strdup(e); // value for `set` or label for `loop`
+        break;
+        case S_INC:
+        case S_DEC:
+            if(!*arg){ *errmsg = "no variable"; return FALSE; }
+            st->arg = strdup(arg);
+        break;
+        case S_MODE:
+            st->num = str2mode(arg);
+            if(st->num == DISP_UNCHANGED){ *errmsg = "wrong mode"; return FALSE; }
+        break;
+        default:
+        break;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief script_load - read and parse script file
+ * @param path - file name
+ * @param headless - where to show errors
+ * @return script or NULL if failed
+ */
+static script_t *script_load(const char *path, int headless){
+    FILE *f = fopen(path, "r");
+    if(!f){
+        message(headless, "Can't open %s: %s", path, strerror(errno));
+        return NULL;
+    }
+    script_t *S = MALLOC(script_t, 1);
+    S->headless = headless;
+    S->name = strdup(path);
+    int nmax = 0, nlabels = 0, lmax = 0, lineno = 0, ok = TRUE;
+    char **labels = NULL, *line = NULL;
+    int *labelidx = NULL;
+    size_t linesz = 0;
+    while(ok && getline(&line, &linesz, f) > 0){
+        ++lineno;
+        char *l = line;
+        while(isspace(*l)) ++l;
+        if(!*l || *l == '#') continue;
+        char *e = l + strlen(l);
+        while(e > l && isspace(e[-1])) *--e = 0;
+        if(e[-1] == ':' && !strpbrk(l, " \t")){ // label
+            e[-1] = 0;
+            if(findlabel(labels, labelidx, nlabels, l) > -1){
+                message(headless, "%s:%d: label '%s' already exists", path, lineno, l);
+                ok = FALSE;
+                break;
+            }
+            if(nlabels == lmax){
+                lmax += 16;
+                labels = realloc(labels, lmax * sizeof(char*));
+                labelidx = realloc(labelidx, lmax * sizeof(int));
+            }
+            labels[nlabels] = strdup(l);
+            labelidx[nlabels++] = S->nsteps;
+            continue;
+        }
+        if(S->nsteps == nmax){
+            nmax += 64;
+            S->steps = realloc(S->steps, nmax * sizeof(step_t));
+        }
+        step_t *st = &S->steps[S->nsteps++];
+        memset(st, 0, sizeof(step_t));
+        st->lineno = lineno;
+        const char *errmsg = NULL;
+        if(!parse_step(st, l, &errmsg)){
+            message(headless, "%s:%d: %s", path, lineno, errmsg);
+            ok = FALSE;
+        }
+    }
+    FREE(line);
+    fclose(f);
+    for(int i = 0; ok && i < S->nsteps; ++i){ // resolve labels
+        step_t *st = &S->steps[i];
+        if(st->cmd != S_IFOK && st->cmd != S_IFFAIL && st->cmd != S_GOTO && st->cmd != S_LOOP) continue;
+        st->target = findlabel(labels, labelidx, nlabels, st->label);
+        if(st->target < 0){
+            message(headless, "%s:%d: no label '%s'", path, st->lineno, st->label);
+            ok = FALSE;
+        }
+    }
+    for(int i = 0; i < nlabels; ++i) FREE(labels[i]);
+    FREE(labels);
+    FREE(labelidx);
+    if(ok && S->nsteps == 0){
+        message(headless, "%s: empty script", path);
+        ok = FALSE;
+    }
+    if(!ok) script_free(&S);
+    return S;
+}
+
+// check if current step's pattern found; store captures and remove data till the end of match
+static int chkmatch(script_t *S, step_t *st){
+    regmatch_t m[NCAPTURES];
+    m[0].rm_so = 0;
+    m[0].rm_eo = S->rxlen;
+    if(regexec(st->re, S->rxbuf, NCAPTURES, m, REG_STARTEND)) return FALSE;
+    for(int i = 0; i < NCAPTURES; ++i){
+        FREE(S->captures[i]);
+        if(m[i].rm_so < 0) continue;
+        size_t l = m[i].rm_eo - m[i].rm_so;
+        S->captures[i] = MALLOC(char, l + 1);
+        memcpy(S->captures[i], S->rxbuf + m[i].rm_so, l);
+    }
+    size_t rest = S->rxlen - m[0].rm_eo;
+    memmove(S->rxbuf, S->rxbuf + m[0].rm_eo, rest);
+    S->rxlen = rest;
+    S->rxbuf[rest] = 0;
+    return TRUE;
+}
+
+// finish script with given result
+static void finish(script_t *S, int result){
+    S->result = result;
+    S->cur = S->nsteps;
+}
+
+// finish current step: store its timing and go to step `next`
+static void endstep(script_t *S, step_t *st, int next, const char *comment){
+    double t = dtime(), dt = t - S->tstep;
+    ++st->nexec;
+    st->ttotal += dt;
+    if(dt > st->tmax) st->tmax = dt;
+    if(S->log) fprintf(S->log, "%10.6f %4d %-7s %10.3f ms%s%s\n", S->tstep - S->t0, st->lineno,
+                       cmdnames[st->cmd], dt * 1000., comment ? "  " : "", comment ? comment : "");
+    S->started = FALSE;
+    if(S->cur < S->nsteps) S->cur = next;
+}
+
+// return value of integer variable
+static long getlong(script_t *S, const char *name){
+    var_t *v = getvar(S, name, strlen(name));
+    return v ? strtol(v->value, NULL, 0) : 0;
+}
+
+static void setlong(script_t *S, const char *name, long val){
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%ld", val);
+    setvar(S, name, buf);
+}
+
+/**
+ * @brief runstep - run current step
+ * @param S - script
+ * @return FALSE if step is waiting for something
+ */
+static int runstep(script_t *S){
+    step_t *st = &S->steps[S->cur];
+    double t = dtime();
+    if(!S->started){
+        S->started = TRUE;
+        S->tstep = t;
+    }
+    int next = S->cur + 1, tm;
+    char *str = NULL;
+    switch(st->cmd){
+        case S_SEND:{
+            str = substitute(S, st->arg);
+            int r = convert_and_send(S->mode, str);
+            if(r < 1){
+                message(S->headless, "%s:%d: %s", S->name, st->lineno, r ? "device disconnected" : "wrong data format");
+                finish(S, 1);
+            }
+        }
+        break;
+        case S_EXPECT:
+        case S_CHECK:
+            tm = (st->num < 0) ? S->tmout : st->num;
+            if(chkmatch(S, st)){
+                S->okflag = TRUE;
+                break;
+            }
+            if(t - S->tstep < tm / 1000.){
+                S->tend = S->tstep + tm / 1000.;
+                return FALSE;
+            }
+            S->okflag = FALSE;
+            if(st->cmd == S_EXPECT){
+                message(S->headless, "%s:%d: timeout waiting for '%s'", S->name, st->lineno, st->arg);
+                finish(S, 1);
+            }
+        break;
+        case S_IFOK:
+            if(S->okflag) next = st->target;
+        break;
+        case S_IFFAIL:
+            if(!S->okflag) next = st->target;
+        break;
+        case S_GOTO:
+            next = st->target;
+        break;
+        case S_TIMEOUT:
+            S->tmout = st->num;
+        break;
+        case S_SET:
+            str = substitute(S, st->label);
+            if(!setvar(S, st->arg, str)){
+                message(S->headless, "%s:%d: too many variables", S->name, st->lineno);
+                finish(S, 1);
+            }
+        break;
+        case S_INC:
+            setlong(S, st->arg, getlong(S, st->arg) + 1);
+        break;
+        case S_DEC:
+            setlong(S, st->arg, getlong(S, st->arg) - 1);
+        break;
+        case S_LOOP:{
+            long l = getlong(S, st->arg) - 1;
+            setlong(S, st->arg, l);
+            if(l > 0) next = st->target;
+        }
+        break;
+        case S_MODE:
+            S->mode = st->num;
+        break;
+        case S_FLUSH:
+            S->rxlen = 0;
+            S->rxbuf[0] = 0;
+        break;
+        case S_SLEEP:
+            if(t - S->tstep < st->num / 1000.){
+                S->tend = S->tstep + st->num / 1000.;
+                return FALSE;
+            }
+        break;
+        case S_PRINT:
+            str = substitute(S, st->arg);
+            if(S->headless){ printf("%s\n", str); fflush(stdout); }
+            else set_status("%s", str);
+        break;
+        case S_FAIL:
+            str = substitute(S, st->arg);
+            message(S->headless, "%s:%d: %s", S->name, st->lineno, str);
+            finish(S, 1);
+        break;
+        case S_EXIT:
+            finish(S, st->num);
+        break;
+        default:
+        break;
+    }
+    endstep(S, st, next, str);
+    FREE(str);
+    return TRUE;
+}
+
+// write timing statistics into log
+static void logstat(script_t *S){
+    if(!S->log) return;
+    fprintf(S->log, "# total time: %.3f s, result: %d\n# line command    runs   mean, ms    max, ms\n", dtime() - S->t0, S->result);
+    for(int i = 0; i < S->nsteps; ++i){
+        step_t *st = &S->steps[i];
+        if(!st->nexec) continue;
+        fprintf(S->log, "# %4d %-7s %7zd %10.3f %10.3f\n", st->lineno, cmdnames[st->cmd], st->nexec,
+                st->ttotal * 1000. / st->nexec, st->tmax * 1000.);
+    }
+}
+
+/**
+ * @brief script_run - load script and start it (it will be run by `script_poll()`)
+ * @param path - script file
+ * @param logpath - file for steps timing log (or NULL)
+ * @param headless - TRUE if running without UI
+ * @return FALSE if failed
+ */
+int script_run(const char *path, const char *logpath, int headless){
+    if(!path) return FALSE;
+    if(script_active()){
+        message(headless, "Another script is running");
+        return FALSE;
+    }
+    script_t *S = script_load(path, headless);
+    if(!S) return FALSE;
+    if(logpath && !(S->log = fopen(logpath, "w"))){
+        message(headless, "Can't open %s: %s", logpath, strerror(errno));
+        script_free(&S);
+        return FALSE;
+    }
+    if(S->log) fprintf(S->log, "# script %s\n#  time, s line command   duration  comment\n", path);
+    S->tmout = DEFTMOUT;
+    S->mode = DISP_TEXT;
+    S->rxbuf = MALLOC(char, RXBUFSZ + 1);
+    S->t0 = dtime();
+    pthread_mutex_lock(&scriptmutex);
+    script = S;
+    pthread_mutex_unlock(&scriptmutex);
+    addrxhook(rxhook, NULL);
+    if(!headless) set_status("Script %s started", path);
+    return TRUE;
+}
+
+/**
+ * @brief script_poll - run all script steps that are ready (should be called from main loop)
+ * @return time till nearest deadline of current step in ms or -1 if there's no deadlines
+ */
+int script_poll(){
+    int ret = -1;
+    pthread_mutex_lock(&scriptmutex);
+    script_t *S = script;
+    if(!S){
+        pthread_mutex_unlock(&scriptmutex);
+        return -1;
+    }
+    for(int i = 0; i < MAXSTEPS && S->cur < S->nsteps; ++i){
+        if(!runstep(S)){
+            double dt = S->tend - dtime();
+            ret = (dt > 0.) ? (int)(dt * 1000.) + 1 : 0;
+            break;
+        }
+    }
+    if(S->cur >= S->nsteps){ // script is over
+        delrxhook(rxhook, NULL);
+        lastresult = S->result;
+        logstat(S);
+        message(S->headless, "Script %s done with result %d (%.3f s)", S->name, S->result, dtime() - S->t0);
+        script = NULL;
+        script_free(&S);
+    }else if(ret < 0) ret = 0; // steps limit reached
+    pthread_mutex_unlock(&scriptmutex);
+    return ret;
+}
+
+// stop script by user request
+void script_stop(){
+    pthread_mutex_lock(&scriptmutex);
+    if(script){
+        step_t *st = &script->steps[script->cur];
+        if(script->started) endstep(script, st, script->cur, "stopped");
+        message(script->headless, "%s:%d: stopped", script->name, st->lineno);
+        finish(script, 1);
+    }
+    pthread_mutex_unlock(&scriptmutex);
+}
+
+int script_active(){
+    pthread_mutex_lock(&scriptmutex);
+    int r = (script != NULL);
+    pthread_mutex_unlock(&scriptmutex);
+    return r;
+}
+
+// result of last finished script: 0 if OK
+int script_result(){
+    return lastresult;
+}
@@ -0,0 +1,146 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Passive sniffer of two serial ports (e.g. RX and TX lines of one link). Both ports are read
+ * by one thread, so data portions are timestamped and put into queue in order of reading:
+ * merged timeline never needs reordering.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "chunkqueue.h"
+#include "dbg.h"
+#include "ncurses_and_readline.h"
+#include "sniffer.h"
+#include "timestamps.h"
+#include "ttysocket.h"
+
+// max size of display queue
+#define QUEUESZ     (8*1024*1024)
+// size of reading buffer
+#define READBUFSZ   (65536)
+
+typedef enum{
+    PORT_A,         // main device
+    PORT_B          // second port
+} portno;
+
+static TTY_descr2 *port2 = NULL;
+static chunkqueue_t *queue = NULL;
+static pthread_t thread;
+static volatile int stopflag = 0, devlost = 0;
+static double t0 = 0.;          // start time
+static double chartime = 0.;    // time of one symbol transmission, s
+static double gap = 0.;         // min idle gap between frames, s
+
+static void *sniff(_U_ void *arg){
+    struct pollfd fds[2] = {{.fd = GetDeviceFD(), .events = POLLIN}, {.fd = port2->comfd, .events = POLLIN}};
+    uint8_t buf[READBUFSZ];
+    while(!stopflag){
+        int n = poll(fds, 2, 100);
+        if(n < 0){
+            if(errno == EINTR) continue;
+            WARN("poll()");
+            break;
+        }
+        for(int i = 0; i < 2; ++i){
+            if(!fds[i].revents) continue;
+            int l = (i == PORT_A) ? ReadRaw(buf, sizeof(buf), 0) : read(fds[i].fd, buf, sizeof(buf));
+            int64_t stamp = ts_now();
+            if(l < 0 || (l == 0 && i == PORT_B)){ // ReadRaw returns 0 on timeout, read - on EOF
+                devlost = 1;
+                return NULL;
+            }
+            if(l < 1) continue;
+            if(i == PORT_B) DumpData(DUMP_TX, buf, l, stamp); // data of port A is dumped by ReadRaw as RX
+            cq_put(queue, i, stamp * 1e-6, buf, l);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief SnifferStart - open second port with settings of current device and start reading both
+ * @param d - opened device
+ * @param port - second port
+ * @param framegap - min idle time between frames, ms (0 - split frames only when direction changes)
+ * @return FALSE if failed
+ */
+int SnifferStart(const chardevice *d, const char *port, double framegap){
+    if(!port || port2 || !d || d->type != DEV_TTY) return FALSE;
+    if(!(port2 = opentty(port, d->speed, d->port))) return FALSE;
+    if(port2->speed != d->speed) WARNX(_("Speed of %s differs from speed of %s"), port, d->name);
+    if(!ClaimDevice()){
+        WARNX(_("Device is busy"));
+        closetty(&port2);
+        return FALSE;
+    }
+    chartime = (double)tty_symbits(port2) / d->speed; // format of both ports is the same
+    gap = framegap / 1000.;
+    queue = cq_new(QUEUESZ);
+    t0 = ts_now() * 1e-6;
+    if(pthread_create(&thread, NULL, sniff, NULL)){
+        WARN("pthread_create()");
+        cq_free(&queue);
+        ReleaseDevice();
+        closetty(&port2);
+        return FALSE;
+    }
+    green(_("Sniffing A: %s, B: %s\n"), d->name, port);
+    return TRUE;
+}
+
+void SnifferStop(){
+    if(!queue) return;
+    stopflag = 1;
+    pthread_join(thread, NULL);
+    ReleaseDevice();
+    closetty(&port2);
+    cq_free(&queue);
+}
+
+// show data portion: new frame on port change or after idle gap; data of main device goes to RX hooks
+static void showchunk(const chunkhdr_t *h, const uint8_t *data){
+    static int lastport = -1;
+    static double tlast = 0.; // time of end of previous portion
+    if(h->dir == PORT_A) RunRxHooks(data, h->len);
+    double tstart = h->t - h->len * chartime; // estimated time of first symbol receiving
+    if((int)h->dir != lastport || (gap > 0. && tstart - tlast > gap)){
+        char label[32];
+        snprintf(label, sizeof(label), "%c %.6f: ", (h->dir == PORT_A) ? 'A' : 'B', tstart - t0);
+        AddChunk(data, h->len, label, (h->dir == PORT_A) ? CHUNK_RX : CHUNK_TX, (int64_t)(h->t * 1e6));
+        lastport = h->dir;
+    }else AddData(data, h->len, (int64_t)(h->t * 1e6));
+    tlast = h->t;
+}
+
+/**
+ * @brief SnifferFlush - show all data read (should be called from main loop with locked device)
+ * @return FALSE if one of devices disconnected
+ */
+int SnifferFlush(){
+    if(!queue) return TRUE;
+    cq_flush(queue, showchunk);
+    return !devlost;
+}
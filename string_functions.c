@@ -18,7 +18,13 @@
 
 #include <stdio.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
+#include "checksum.h"
+#include "dbg.h"
+#include "modbus.h"
 #include "string_functions.h"
 
 // end of line - for text mode
@@ -171,25 +177,60 @@ static inline const char* getu32(const char *str, uint32_t *val){
     return omit_nonletters(DISP_RTU, eptr);
 }*/
 
+#ifdef __SSE2__
 /**
- * @brief convert_and_send - convert input line and send it (in text mode add `eol`)
- * @param line - line with data
- * @return amount of bytes sent, 0 if error or -1 if disconnect
+ * @brief hexblock - convert 16 hex symbols into 8 bytes or five "HH " groups into 5 bytes
+ * @param in - input (at least 16 symbols)
+ * @param out - output
+ * @param outlen (o) - amount of bytes in `out`
+ * @return amount of input symbols processed (0 if there's no such block)
  */
-int convert_and_send(disptype input_type, const char *line){
-    static uint8_t *buf = NULL;
-    static size_t bufsiz = 0;
-    size_t curpos = 0; // position in `buf`
-    line = omit_nonletters(input_type, line);
-    DBG("got: '%s' to send", line);
-    void CHKbufsiz(size_t sz){
-        if(curpos + sz >= bufsiz){ // out ouptut buffer can't be larger than input
-            bufsiz += BUFSIZ;
-            buf = realloc(buf, bufsiz);
-        }
+static inline int hexblock(const char *in, uint8_t *out, int *outlen){
+    __m128i v = _mm_loadu_si128((const __m128i*)in);
+    // symbols > 127 are negative and don't fall into ranges below
+    __m128i d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    __m128i l = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i isd = _mm_and_si128(_mm_cmpgt_epi8(d, _mm_set1_epi8(-1)), _mm_cmplt_epi8(d, _mm_set1_epi8(10)));
+    __m128i isl = _mm_and_si128(_mm_cmpgt_epi8(l, _mm_set1_epi8(-1)), _mm_cmplt_epi8(l, _mm_set1_epi8(6)));
+    int mask = _mm_movemask_epi8(_mm_or_si128(isd, isl));
+    __m128i n = _mm_or_si128(_mm_and_si128(isd, d), _mm_and_si128(isl, _mm_add_epi8(l, _mm_set1_epi8(10))));
+    if(mask == 0xffff){ // each 16-bit word: high nibble in low byte, low nibble in high byte
+        __m128i w = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(n, _mm_set1_epi16(0xff)), 4), _mm_srli_epi16(n, 8));
+        _mm_storel_epi64((__m128i*)out, _mm_packus_epi16(w, w));
+        *outlen = 8;
+        return 16;
     }
-    while(*line){
-        CHKbufsiz(1);
+    if((mask & 0x7fff) != 0x36db) return 0;
+    // separators are all symbols skipped by omit_nonletters() except zero
+    __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(32)), _mm_cmplt_epi8(v, _mm_set1_epi8(127)));
+    __m128i notsep = _mm_or_si128(letter, _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+    if(_mm_movemask_epi8(notsep) & 0x4924) return 0;
+    uint8_t nb[16];
+    _mm_storeu_si128((__m128i*)nb, n);
+    for(int i = 0; i < 5; ++i) out[i] = (nb[3*i] << 4) | nb[3*i+1];
+    *outlen = 5;
+    return 15;
+}
+#endif
+
+/**
+ * @brief parse_input - convert input data portion into binary (like user input in given mode, without EOL or CRC)
+ * @param input_type - input mode
+ * @param line - input, `line[len]` should be zero; zeros inside are skipped
+ * @param len - its length
+ * @param out - output buffer (not less than `len` bytes)
+ * @param outlen (o) - amount of bytes in `out`
+ * @param last - FALSE if there will be next portion: last number (which could continue in it) isn't converted
+ * @return amount of input symbols processed
+ */
+size_t parse_input(disptype input_type, const char *line, size_t len, uint8_t *out, size_t *outlen, int last){
+    const char *start = line, *end = line + len;
+    uint8_t *optr = out;
+    while(1){
+        line = omit_nonletters(input_type, line);
+        if(line >= end) break;
+        if(!*line){ ++line; continue; }
+        const char *token = line;
         int ch = -1;
         switch(input_type){
             case DISP_TEXT: // only check for '\'
@@ -221,39 +262,196 @@ int convert_and_send(disptype input_type, const char *line){
             break;
             case DISP_HEX: // read next 2 hex bytes and put into buffer
             case DISP_RTUHEX: // the same (but calculate CRC at the end)
+            case DISP_MBASCII: // the same (but make ASCII frame with LRC)
+            case DISP_MBTCP: // the same (but add MBAP header)
+#ifdef __SSE2__
+                // long hex strings or "HH HH ..." blocks at once (pairs don't depend on next portion)
+                if(end - line >= 16){
+                    int n, l = hexblock(line, optr, &n);
+                    if(l){
+                        line += l; optr += n;
+                        continue;
+                    }
+                }
+#endif
                 line = gethex(line, &ch);
             break;
             default:
+                *outlen = 0;
                 return 0; // unknown display type
         }
-        if(ch > -1) buf[curpos++] = ch;
-        line = omit_nonletters(input_type, line);
+        if(line > end) line = end; // "\\x" or "0x" at the end
+        if(line == end && !last){ // this number could continue in next portion
+            line = token;
+            break;
+        }
+        if(ch > -1) *optr++ = ch;
     }
-    // now insert EOL in text mode
-    if(input_type == DISP_TEXT){
-        if(curpos+eollen >= bufsiz){
-            bufsiz += BUFSIZ;
-            buf = realloc(buf, bufsiz);
+    *outlen = optr - out;
+    return line - start;
+}
+
+/**
+ * @brief convert_line - convert input line into data to send (like user input: with EOL, CRC or checksum);
+ *          Modbus ASCII and TCP requests aren't framed (their length is checked only)
+ * @param input_type - input mode
+ * @param line - input line
+ * @param eol - EOL for TEXT mode
+ * @param cs - checksum for RAW and HEX modes (or NULL)
+ * @param buf (io) - output buffer (enlarged if need)
+ * @param bufsiz (io) - its size (output buffer has place for Modbus frame)
+ * @return amount of bytes in `buf` (0 if nothing to send or error)
+ */
+size_t convert_line(disptype input_type, const char *line, const char *eol, const cspars_t *cs,
+                    uint8_t **buf, size_t *bufsiz){
+    if(!line || !buf || !bufsiz) return 0;
+    size_t len = strlen(line), curpos = 0, eollen = eol ? strlen(eol) : 0;
+    DBG("got: '%s' to send", line);
+    // output can't be longer than input, reserve place for EOL and checksum; ASCII frame is twice longer
+    size_t need = len + eollen + 4;
+    if(input_type == DISP_MBASCII || input_type == DISP_MBTCP) need = 2*len + 8;
+    if(need > *bufsiz){
+        *bufsiz = need;
+        *buf = realloc(*buf, *bufsiz);
+    }
+    uint8_t *b = *buf;
+    parse_input(input_type, line, len, b, &curpos, TRUE);
+    switch(input_type){
+        case DISP_TEXT: // now insert EOL in text mode
+            memcpy(b+curpos, eol, eollen);
+            curpos += eollen;
+            DBG("Add EOL");
+        break;
+        case DISP_RTURAW: // calculate CRC
+        case DISP_RTUHEX:
+        {
+            static const cspars_t rtu = {.algo = CS_MODBUS}; // Lo, Hi
+            curpos += cs_append(&rtu, b, curpos);
         }
-        memcpy(buf+curpos, eol, eollen);
-        curpos += eollen;
-        DBG("Add EOL");
-    }else if(input_type == DISP_RTURAW || input_type == DISP_RTUHEX){ // calculate CRC
-        CHKbufsiz(2);
-        uint16_t crc = 0xFFFF;
-        for(size_t pos = 0; pos < curpos; ++pos){
-            crc ^= (uint16_t)buf[pos];
-            for(int i = 8; i; --i){
-                if((crc & 1)){
-                    crc >>= 1;
-                    crc ^= 0xA001;
-                }else crc >>= 1;
-            }
+        break;
+        case DISP_MBASCII:
+        case DISP_MBTCP:
+            if(curpos > MB_MAXADU) return 0;
+        break;
+        case DISP_RAW: // checksum selected by user
+        case DISP_HEX:
+            curpos += cs_append(cs, b, curpos);
+        break;
+        default:
+            return 0; // unknown display type
+    }
+    return curpos;
+}
+
+/**
+ * @brief convert_and_send - convert input line and send it (in text mode add `eol`)
+ * @param line - line with data
+ * @return amount of bytes sent, 0 if error or -1 if disconnect
+ */
+int convert_and_send(disptype input_type, const char *line){
+    return SendLine(input_type, line);
+}
+
+/**
+ * @brief str2mode - get input mode by its name
+ * @param name - "text", "raw", "hex", "rturaw", "rtuhex", "ascii" or "tcp" (case insensitive)
+ * @return mode or DISP_UNCHANGED if name is wrong
+ */
+disptype str2mode(const char *name){
+    static const char *modenames[] = {"text", "raw", "hex", "rturaw", "rtuhex", "ascii", "tcp", NULL}; // by disptype order
+    if(!name) return DISP_UNCHANGED;
+    for(int i = 0; modenames[i]; ++i)
+        if(strcasecmp(modenames[i], name) == 0) return (disptype)i;
+    return DISP_UNCHANGED;
+}
+
+/**
+ * @brief unescape - convert string with escape-sequences (like in TEXT mode) into binary data
+ * @param line - input string
+ * @param len (o) - length of data
+ * @return allocated zero-terminated buffer (should be free'd) or NULL if empty/wrong
+ */
+uint8_t *unescape(const char *line, size_t *len){
+    if(!line || !*line) return NULL;
+    uint8_t *buf = MALLOC(uint8_t, strlen(line) + 1), *ptr = buf;
+    while(*line){
+        int ch = *line++;
+        if(ch == '\\') line = getspec(line, &ch);
+        if(ch > -1) *ptr++ = ch;
+    }
+    if(ptr == buf){
+        FREE(buf);
+        return NULL;
+    }
+    *ptr = 0;
+    if(len) *len = ptr - buf;
+    return buf;
+}
+
+/**
+ * @brief strmatch_new - create new streaming pattern matcher (Knuth-Morris-Pratt)
+ * @param pattern - pattern to search
+ * @param len - its length
+ * @return allocated matcher or NULL if pattern is empty
+ */
+strmatch_t *strmatch_new(const uint8_t *pattern, size_t len){
+    if(!pattern || !len) return NULL;
+    strmatch_t *m = MALLOC(strmatch_t, 1);
+    m->pattern = MALLOC(uint8_t, len);
+    memcpy(m->pattern, pattern, len);
+    m->len = len;
+    m->fail = MALLOC(size_t, len);
+    // m->fail[i] - length of longest proper prefix of pattern[0..i], which is also its suffix
+    for(size_t i = 1, k = 0; i < len; ++i){
+        while(k && pattern[i] != pattern[k]) k = m->fail[k-1];
+        if(pattern[i] == pattern[k]) ++k;
+        m->fail[i] = k;
+    }
+    return m;
+}
+
+void strmatch_free(strmatch_t **m){
+    if(!m || !*m) return;
+    FREE((*m)->pattern);
+    FREE((*m)->fail);
+    FREE(*m);
+}
+
+// forget about partial match
+void strmatch_reset(strmatch_t *m){
+    if(m) m->pos = 0;
+}
+
+/**
+ * @brief strmatch_feed - feed next data portion to matcher (pattern could be splitted between portions)
+ * @param m - matcher
+ * @param data - data portion
+ * @param len - its length
+ * @return amount of bytes from `data` processed until the end of match (so match ends @ data[ret-1]) or 0 if not found
+ */
+size_t strmatch_feed(strmatch_t *m, const uint8_t *data, size_t len){
+    if(!m || !data) return 0;
+    size_t k = m->pos;
+    for(size_t i = 0; i < len; ++i){
+        while(k && data[i] != m->pattern[k]) k = m->fail[k-1];
+        if(data[i] == m->pattern[k]) ++k;
+        if(k == m->len){
+            m->pos = 0;
+            return i + 1;
         }
-        buf[curpos++] = crc & 0xff; // Lo
-        buf[curpos++] = crc >> 8; // Hi
     }
-    return SendData(buf, curpos);
+    m->pos = k;
+    return 0;
+}
+
+/**
+ * @brief geteol - get current EOL
+ * @param len (o) - its length
+ * @return EOL string
+ */
+const char *geteol(int *len){
+    if(len) *len = eollen;
+    return eol;
 }
 
 /**
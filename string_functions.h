@@ -18,7 +18,25 @@
 
 #pragma once
 
-#include "ncurses_and_readline.h"
+#include "ttyterm.h"
+
+// streaming pattern matcher
+typedef struct{
+    uint8_t *pattern;   // pattern to search
+    size_t len;         // its length
+    size_t *fail;       // KMP failure function
+    size_t pos;         // amount of already matched symbols
+} strmatch_t;
 
 int convert_and_send(disptype input_type, const char *line);
+size_t convert_line(disptype input_type, const char *line, const char *eol, const cspars_t *cs,
+                    uint8_t **buf, size_t *bufsiz);
+size_t parse_input(disptype input_type, const char *line, size_t len, uint8_t *out, size_t *outlen, int last);
+disptype str2mode(const char *name);
 void changeeol(const char *e);
+const char *geteol(int *len);
+uint8_t *unescape(const char *line, size_t *len);
+strmatch_t *strmatch_new(const uint8_t *pattern, size_t len);
+void strmatch_free(strmatch_t **m);
+void strmatch_reset(strmatch_t *m);
+size_t strmatch_feed(strmatch_t *m, const uint8_t *data, size_t len);
@@ -0,0 +1,164 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Timestamps of received data: microseconds of CLOCK_MONOTONIC (kernel timestamps of sockets are
+ * converted to it), so intervals don't depend on system time changes.
+ * `tsarr_t` stores them as zigzag varints of differences: 1..3 bytes per value instead of 8;
+ * each TS_CKSTEP'th value is stored as is to get any value after decoding less than TS_CKSTEP varints.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "dbg.h"
+#include "timestamps.h"
+
+// step of checkpoints
+#define TS_CKSTEP   (64)
+// initial size of varints buffer
+#define TS_DATASZ   (4096)
+
+// current time, us
+int64_t ts_now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// difference between CLOCK_REALTIME and CLOCK_MONOTONIC, us
+static int64_t realoffset(){
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 - ts_now();
+}
+
+/**
+ * @brief ts_fromreal - convert CLOCK_REALTIME time (e.g. SO_TIMESTAMPNS) into timestamp
+ * @param t - time
+ * @return timestamp, us
+ */
+int64_t ts_fromreal(const struct timespec *t){
+    return (int64_t)t->tv_sec * 1000000 + t->tv_nsec / 1000 - realoffset();
+}
+
+// convert timestamp into UNIX time, us
+int64_t ts_toreal(int64_t t){
+    return t + realoffset();
+}
+
+/**
+ * @brief ts_format - print local time of timestamp as HH:MM:SS.uuuuuu
+ * @param buf - buffer
+ * @param len - its length
+ * @param t - timestamp
+ * @return amount of symbols printed
+ */
+size_t ts_format(char *buf, size_t len, int64_t t){
+    t = ts_toreal(t);
+    time_t sec = (time_t)(t / 1000000);
+    struct tm tm;
+    localtime_r(&sec, &tm);
+    int n = snprintf(buf, len, "%02d:%02d:%02d.%06d", tm.tm_hour, tm.tm_min, tm.tm_sec, (int)(t % 1000000));
+    return (n < 0) ? 0 : ((size_t)n < len ? (size_t)n : len - 1);
+}
+
+// free memory of array
+void tsarr_clear(tsarr_t *a){
+    if(!a) return;
+    FREE(a->data);
+    FREE(a->ckpt);
+    memset(a, 0, sizeof(tsarr_t));
+}
+
+/**
+ * @brief tsarr_push - add value to the end of array
+ * @param a - array
+ * @param v - value
+ */
+void tsarr_push(tsarr_t *a, int64_t v){
+    if(a->datasz - a->datalen < 10){ // max length of varint
+        a->datasz = a->datasz ? a->datasz * 2 : TS_DATASZ;
+        a->data = realloc(a->data, a->datasz);
+    }
+    if(a->n % TS_CKSTEP == 0){
+        size_t k = a->n / TS_CKSTEP;
+        if(k == a->cksz){
+            a->cksz = a->cksz ? a->cksz * 2 : 64;
+            a->ckpt = realloc(a->ckpt, a->cksz * sizeof(tsckpt_t));
+        }
+        a->ckpt[k].pos = a->datalen;
+        a->ckpt[k].val = v;
+    }
+    int64_t d = v - (a->n ? a->last : 0);
+    uint64_t z = ((uint64_t)d << 1) ^ (uint64_t)(d >> 63); // zigzag: small negative are small too
+    uint8_t *p = a->data + a->datalen;
+    while(z > 0x7f){
+        *p++ = (uint8_t)(z | 0x80);
+        z >>= 7;
+    }
+    *p++ = (uint8_t)z;
+    a->datalen = p - a->data;
+    a->last = v;
+    ++a->n;
+}
+
+// read varint at `a->data[*pos]`
+static int64_t getdiff(const tsarr_t *a, size_t *pos){
+    uint64_t z = 0;
+    int shift = 0;
+    uint8_t b;
+    do{
+        b = a->data[(*pos)++];
+        z |= (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+    }while(b & 0x80);
+    return (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+}
+
+/**
+ * @brief tsarr_get - get value by index (sequential reading doesn't decode anything twice)
+ * @param a - array
+ * @param idx - index
+ * @return value or 0 if idx is out of range
+ */
+int64_t tsarr_get(tsarr_t *a, size_t idx){
+    if(idx >= a->n) return 0;
+    if(idx == a->n - 1) return a->last;
+    size_t i, pos;
+    int64_t v;
+    if(a->cpos && a->cidx <= idx && idx - a->cidx < TS_CKSTEP){ // continue from last value
+        i = a->cidx; pos = a->cpos; v = a->cval;
+    }else{
+        const tsckpt_t *c = &a->ckpt[idx / TS_CKSTEP];
+        i = idx - idx % TS_CKSTEP; pos = c->pos; v = c->val;
+        getdiff(a, &pos); // difference with previous checkpoint
+    }
+    while(i < idx){
+        v += getdiff(a, &pos);
+        ++i;
+    }
+    a->cidx = i; a->cpos = pos; a->cval = v;
+    return v;
+}
+
+// amount of memory used by array
+size_t tsarr_mem(const tsarr_t *a){
+    return a->datasz + a->cksz * sizeof(tsckpt_t);
+}
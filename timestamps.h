@@ -0,0 +1,56 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef TIMESTAMPS_H__
+#define TIMESTAMPS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// checkpoint of `tsarr_t`
+typedef struct{
+    size_t pos;         // position of value in `data`
+    int64_t val;        // value
+} tsckpt_t;
+
+// delta-encoded array of values (e.g. timestamps) with random access
+typedef struct{
+    uint8_t *data;      // zigzag varints of differences between neighbours
+    size_t datalen;     // used bytes of `data`
+    size_t datasz;      // its size
+    tsckpt_t *ckpt;     // value of each TS_CKSTEP'th element
+    size_t cksz;        // size of `ckpt`
+    size_t n;           // amount of values
+    int64_t last;       // last value
+    size_t cidx;        // last value got by tsarr_get() (for sequential reading)
+    size_t cpos;        // position of next value in `data`
+    int64_t cval;       // and its value
+} tsarr_t;
+
+int64_t ts_now();
+int64_t ts_fromreal(const struct timespec *t);
+int64_t ts_toreal(int64_t t);
+size_t ts_format(char *buf, size_t len, int64_t t);
+void tsarr_clear(tsarr_t *a);
+void tsarr_push(tsarr_t *a, int64_t v);
+int64_t tsarr_get(tsarr_t *a, size_t idx);
+size_t tsarr_mem(const tsarr_t *a);
+
+#endif // TIMESTAMPS_H__
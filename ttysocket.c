@@ -16,48 +16,163 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE // recvmmsg()
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <linux/serial.h> // serial_icounter_struct
 #include <netdb.h>
+#include <stddef.h> // offsetof
 #include <stdio.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/select.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/un.h>  // unix socket
 
 #include "dbg.h"
+#include "dumpfile.h"
+#include "modbus.h"
 #include "string_functions.h"
+#include "timestamps.h"
 #include "ttysocket.h"
+#include "ttyterm.h"
 
-static int sec = 0, usec = 100; // timeout
-static FILE *dupfile = NULL; // file for output
-static chardevice *device = NULL; // current opened device
+// packet mode: max size of frame (larger frames are splitted)
+#define MAXFRAMESZ  (65536)
+// packet mode: max amount of frames read but not taken by tt_read()
+#define FRAMEQ      (1024)
+// packet mode: max time of waiting for first byte of frame by reader thread, us
+#define FRAMEPOLL   (50000)
+// frame read in packet mode
+typedef struct{
+    uint8_t *data;
+    int len;
+    int64_t stamp;              // time of its first symbols
+    int64_t gap;                // idle time before it, us (-1 if unknown)
+} frame_t;
+
+// maximal amount of RX hooks
+#define RXHOOKS_MAX     (8)
+// datagram mode: amount of datagrams read by one recvmmsg() and max size of datagram
+#define DGRAM_BATCH     (32)
+#define DGRAM_MAXLEN    (65536)
+
+typedef struct{
+    rxhook_t h;
+    void *arg;
+} rxhookent_t;
+
+struct ttyterm{
+    chardevice *device;         // opened device
+    int sec, usec;              // timeout
+    int gapusec;                // max gap between bytes of one data portion, us
+    double charus;              // time of one symbol transmission, us
+    int framechars;             // packet mode: min idle gap between frames in symbols (0 - off)
+    rxhookent_t rxhooks[RXHOOKS_MAX];
+    pthread_mutex_t hookmutex;
+    // statistics
+    size_t rxbytes, txbytes;
+    int64_t rxstamp;            // time of last data portion read
+    int64_t rxgap;              // idle time before it (tty only), us
+    int64_t lastread;           // time of last reading of tty
+    struct serial_icounter_struct icount0; // UART counters on device opening
+    int have_icount;            // TIOCGICOUNT supported
+    // datagram mode
+    dgram_t dgrams[DGRAM_BATCH];
+    int ndgrams;                // amount of datagrams in last tt_read()
+    struct sockaddr_storage peer; // last datagram source (reply address for bound sockets)
+    socklen_t peerlen;
+    // device is claimed for exclusive reading by some protocol (e.g. XMODEM)
+    int claimed;
+    pthread_mutex_t rdmutex;
+    dump_t *dump;               // all data is written into dump file (or NULL)
+    // input conversion
+    cspars_t cs;                // checksum for RAW and HEX modes
+    uint8_t *convbuf;           // converted line
+    size_t convsz;              // size of `convbuf`
+    uint16_t tid;               // next transaction ID of Modbus TCP
+    mbtrack_t *mb;              // tracker of Modbus requests (or NULL)
+    pthread_mutex_t convmutex;
+    // checking of received frames
+    cspars_t rxcs;
+    size_t rxgood, rxbad;
+    pthread_mutex_t csmutex;
+    // packet mode: tty is read by separate thread, so gaps are measured even when nobody calls tt_read()
+    pthread_t framethread;
+    int framerun;               // thread is running
+    int framestop;              // command to stop it
+    int frameeof;               // device disconnected
+    frame_t *frames;            // queue of frames (FRAMEQ items)
+    int fhead, fcount;          // first frame in queue and amount of frames
+    pthread_mutex_t fmutex;
+    pthread_cond_t fcond;       // frame added or taken
+};
+
+// device opened by `opendev()`: functions without handle work with it
+static ttyterm_t *current = NULL;
 
 // TODO: if unix socket name starts with \0 translate it as \\0 to d->name!
 
-// set Read_tty timeout in milliseconds
-void settimeout(int tmout){
-    sec = 0;
+/**
+ * @brief tt_settimeout - set timeout of reading
+ * @param t - device
+ * @param tmout - timeout, ms
+ */
+void tt_settimeout(ttyterm_t *t, int tmout){
+    if(!t) return;
+    t->sec = 0;
     if(tmout > 999){
-        sec = tmout / 1000;
-        tmout -= sec * 1000;
+        t->sec = tmout / 1000;
+        tmout -= t->sec * 1000;
+    }
+    t->usec = tmout * 1000L;
+}
+
+// amount of bits in one symbol of opened tty (with start, parity and stop bits)
+int tty_symbits(const TTY_descr2 *d){
+    if(!d) return 10;
+    tcflag_t f = d->tty.c_cflag;
+    int bits = 2; // start + stop
+    switch(f & CSIZE){
+        case CS5: bits += 5; break;
+        case CS6: bits += 6; break;
+        case CS7: bits += 7; break;
+        default: bits += 8; break;
     }
-    usec = tmout * 1000L;
+    if(f & PARENB) ++bits;
+    if(f & CSTOPB) ++bits;
+    return bits;
+}
+
+// gap between data portions: 2 symbols (20 bits), but not less than 1ms; in packet mode - given amount of symbols
+static void setgap(ttyterm_t *t, int speed){
+    if(speed < 1) return;
+    t->charus = 1e6 * ((t->device->type == DEV_TTY) ? tty_symbits(t->device->dev) : 10) / speed;
+    if(t->framechars > 0){
+        t->gapusec = (int)(t->framechars * t->charus);
+        if(t->gapusec < 1) t->gapusec = 1;
+    }else{
+        t->gapusec = 20000000 / speed;
+        if(t->gapusec < 1000) t->gapusec = 1000;
+    }
+    DBG("speed %d -> gap %dus", speed, t->gapusec);
 }
 
 /**
  * wait for answer from socket
  * @param sock - socket fd
+ * @param tsec, tusec - timeout
  * @return 0 in case of timeout, 1 in case of socket ready, -1 if error
  */
-static int waittoread(int fd){
+static int waitfd(int fd, int tsec, int tusec){
     fd_set fds;
     struct timeval timeout;
-    timeout.tv_sec = sec;
-    timeout.tv_usec = usec;
+    timeout.tv_sec = tsec;
+    timeout.tv_usec = tusec;
     FD_ZERO(&fds);
     FD_SET(fd, &fds);
     do{
@@ -78,17 +193,167 @@ static int waittoread(int fd){
     return 0;
 }
 
+static int waittoread(ttyterm_t *t, int fd){
+    return waitfd(fd, t->sec, t->usec);
+}
+
+// packet mode: read frames until stopped or disconnected
+static void *framereader(void *arg){
+    ttyterm_t *t = (ttyterm_t*)arg;
+    int fd = t->device->dev->comfd;
+    uint8_t *buf = MALLOC(uint8_t, MAXFRAMESZ);
+    while(!t->framestop){
+        pthread_mutex_lock(&t->rdmutex);
+        if(t->claimed){ // somebody reads data by himself
+            pthread_mutex_unlock(&t->rdmutex);
+            usleep(FRAMEPOLL);
+            continue;
+        }
+        frame_t f = {.gap = -1};
+        int s = 0;
+        while(f.len < MAXFRAMESZ){ // wait for first byte not more than FRAMEPOLL, next - not more than gap
+            if((s = waitfd(fd, 0, f.len ? t->gapusec : FRAMEPOLL)) < 1) break;
+            int l = read(fd, buf + f.len, MAXFRAMESZ - f.len);
+            if(l < 1){ // disconnected
+                s = -1;
+                break;
+            }
+            int64_t tm = ts_now();
+            if(!f.len){ // time of first symbols and idle time before them
+                f.stamp = tm;
+                f.gap = t->lastread ? tm - (int64_t)(l * t->charus) - t->lastread : -1;
+                if(f.gap < -1) f.gap = 0;
+            }
+            t->lastread = tm;
+            f.len += l;
+        }
+        pthread_mutex_unlock(&t->rdmutex);
+        if(f.len){
+            f.data = MALLOC(uint8_t, f.len);
+            memcpy(f.data, buf, f.len);
+            pthread_mutex_lock(&t->fmutex);
+            while(t->fcount == FRAMEQ && !t->framestop) pthread_cond_wait(&t->fcond, &t->fmutex);
+            if(t->fcount < FRAMEQ){
+                t->frames[(t->fhead + t->fcount++) % FRAMEQ] = f;
+                f.data = NULL;
+                pthread_cond_broadcast(&t->fcond);
+            }
+            pthread_mutex_unlock(&t->fmutex);
+            FREE(f.data);
+        }
+        if(s < 0 && !f.len){ // error of select() or disconnect
+            pthread_mutex_lock(&t->fmutex);
+            t->frameeof = TRUE;
+            pthread_cond_broadcast(&t->fcond);
+            pthread_mutex_unlock(&t->fmutex);
+            break;
+        }
+    }
+    FREE(buf);
+    return NULL;
+}
+
+// start reading of frames by separate thread
+static int framestart(ttyterm_t *t){
+    if(!t->frames) t->frames = MALLOC(frame_t, FRAMEQ);
+    t->framestop = FALSE;
+    t->frameeof = FALSE;
+    if(pthread_create(&t->framethread, NULL, framereader, t)){
+        WARN("pthread_create()");
+        return FALSE;
+    }
+    t->framerun = TRUE;
+    return TRUE;
+}
+
+// stop frames reading thread and throw out frames not read
+static void framestop(ttyterm_t *t){
+    if(!t->framerun) return;
+    pthread_mutex_lock(&t->fmutex);
+    t->framestop = TRUE;
+    pthread_cond_broadcast(&t->fcond);
+    pthread_mutex_unlock(&t->fmutex);
+    pthread_join(t->framethread, NULL);
+    t->framerun = FALSE;
+    pthread_mutex_lock(&t->fmutex);
+    for(; t->fcount; --t->fcount, t->fhead = (t->fhead + 1) % FRAMEQ) FREE(t->frames[t->fhead].data);
+    pthread_mutex_unlock(&t->fmutex);
+}
+
+// packet mode: get next frame read by `framereader` (wait for it not more than timeout)
+static uint8_t *getframe(ttyterm_t *t, int *len){
+    TTY_descr2 *D = t->device->dev;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += t->sec;
+    ts.tv_nsec += t->usec * 1000L;
+    if(ts.tv_nsec > 999999999){
+        ++ts.tv_sec;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&t->fmutex);
+    while(!t->fcount && !t->frameeof && t->framerun)
+        if(ETIMEDOUT == pthread_cond_timedwait(&t->fcond, &t->fmutex, &ts)) break;
+    if(!t->fcount){
+        if(len) *len = t->frameeof ? -1 : 0;
+        pthread_mutex_unlock(&t->fmutex);
+        return NULL;
+    }
+    frame_t f = t->frames[t->fhead];
+    t->fhead = (t->fhead + 1) % FRAMEQ;
+    --t->fcount;
+    pthread_cond_broadcast(&t->fcond);
+    pthread_mutex_unlock(&t->fmutex);
+    if((size_t)f.len > D->bufsz){
+        D->bufsz = f.len;
+        D->buf = realloc(D->buf, D->bufsz + 1);
+    }
+    memcpy(D->buf, f.data, f.len);
+    FREE(f.data);
+    t->rxstamp = f.stamp;
+    t->rxgap = f.gap;
+    D->buflen = f.len;
+    D->buf[f.len] = 0;
+    if(len) *len = f.len;
+    return D->buf;
+}
+
+/**
+ * @brief tt_setframegap - turn on/off packet mode: each data portion read from tty is one frame
+ * @param t - device
+ * @param nsymbols - min idle time between frames in symbols (0 - turn off)
+ * @return FALSE if device isn't tty
+ */
+int tt_setframegap(ttyterm_t *t, int nsymbols){
+    if(!t || t->device->type != DEV_TTY || nsymbols < 0) return FALSE;
+    t->framechars = nsymbols;
+    setgap(t, t->device->speed);
+    if(nsymbols && !t->framerun) return framestart(t);
+    if(!nsymbols) framestop(t);
+    return TRUE;
+}
+
+// amount of symbols between frames in packet mode (0 if it's off)
+int tt_framegap(ttyterm_t *t){
+    return t ? t->framechars : 0;
+}
+
+// TRUE if each data portion read is a frame (datagram socket or packet mode)
+int tt_framed(ttyterm_t *t){
+    if(!t) return FALSE;
+    return t->device->socktype || t->framechars > 0;
+}
+
 // get data drom TTY
-static uint8_t *getttydata(int *len){
-    if(!device || !device->dev) return NULL;
-    TTY_descr2 *D = device->dev;
+static uint8_t *getttydata(ttyterm_t *t, int *len){
+    TTY_descr2 *D = t->device->dev;
     if(D->comfd < 0) return NULL;
     int L = 0;
     int length = D->bufsz - 1; // -1 for terminating zero
     uint8_t *ptr = D->buf;
     int s = 0;
-    do{
-        if(!(s = waittoread(D->comfd))) break;
+    do{ // wait for first byte not more than timeout, next - not more than gap
+        if(!(s = L ? waitfd(D->comfd, 0, t->gapusec) : waittoread(t, D->comfd))) break;
         if(s < 0){
             if(len) *len = 0;
             return NULL;
@@ -98,6 +363,13 @@ static uint8_t *getttydata(int *len){
             if(len) *len = -1;
             return NULL;
         }
+        int64_t tm = ts_now();
+        if(!L){ // time of first symbols and idle time before them
+            t->rxstamp = tm;
+            t->rxgap = t->lastread ? tm - (int64_t)(l * t->charus) - t->lastread : -1;
+            if(t->rxgap < -1) t->rxgap = 0;
+        }
+        t->lastread = tm;
         ptr += l; L += l;
         length -= l;
     }while(length);
@@ -109,15 +381,36 @@ static uint8_t *getttydata(int *len){
     return D->buf;
 }
 
-static uint8_t *getsockdata(int *len){
-    if(!device || !device->dev) return NULL;
-    TTY_descr2 *D = device->dev;
+// buffer for control messages of recvmsg()
+typedef union{
+    char buf[CMSG_SPACE(sizeof(struct timespec))];
+    struct cmsghdr align;
+} cmsgbuf_t;
+
+// get time of data receiving from SCM_TIMESTAMPNS (or current time if there's no such message)
+static int64_t kernelstamp(struct msghdr *msg){
+    for(struct cmsghdr *c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR(msg, c)){
+        if(c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS){
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+            return ts_fromreal(&ts);
+        }
+    }
+    return ts_now();
+}
+
+static uint8_t *getsockdata(ttyterm_t *t, int *len){
+    TTY_descr2 *D = t->device->dev;
     if(D->comfd < 0) return NULL;
     uint8_t *ptr = NULL;
-    int n = waittoread(D->comfd);
+    int n = waittoread(t, D->comfd);
     if(n == 1){
-        n = read(D->comfd, D->buf, D->bufsz-1);
+        cmsgbuf_t ctrl;
+        struct iovec iov = {.iov_base = D->buf, .iov_len = D->bufsz-1};
+        struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = ctrl.buf, .msg_controllen = sizeof(ctrl)};
+        n = recvmsg(D->comfd, &msg, 0);
         if(n > 0){
+            t->rxstamp = kernelstamp(&msg);
             ptr = D->buf;
             ptr[n] = 0;
             D->buflen = n;
@@ -131,43 +424,353 @@ static uint8_t *getsockdata(int *len){
     return ptr;
 }
 
+// convert socket address into string
+static void addr2str(ttyterm_t *t, const struct sockaddr_storage *a, socklen_t len, char *str, size_t strl){
+    char buf[INET6_ADDRSTRLEN];
+    if(len == 0){ // connected socket
+        snprintf(str, strl, "%s", t->device->name);
+        return;
+    }
+    switch(a->ss_family){
+        case AF_INET:{
+            const struct sockaddr_in *i = (const struct sockaddr_in*)a;
+            inet_ntop(AF_INET, &i->sin_addr, buf, sizeof(buf));
+            snprintf(str, strl, "%s:%d", buf, ntohs(i->sin_port));
+        }
+        break;
+        case AF_INET6:{
+            const struct sockaddr_in6 *i = (const struct sockaddr_in6*)a;
+            inet_ntop(AF_INET6, &i->sin6_addr, buf, sizeof(buf));
+            snprintf(str, strl, "[%s]:%d", buf, ntohs(i->sin6_port));
+        }
+        break;
+        case AF_UNIX:{
+            const struct sockaddr_un *u = (const struct sockaddr_un*)a;
+            int l = (int)len - (int)offsetof(struct sockaddr_un, sun_path);
+            if(l < 1) snprintf(str, strl, "unnamed");
+            else if(u->sun_path[0] == 0) snprintf(str, strl, "@%.*s", l - 1, u->sun_path + 1);
+            else snprintf(str, strl, "%.*s", l, u->sun_path);
+        }
+        break;
+        default:
+            snprintf(str, strl, "?");
+    }
+}
+
+// get batch of datagrams: all data is joined in D->buf, boundaries are in `dgrams`
+static uint8_t *getdgramdata(ttyterm_t *t, int *len){
+    TTY_descr2 *D = t->device->dev;
+    if(D->comfd < 0) return NULL;
+    struct mmsghdr msgs[DGRAM_BATCH];
+    struct iovec iovs[DGRAM_BATCH];
+    struct sockaddr_storage addrs[DGRAM_BATCH];
+    cmsgbuf_t ctrls[DGRAM_BATCH];
+    int n = waittoread(t, D->comfd);
+    if(n != 1){
+        if(len) *len = n;
+        return NULL;
+    }
+    for(int i = 0; i < DGRAM_BATCH; ++i){
+        iovs[i].iov_base = D->buf + i * DGRAM_MAXLEN;
+        iovs[i].iov_len = DGRAM_MAXLEN;
+        memset(&msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = ctrls[i].buf;
+        msgs[i].msg_hdr.msg_controllen = sizeof(ctrls[i]);
+    }
+    n = recvmmsg(D->comfd, msgs, DGRAM_BATCH, MSG_DONTWAIT, NULL);
+    if(n < 0){
+        if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) n = 0;
+        else WARN("recvmmsg()");
+        if(len) *len = n;
+        return NULL;
+    }
+    DBG("got %d datagrams", n);
+    size_t L = 0;
+    for(int i = 0; i < n; ++i){
+        size_t l = msgs[i].msg_len;
+        if(l == 0 && t->device->socktype == SOCK_SEQPACKET){ // EOF
+            if(len) *len = -1;
+            return NULL;
+        }
+        uint8_t *ptr = D->buf + L;
+        if(l && ptr != iovs[i].iov_base) memmove(ptr, iovs[i].iov_base, l); // join all data
+        dgram_t *d = &t->dgrams[i];
+        d->data = ptr;
+        d->len = (int)l;
+        d->trunc = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) ? TRUE : FALSE;
+        d->stamp = kernelstamp(&msgs[i].msg_hdr);
+        addr2str(t, &addrs[i], msgs[i].msg_hdr.msg_namelen, d->src, sizeof(d->src));
+        L += l;
+    }
+    if(n) t->rxstamp = t->dgrams[n-1].stamp;
+    if(n && msgs[n-1].msg_hdr.msg_namelen){ // remember source to answer
+        t->peerlen = msgs[n-1].msg_hdr.msg_namelen;
+        memcpy(&t->peer, &addrs[n-1], t->peerlen);
+    }
+    t->ndgrams = n;
+    D->buflen = L;
+    D->buf[L] = 0;
+    if(len) *len = (int)L;
+    return D->buf;
+}
+
+/**
+ * @brief tt_dgrams - get datagrams read by last tt_read() (in datagram mode)
+ * @param t - device
+ * @param d (o) - array of datagrams
+ * @return amount of datagrams (0 if none or not datagram mode)
+ */
+int tt_dgrams(ttyterm_t *t, const dgram_t **d){
+    if(!t) return 0;
+    if(d) *d = t->dgrams;
+    return t->ndgrams;
+}
+
 /**
- * @brief ReadData - get data from serial device or socket
- * @param d - device
+ * @brief tt_read - get data from serial device or socket
+ * @param t - device
  * @param len (o) - length of data read (-1 if device disconnected)
  * @return NULL or string
  */
-uint8_t *ReadData(int *len){
-    if(!device || !device->dev) return NULL;
+uint8_t *tt_read(ttyterm_t *t, int *len){
+    if(!t || !t->device->dev) return NULL;
+    chardevice *device = t->device;
     if(len) *len = -1;
     uint8_t *r = NULL;
-    switch(device->type){
+    t->ndgrams = 0;
+    pthread_mutex_lock(&t->rdmutex);
+    if(t->claimed){ // somebody reads data by himself
+        pthread_mutex_unlock(&t->rdmutex);
+        if(len) *len = 0;
+        return NULL;
+    }
+    int framed = t->framerun;
+    if(framed){ // frames are read by other thread, it needs `rdmutex`
+        pthread_mutex_unlock(&t->rdmutex);
+        r = getframe(t, len);
+    }else switch(device->type){
         case DEV_TTY:
-            r = getttydata(len);
+            r = getttydata(t, len);
         break;
         case DEV_NETSOCKET:
         case DEV_UNIXSOCKET:
-            r = getsockdata(len);
+            r = device->socktype ? getdgramdata(t, len) : getsockdata(t, len);
         break;
         default:
         break;
     }
-    if(r && dupfile){
-        fwrite("< ", 1, 2, dupfile);
-        fwrite(r, 1, *len, dupfile);
+    if(!framed) pthread_mutex_unlock(&t->rdmutex);
+    if(r) t->rxbytes += *len;
+    if(r && t->dump){ // one record per datagram to keep boundaries and kernel timestamps
+        if(t->ndgrams){
+            for(int i = 0; i < t->ndgrams; ++i)
+                dump_writeat(t->dump, DUMP_RX, t->dgrams[i].data, t->dgrams[i].len, t->dgrams[i].stamp);
+        }else dump_writeat(t->dump, DUMP_RX, r, *len, t->rxstamp);
     }
+    if(r) tt_rxhooks(t, r, *len);
     return r;
 }
 
 /**
- * @brief SendData - send data to tty or socket
- * @param d - device
+ * @brief tt_rxhooks - call RX hooks for data read (tt_read() does it itself; this is for data read by
+ *          owner of claimed device, e.g. relayed to other program)
+ * @param t - device
+ * @param data - data read
+ * @param len - its length
+ */
+void tt_rxhooks(ttyterm_t *t, const uint8_t *data, int len){
+    if(!t || !data) return;
+    // hooks are called without lock: they could add or remove hooks and take their own locks
+    rxhookent_t hooks[RXHOOKS_MAX];
+    pthread_mutex_lock(&t->hookmutex);
+    memcpy(hooks, t->rxhooks, sizeof(hooks));
+    pthread_mutex_unlock(&t->hookmutex);
+    for(int i = 0; i < RXHOOKS_MAX; ++i)
+        if(hooks[i].h) hooks[i].h(t, data, len, hooks[i].arg);
+}
+
+/**
+ * @brief tt_rxstamp - get time of data read by last tt_read()
+ * @param t - device
+ * @return timestamp (microseconds of CLOCK_MONOTONIC)
+ */
+int64_t tt_rxstamp(ttyterm_t *t){
+    return t ? t->rxstamp : 0;
+}
+
+/**
+ * @brief tt_rxgap - get idle time of tty before data read by last tt_read()
+ * @param t - device
+ * @return time in us or -1 if unknown
+ */
+int64_t tt_rxgap(ttyterm_t *t){
+    return t ? t->rxgap : -1;
+}
+
+/**
+ * @brief tt_claim - get exclusive access to device reading (tt_read() will return nothing until release)
+ * @param t - device
+ * @return FALSE if device is already claimed
+ */
+int tt_claim(ttyterm_t *t){
+    if(!t || !t->device->dev) return FALSE;
+    pthread_mutex_lock(&t->rdmutex); // wait until current tt_read() ends
+    int ret = !t->claimed;
+    t->claimed = TRUE;
+    pthread_mutex_unlock(&t->rdmutex);
+    return ret;
+}
+
+void tt_release(ttyterm_t *t){
+    if(!t) return;
+    pthread_mutex_lock(&t->rdmutex);
+    t->claimed = FALSE;
+    pthread_mutex_unlock(&t->rdmutex);
+}
+
+// get file descriptor of opened device (e.g. to poll it), -1 if none
+int tt_fd(ttyterm_t *t){
+    if(!t || !t->device->dev) return -1;
+    return t->device->dev->comfd;
+}
+
+/**
+ * @brief tt_readraw - read data directly from device (only for owner of claimed device)
+ * @param t - device
+ * @param buf - buffer for data
+ * @param len - its length
+ * @param tmout - timeout, ms
+ * @return amount of bytes read, 0 if timeout or -1 if disconnected
+ */
+int tt_readraw(ttyterm_t *t, uint8_t *buf, size_t len, int tmout){
+    if(!t || !t->device->dev || !buf || !len) return -1;
+    int fd = t->device->dev->comfd;
+    int s = waitfd(fd, tmout / 1000, (tmout % 1000) * 1000);
+    if(s == 0) return 0;
+    if(s < 0) return -1;
+    ssize_t l = read(fd, buf, len);
+    if(l < 1) return -1;
+    t->rxbytes += l;
+    if(t->dump) dump_write(t->dump, DUMP_RX, buf, l);
+    return (int)l;
+}
+
+/**
+ * @brief tt_dump - write data which device didn't read or send by itself into its dump file (if any)
+ * @param t - device
+ * @param dir - direction
+ * @param data - data
+ * @param len - its length
+ * @param stamp - time of data reading (see timestamps.h) or 0 for current time
+ */
+void tt_dump(ttyterm_t *t, dumpdir dir, const uint8_t *data, size_t len, int64_t stamp){
+    if(!t || !t->dump || !data || !len) return;
+    dump_writeat(t->dump, dir, data, len, stamp);
+}
+
+/**
+ * @brief tt_setspeed - change speed of opened tty (input buffer would be flushed)
+ * @param t - device
+ * @param speed - new speed
+ * @return FALSE if failed
+ */
+int tt_setspeed(ttyterm_t *t, int speed){
+    if(!t || !t->device->dev || t->device->type != DEV_TTY || speed < 1) return FALSE;
+    TTY_descr2 *D = t->device->dev;
+    struct termios2 tty = D->tty;
+    tty.c_ispeed = speed;
+    tty.c_ospeed = speed;
+    if(ioctl(D->comfd, TCSETS2, &tty)){
+        WARN(_("Can't set speed %d"), speed);
+        return FALSE;
+    }
+    ioctl(D->comfd, TCGETS2, &D->tty);
+    ioctl(D->comfd, TCFLSH, TCIFLUSH); // throw out all data read with previous speed
+    if(D->tty.c_ispeed != (speed_t)speed)
+        WARNX(_("Can't set speed %d, got ispeed=%d, ospeed=%d"), speed, D->tty.c_ispeed, D->tty.c_ospeed);
+    t->device->speed = D->speed = D->tty.c_ispeed;
+    setgap(t, t->device->speed);
+    return TRUE;
+}
+
+/**
+ * @brief tt_stat - get statistics of device
+ * @param t - device
+ * @param s (o) - statistics
+ * @return FALSE if device isn't opened
+ */
+int tt_stat(ttyterm_t *t, devstat_t *s){
+    if(!t || !t->device->dev || !s) return FALSE;
+    chardevice *device = t->device;
+    memset(s, 0, sizeof(devstat_t));
+    s->rxbytes = t->rxbytes;
+    s->txbytes = t->txbytes;
+    if(device->type != DEV_TTY || !t->have_icount) return TRUE;
+    struct serial_icounter_struct ic, *icount0 = &t->icount0;
+    if(ioctl(device->dev->comfd, TIOCGICOUNT, &ic)) return TRUE;
+    s->hwcounters = TRUE;
+    s->uartrx = ic.rx - icount0->rx;
+    s->uarttx = ic.tx - icount0->tx;
+    s->frame = ic.frame - icount0->frame;
+    s->overrun = ic.overrun - icount0->overrun;
+    s->parity = ic.parity - icount0->parity;
+    s->brk = ic.brk - icount0->brk;
+    s->buf_overrun = ic.buf_overrun - icount0->buf_overrun;
+    s->cts = ic.cts - icount0->cts;
+    s->dsr = ic.dsr - icount0->dsr;
+    s->dcd = ic.dcd - icount0->dcd;
+    return TRUE;
+}
+
+/**
+ * @brief tt_addrxhook - add function which will be called for each data portion read
+ * @param t - device
+ * @param h - hook
+ * @param arg - its argument (the same hook could be added with different arguments)
+ * @return FALSE if there's no more place for hooks
+ */
+int tt_addrxhook(ttyterm_t *t, rxhook_t h, void *arg){
+    if(!t || !h) return FALSE;
+    int ret = FALSE, empty = -1;
+    pthread_mutex_lock(&t->hookmutex);
+    for(int i = 0; i < RXHOOKS_MAX; ++i){
+        if(t->rxhooks[i].h == h && t->rxhooks[i].arg == arg){ ret = TRUE; break; } // already have
+        if(!t->rxhooks[i].h && empty < 0) empty = i;
+    }
+    if(!ret && empty > -1){
+        t->rxhooks[empty].h = h;
+        t->rxhooks[empty].arg = arg;
+        ret = TRUE;
+    }
+    pthread_mutex_unlock(&t->hookmutex);
+    return ret;
+}
+
+// remove hook added with given argument; tt_read() running in other thread at this moment could call it
+// once more, so its argument should live until device closing (or hook should check it under own lock)
+void tt_delrxhook(ttyterm_t *t, rxhook_t h, void *arg){
+    if(!t) return;
+    pthread_mutex_lock(&t->hookmutex);
+    for(int i = 0; i < RXHOOKS_MAX; ++i)
+        if(t->rxhooks[i].h == h && t->rxhooks[i].arg == arg) t->rxhooks[i].h = NULL;
+    pthread_mutex_unlock(&t->hookmutex);
+}
+
+/**
+ * @brief tt_send - send data to tty or socket
+ * @param t - device
  * @param data - buffer with data
+ * @param len - its length
  * @return 0 if error or empty string, -1 if disconnected
  */
-int SendData(const uint8_t *data, size_t len){
-    if(!device) return -1;
+int tt_send(ttyterm_t *t, const uint8_t *data, size_t len){
+    if(!t) return -1;
     if(!data || len == 0) return 0;
+    chardevice *device = t->device;
     int ret = 0;
     DBG("Send %d bytes", len);
     if(0 == pthread_mutex_lock(&device->mutex)){
@@ -178,30 +781,271 @@ int SendData(const uint8_t *data, size_t len){
             break;
             case DEV_NETSOCKET:
             case DEV_UNIXSOCKET:
-                if(len != (size_t)send(device->dev->comfd, data, len, MSG_NOSIGNAL)) ret = 0;
+                if(device->bindsock){ // answer to last datagram source
+                    if(t->peerlen && len == (size_t)sendto(device->dev->comfd, data, len, MSG_NOSIGNAL,
+                                                        (struct sockaddr*)&t->peer, t->peerlen)) ret = len;
+                    else ret = 0;
+                }else if(len != (size_t)send(device->dev->comfd, data, len, MSG_NOSIGNAL)) ret = 0;
                 else ret = len;
             break;
             default:
                 data = NULL;
             break;
         }
-        if(data && dupfile){
-            fwrite("> ", 1, 2, dupfile);
-            fwrite(data, 1, len, dupfile);
-        }
+        if(data && t->dump) dump_write(t->dump, DUMP_TX, data, len);
+        if(ret > 0) t->txbytes += ret;
         pthread_mutex_unlock(&device->mutex);
     }else ret = -1;
     DBG("ret=%d", ret);
     return ret;
 }
 
+/**
+ * @brief tt_sendfile - send data from file; sockets without dump file use zero-copy `sendfile()`
+ * @param t - device
+ * @param fd - opened file
+ * @param offset (io) - offset of data in file (moved to the end of data sent)
+ * @param len - amount of bytes to send
+ * @return amount of bytes sent, 0 if error or -1 if disconnected
+ */
+ssize_t tt_sendfile(ttyterm_t *t, int fd, off_t *offset, size_t len){
+    if(!t || !t->device->dev) return -1;
+    if(fd < 0 || !offset || len == 0) return 0;
+    chardevice *device = t->device;
+    if(device->type == DEV_TTY || t->dump || device->socktype){ // we need data in user space (or datagrams)
+        uint8_t buf[BUFSIZ];
+        if(len > BUFSIZ) len = BUFSIZ;
+        ssize_t got = pread(fd, buf, len, *offset);
+        if(got < 1) return 0;
+        int ret = tt_send(t, buf, got);
+        if(ret > 0) *offset += ret;
+        return ret;
+    }
+    ssize_t ret = -1;
+    DBG("sendfile() %zd bytes", len);
+    if(0 == pthread_mutex_lock(&device->mutex)){
+        ret = sendfile(device->dev->comfd, fd, offset, len);
+        if(ret < 0) ret = (errno == EPIPE || errno == ECONNRESET) ? -1 : 0;
+        else t->txbytes += ret;
+        pthread_mutex_unlock(&device->mutex);
+    }
+    return ret;
+}
+
+/**
+ * @brief tt_setcs - set checksum added to data sent in RAW and HEX input modes
+ * @param t - device
+ * @param cs - parameters (NULL or CS_NONE to turn off)
+ */
+void tt_setcs(ttyterm_t *t, const cspars_t *cs){
+    if(!t) return;
+    pthread_mutex_lock(&t->convmutex);
+    if(cs) t->cs = *cs;
+    else t->cs.algo = CS_NONE;
+    pthread_mutex_unlock(&t->convmutex);
+}
+
+// check each received frame (arbitrary portions of stream data aren't frames)
+static void csrxhook(ttyterm_t *t, const uint8_t *data, int len, _U_ void *arg){
+    const dgram_t *d;
+    int n = tt_dgrams(t, &d);
+    pthread_mutex_lock(&t->csmutex);
+    if(n > 0){
+        for(int i = 0; i < n; ++i){
+            if(cs_check(&t->rxcs, d[i].data, d[i].len)) ++t->rxgood;
+            else ++t->rxbad;
+        }
+    }else if(len > 0 && tt_framegap(t) > 0){
+        if(cs_check(&t->rxcs, data, len)) ++t->rxgood;
+        else ++t->rxbad;
+    }
+    pthread_mutex_unlock(&t->csmutex);
+}
+
+/**
+ * @brief tt_setrxcs - set checksum of received frames (counters are cleared)
+ * @param t - device
+ * @param cs - parameters (NULL or CS_NONE to turn off)
+ * @return FALSE if can't add RX hook or device gives no frames (not datagram socket and packet mode is off)
+ */
+int tt_setrxcs(ttyterm_t *t, const cspars_t *cs){
+    if(!t) return FALSE;
+    tt_delrxhook(t, csrxhook, NULL);
+    pthread_mutex_lock(&t->csmutex);
+    t->rxgood = t->rxbad = 0;
+    t->rxcs.algo = CS_NONE;
+    if(cs && cs->algo != CS_NONE && tt_framed(t)) t->rxcs = *cs;
+    int on = (t->rxcs.algo != CS_NONE);
+    pthread_mutex_unlock(&t->csmutex);
+    if(!cs || cs->algo == CS_NONE) return TRUE;
+    return on && tt_addrxhook(t, csrxhook, NULL);
+}
+
+/**
+ * @brief tt_rxcsstat - get amount of received frames with right and wrong checksum
+ * @param t - device
+ * @param good (o) - right frames
+ * @param bad (o) - wrong frames
+ */
+void tt_rxcsstat(ttyterm_t *t, size_t *good, size_t *bad){
+    size_t g = 0, b = 0;
+    if(t){
+        pthread_mutex_lock(&t->csmutex);
+        g = t->rxgood; b = t->rxbad;
+        pthread_mutex_unlock(&t->csmutex);
+    }
+    if(good) *good = g;
+    if(bad) *bad = b;
+}
+
+static void mbrxhook(_U_ ttyterm_t *t, const uint8_t *data, int len, void *arg){
+    if(len > 0) mb_rx((mbtrack_t*)arg, data, len);
+}
+
+/**
+ * @brief tt_mbtrack - track Modbus ASCII/TCP requests sent by tt_sendline() and decode responses
+ * @param t - device
+ * @param report - function to show decoded responses and errors (NULL - don't show)
+ * @return FALSE if can't add RX hook
+ */
+int tt_mbtrack(ttyterm_t *t, mbreport_t report){
+    if(!t) return FALSE;
+    pthread_mutex_lock(&t->convmutex);
+    if(t->mb){
+        mb_setreport(t->mb, report);
+        pthread_mutex_unlock(&t->convmutex);
+        return TRUE;
+    }
+    mbtrack_t *m = mb_tracknew(report);
+    int ret = tt_addrxhook(t, mbrxhook, m);
+    if(ret) t->mb = m; // tracker lives until device closing: hook could be running
+    else mb_trackfree(&m);
+    pthread_mutex_unlock(&t->convmutex);
+    return ret;
+}
+
+/**
+ * @brief tt_mbstat - get statistics of Modbus transactions
+ * @param t - device
+ * @param s (o) - statistics
+ * @return FALSE if tracking is off or there was no Modbus TCP/ASCII requests
+ */
+int tt_mbstat(ttyterm_t *t, mbstat_t *s){
+    if(!t) return FALSE;
+    pthread_mutex_lock(&t->convmutex);
+    mbtrack_t *m = t->mb;
+    pthread_mutex_unlock(&t->convmutex);
+    return mb_stat(m, s);
+}
+
+/**
+ * @brief tt_sendline - convert line like user input in given mode and send it (in text mode add device EOL);
+ *          Modbus ASCII/TCP responses are tracked after tt_mbtrack()
+ * @param t - device
+ * @param input_type - input mode
+ * @param line - line with data
+ * @return amount of bytes sent, 0 if error or -1 if disconnect
+ */
+int tt_sendline(ttyterm_t *t, disptype input_type, const char *line){
+    if(!t) return -1;
+    pthread_mutex_lock(&t->convmutex);
+    size_t l = convert_line(input_type, line, t->device->eol, &t->cs, &t->convbuf, &t->convsz);
+    if(input_type == DISP_MBASCII) l = t->mb ? mb_ascii_pack(t->mb, t->convbuf, l) : mb_ascii_frame(t->convbuf, l);
+    else if(input_type == DISP_MBTCP){
+        l = t->mb ? mb_tcp_pack(t->mb, t->convbuf, l, t->tid) : mb_tcp_frame(t->convbuf, l, t->tid);
+        ++t->tid;
+    }
+    int ret = l ? tt_send(t, t->convbuf, l) : 0;
+    pthread_mutex_unlock(&t->convmutex);
+    return ret;
+}
+
 static const int socktypes[] = {SOCK_STREAM, SOCK_RAW, SOCK_RDM, SOCK_SEQPACKET, SOCK_DCCP, SOCK_PACKET, SOCK_DGRAM, 0};
 
-static TTY_descr2* opensocket(){
+// ask kernel for timestamps of received data
+static void setstamps(int fd){
+    int one = 1;
+    if(setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(int))) DBG("Can't set SO_TIMESTAMPNS");
+}
+
+// set size of socket receive buffer
+static void setrcvbuf(int fd, int size){
+    if(size < 1) return;
+    // SO_RCVBUFFORCE allows to override rmem_max, but needs CAP_NET_ADMIN
+    if(setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(int)) &&
+       setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(int))) WARN("setsockopt()");
+    int real = 0;
+    socklen_t l = sizeof(int);
+    if(0 == getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &real, &l) && real < size) // kernel doubles value
+        WARNX(_("Receive buffer size limited to %d (see net.core.rmem_max)"), real / 2);
+    DBG("SO_RCVBUF=%d", real);
+}
+
+/**
+ * @brief dgramsocket - open datagram (UDP, UNIX DGRAM or SEQPACKET) socket
+ * @param device - device
+ * @param domain - socket domain
+ * @param sa - address
+ * @param addrlen - its length
+ * @return socket fd or -1 if failed
+ */
+static int dgramsocket(chardevice *device, int domain, struct sockaddr *sa, socklen_t addrlen){
+    int type = device->socktype;
+    if(domain != AF_UNIX && type != SOCK_DGRAM){
+        WARNX(_("Only datagrams (UDP) available for network sockets"));
+        return -1;
+    }
+    int fd = socket(domain, type, 0);
+    if(fd < 0){
+        WARN("socket()");
+        return -1;
+    }
+    setrcvbuf(fd, device->rcvbuf);
+    if(device->bindsock){
+        if(domain == AF_UNIX){ // remove old socket file
+            struct sockaddr_un *u = (struct sockaddr_un*)sa;
+            struct stat st;
+            if(u->sun_path[0] && 0 == stat(u->sun_path, &st) && S_ISSOCK(st.st_mode)) unlink(u->sun_path);
+        }else{
+            int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(int));
+        }
+        if(type == SOCK_SEQPACKET){ // server: wait for one client
+            int cl = -1;
+            if(bind(fd, sa, addrlen) || listen(fd, 1)) WARN("bind()");
+            else{
+                green(_("Wait for client on %s\n"), device->name);
+                if((cl = accept(fd, NULL, NULL)) < 0) WARN("accept()");
+                else setrcvbuf(cl, device->rcvbuf);
+            }
+            close(fd);
+            device->bindsock = FALSE; // now socket is connected
+            return cl;
+        }
+        if(bind(fd, sa, addrlen)){
+            WARN("bind()");
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    if(domain == AF_UNIX && type == SOCK_DGRAM){ // autobind to abstract address to get answers
+        sa_family_t af = AF_UNIX;
+        if(bind(fd, (struct sockaddr*)&af, sizeof(af))) WARN("bind()");
+    }
+    if(connect(fd, sa, addrlen)){
+        WARN("connect()");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static TTY_descr2* opensocket(chardevice *device){
     if(!device) return FALSE;
     TTY_descr2 *descr = MALLOC(TTY_descr2, 1); // only for `buf` and bufsz/buflen
-    descr->buf = MALLOC(uint8_t, BUFSIZ);
-    descr->bufsz = BUFSIZ;
+    descr->bufsz = device->socktype ? DGRAM_BATCH * DGRAM_MAXLEN : BUFSIZ;
+    descr->buf = MALLOC(uint8_t, descr->bufsz + 1);
     // now try to open a socket
     descr->comfd = -1;
     struct hostent *host;
@@ -245,6 +1089,15 @@ static TTY_descr2* opensocket(){
         }else  strncpy(saddr.sun_path, device->name, 106);
         domain = AF_UNIX;
     }
+    if(device->socktype){
+        if((descr->comfd = dgramsocket(device, domain, sa, addrlen)) < 0){
+            FREE(descr->buf);
+            FREE(descr);
+            return NULL;
+        }
+        setstamps(descr->comfd);
+        return descr;
+    }
     const int *type = socktypes;
     while(*type){
         DBG("type = %d", *type);
@@ -252,6 +1105,7 @@ static TTY_descr2* opensocket(){
             if(connect(descr->comfd, sa, addrlen) < 0){
                 DBG("CANT connect");
                 close(descr->comfd);
+                descr->comfd = -1;
             }else break;
         }
         ++type;
@@ -263,16 +1117,27 @@ static TTY_descr2* opensocket(){
         FREE(descr);
         return NULL;
     }
+    setrcvbuf(descr->comfd, device->rcvbuf);
+    setstamps(descr->comfd);
     return descr;
 }
 
-static char *parse_format(const char *iformat, tcflag_t *flags){
+/**
+ * @brief parse_format - get tty flags by format string
+ * @param iformat - format like 8N1 with optional flow control suffix (H - RTS/CTS, X - XON/XOFF)
+ * @param flags (o) - c_cflag
+ * @param iflags (o) - c_iflag
+ * @return copy of format or NULL if wrong
+ */
+static char *parse_format(const char *iformat, tcflag_t *flags, tcflag_t *iflags){
     tcflag_t f = 0;
+    *iflags = 0;
     if(!iformat){ // default
         *flags = CS8;
         return strdup("8N1");
     }
-    if(strlen(iformat) != 3) goto someerr;
+    size_t l = strlen(iformat);
+    if(l != 3 && l != 4) goto someerr;
     switch(iformat[0]){
         case '5':
             f |= CS5;
@@ -316,24 +1181,45 @@ static char *parse_format(const char *iformat, tcflag_t *flags){
         default:
             goto someerr;
     }
+    switch(iformat[3]){ // flow control
+        case 0:
+        break;
+        case 'H':
+        case 'h':
+            f |= CRTSCTS;
+        break;
+        case 'X':
+        case 'x':
+            *iflags = IXON | IXOFF;
+        break;
+        default:
+            goto someerr;
+    }
     *flags = f;
     return strdup(iformat);
 someerr:
-    WARNX(_("Wrong USART format \"%s\"; use NPS, where N: 5..8; P: N/E/O/1/0, S: 1/2"), iformat);
+    WARNX(_("Wrong USART format \"%s\"; use NPS[F], where N: 5..8; P: N/E/O/1/0, S: 1/2, F: H (RTS/CTS) or X (XON/XOFF)"), iformat);
     return NULL;
 }
 
-static TTY_descr2* opentty(){
-    if(!device->name){
+/**
+ * @brief opentty - open serial device
+ * @param name - device path
+ * @param speed - baudrate
+ * @param format - format like 8N1 (with optional flow control)
+ * @return device descriptor or NULL if failed
+ */
+TTY_descr2 *opentty(const char *name, int speed, const char *format){
+    if(!name){
         ///   
         WARNX(_("Port name is missing"));
         return NULL;
     }
     TTY_descr2 *descr = MALLOC(TTY_descr2, 1);
-    descr->portname = strdup(device->name);
-    descr->speed = device->speed;
-    tcflag_t flags;
-    descr->format = parse_format(device->port, &flags);
+    descr->portname = strdup(name);
+    descr->speed = speed;
+    tcflag_t flags, iflags;
+    descr->format = parse_format(format, &flags, &iflags);
     if(!descr->format) goto someerr;
     descr->buf = MALLOC(uint8_t, 512);
     descr->bufsz = 511;
@@ -347,21 +1233,23 @@ static TTY_descr2* opentty(){
     }
     descr->tty = descr->oldtty;
     descr->tty.c_lflag = 0; // ~(ICANON | ECHO | ECHOE | ISIG)
-    descr->tty.c_iflag = 0; // don't do any changes in input stream
+    descr->tty.c_iflag = iflags; // don't do any changes in input stream (except XON/XOFF)
+    descr->tty.c_cc[VSTART] = 0x11; // XON
+    descr->tty.c_cc[VSTOP] = 0x13; // XOFF
     descr->tty.c_oflag = 0; // don't do any changes in output stream
     descr->tty.c_cflag = BOTHER | flags |CREAD|CLOCAL;
-    descr->tty.c_ispeed = device->speed;
-    descr->tty.c_ospeed = device->speed;
+    descr->tty.c_ispeed = speed;
+    descr->tty.c_ospeed = speed;
     if(ioctl(descr->comfd, TCSETS2, &descr->tty)){
         WARN(_("Can't set new port config"));
         goto someerr;
     }
     ioctl(descr->comfd, TCGETS2, &descr->tty);
-    if(descr->tty.c_ispeed != (speed_t)device->speed || descr->tty.c_ospeed != (speed_t)device->speed){
-        WARN(_("Can't set speed %d, got ispeed=%d, ospeed=%d"), device->speed, descr->tty.c_ispeed, descr->tty.c_ospeed);
+    if(descr->tty.c_ispeed != (speed_t)speed || descr->tty.c_ospeed != (speed_t)speed){
+        WARN(_("Can't set speed %d, got ispeed=%d, ospeed=%d"), speed, descr->tty.c_ispeed, descr->tty.c_ospeed);
         //goto someerr;
     }
-    device->speed = descr->tty.c_ispeed;
+    descr->speed = descr->tty.c_ispeed;
     return descr;
 someerr:
     FREE(descr->format);
@@ -370,87 +1258,258 @@ someerr:
     return NULL;
 }
 
+// close serial device and return it to previous state
+void closetty(TTY_descr2 **d){
+    if(!d || !*d) return;
+    TTY_descr2 *t = *d;
+    ioctl(t->comfd, TCSETS2, &t->oldtty); // return TTY to previous state
+    close(t->comfd);
+    FREE(t->format);
+    FREE(t->portname);
+    FREE(t->buf);
+    FREE(*d);
+}
+
 /**
- * @brief opendev - open TTY or socket output device
- * @param d - device type
- * @return FALSE if failed
+ * @brief tt_open - open TTY or socket
+ * @param d - device parameters (`dev` field is ignored)
+ * @param dump - dump file parameters (or NULL); each device should have its own file
+ * @return device handle or NULL if failed
  */
-int opendev(chardevice *d, char *path){
-    if(!d) return FALSE;
+ttyterm_t *tt_open(const chardevice *d, const dumppars_t *dump){
+    if(!d || !d->name) return NULL;
     DBG("Try to open device");
-    device = MALLOC(chardevice, 1);
+    ttyterm_t *t = MALLOC(ttyterm_t, 1);
+    t->usec = 100;
+    t->gapusec = 1000;
+    t->charus = 1041.7;
+    t->rxgap = -1;
+    pthread_mutex_init(&t->hookmutex, NULL);
+    pthread_mutex_init(&t->rdmutex, NULL);
+    pthread_mutex_init(&t->convmutex, NULL);
+    pthread_mutex_init(&t->csmutex, NULL);
+    pthread_mutex_init(&t->fmutex, NULL);
+    pthread_condattr_t ca;
+    pthread_condattr_init(&ca);
+    pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+    pthread_cond_init(&t->fcond, &ca);
+    pthread_condattr_destroy(&ca);
+    chardevice *device = t->device = MALLOC(chardevice, 1);
     memcpy(device, d, sizeof(chardevice));
+    pthread_mutex_init(&device->mutex, NULL);
+    device->dev = NULL;
     device->name = strdup(d->name);
     if(d->port) device->port = strdup(d->port);
     DBG("devtype=%d", device->type);
     switch(device->type){
         case DEV_TTY:
             DBG("Serial");
-            device->dev = opentty();
+            device->dev = opentty(device->name, device->speed, device->port);
             if(!device->dev){
                 WARN("Can't open device %s", device->name);
                 DBG("CANT OPEN");
-                return FALSE;
+                break;
             }
+            device->speed = device->dev->speed;
+            setgap(t, device->speed);
+            t->have_icount = (0 == ioctl(device->dev->comfd, TIOCGICOUNT, &t->icount0));
+            DBG("TIOCGICOUNT %s supported", t->have_icount ? "is" : "isn't");
         break;
         case DEV_NETSOCKET:
         case DEV_UNIXSOCKET:
             DBG("Socket");
-            device->dev = opensocket();
+            device->dev = opensocket(device);
             if(!device->dev){
                 WARNX("Can't open socket");
                 DBG("CANT OPEN");
-                return FALSE;
             }
         break;
         default:
-            return FALSE;
-    }
-    if(path){ // open logging file
-        dupfile = fopen(path, "a");
-        if(!dupfile){
-            WARN("Can't open %s", path);
-            closedev();
-            return FALSE;
+        break;
+    }
+    if(!device->dev){
+        tt_close(&t);
+        return NULL;
+    }
+    if(dump && dump->path){ // open logging file
+        char name[PATH_MAX];
+        if(device->type == DEV_TTY || !device->port) snprintf(name, PATH_MAX, "%s", device->name);
+        else snprintf(name, PATH_MAX, "%s:%s", device->name, device->port);
+        if(!(t->dump = dump_open(dump, name))){
+            tt_close(&t);
+            return NULL;
         }
     }
-    changeeol(device->eol); // allow string functions to know EOL
-    memcpy(d, device, sizeof(chardevice));
-    return TRUE;
+    return t;
 }
 
-void closedev(){
-    if(!device) return;
+// get parameters of opened device
+const chardevice *tt_device(ttyterm_t *t){
+    return t ? t->device : NULL;
+}
+
+/**
+ * @brief tt_close - close device (tty returns to previous state) and free its handle
+ * @param t - device
+ */
+void tt_close(ttyterm_t **t){
+    if(!t || !*t) return;
+    ttyterm_t *T = *t;
+    chardevice *device = T->device;
+    framestop(T);
     pthread_mutex_unlock(&device->mutex);
     pthread_mutex_trylock(&device->mutex);
-    if(dupfile){
-        fclose(dupfile);
-        dupfile = NULL;
-    }
-    switch(device->type){
-        case DEV_TTY:
-            if(device->dev){
-                TTY_descr2 *t = device->dev;
-                ioctl(t->comfd, TCSETS2, &t->oldtty); // return TTY to previous state
-                close(t->comfd);
-            }
-        break;
-        case DEV_NETSOCKET:
-            if(device->dev){
-                close(device->dev->comfd);
-                FREE(device->dev);
-            }
-        break;
-        default:
-            return;
-    }
+    dump_close(&T->dump);
     if(device->dev){
-        FREE(device->dev->format);
-        FREE(device->dev->portname);
-        FREE(device->dev->buf);
-        FREE(device->dev);
+        if(device->type == DEV_TTY) closetty(&device->dev);
+        else{
+            close(device->dev->comfd);
+            FREE(device->dev->buf);
+            FREE(device->dev);
+        }
     }
     FREE(device->name);
+    FREE(device->port);
+    pthread_mutex_unlock(&device->mutex);
+    pthread_mutex_destroy(&device->mutex);
     FREE(device);
+    FREE(T->convbuf);
+    mb_trackfree(&T->mb);
+    FREE(T->frames);
+    pthread_mutex_destroy(&T->hookmutex);
+    pthread_mutex_destroy(&T->rdmutex);
+    pthread_mutex_destroy(&T->convmutex);
+    pthread_mutex_destroy(&T->csmutex);
+    pthread_mutex_destroy(&T->fmutex);
+    pthread_cond_destroy(&T->fcond);
+    FREE(*t);
     DBG("Device closed");
 }
+
+/*
+ * Functions below work with device opened by `opendev()`
+ */
+
+/**
+ * @brief opendev - open TTY or socket output device
+ * @param d - device type
+ * @param dump - dump file parameters (or NULL)
+ * @return FALSE if failed
+ */
+int opendev(chardevice *d, const dumppars_t *dump){
+    closedev();
+    current = tt_open(d, dump);
+    if(!current) return FALSE;
+    changeeol(current->device->eol); // allow string functions to know EOL
+    memcpy(d, current->device, sizeof(chardevice));
+    return TRUE;
+}
+
+void closedev(){
+    tt_close(&current);
+}
+
+// set reading timeout in milliseconds
+void settimeout(int tmout){
+    tt_settimeout(current, tmout);
+}
+
+int SetFrameGap(int nsymbols){
+    return tt_setframegap(current, nsymbols);
+}
+
+int GetFrameGap(){
+    return tt_framegap(current);
+}
+
+int IsFramed(){
+    return tt_framed(current);
+}
+
+int GetDgrams(const dgram_t **d){
+    return tt_dgrams(current, d);
+}
+
+uint8_t *ReadData(int *len){
+    return tt_read(current, len);
+}
+
+int64_t GetRxStamp(){
+    return tt_rxstamp(current);
+}
+
+int64_t GetRxGap(){
+    return tt_rxgap(current);
+}
+
+int ClaimDevice(){
+    return tt_claim(current);
+}
+
+void ReleaseDevice(){
+    tt_release(current);
+}
+
+int GetDeviceFD(){
+    return tt_fd(current);
+}
+
+int ReadRaw(uint8_t *buf, size_t len, int tmout){
+    return tt_readraw(current, buf, len, tmout);
+}
+
+void DumpData(dumpdir dir, const uint8_t *data, size_t len, int64_t stamp){
+    tt_dump(current, dir, data, len, stamp);
+}
+
+int SetSpeed(int speed){
+    return tt_setspeed(current, speed);
+}
+
+int GetDevStat(devstat_t *s){
+    return tt_stat(current, s);
+}
+
+int addrxhook(rxhook_t h, void *arg){
+    return tt_addrxhook(current, h, arg);
+}
+
+void delrxhook(rxhook_t h, void *arg){
+    tt_delrxhook(current, h, arg);
+}
+
+void RunRxHooks(const uint8_t *data, int len){
+    tt_rxhooks(current, data, len);
+}
+
+int SendData(const uint8_t *data, size_t len){
+    return tt_send(current, data, len);
+}
+
+ssize_t SendFromFile(int fd, off_t *offset, size_t len){
+    return tt_sendfile(current, fd, offset, len);
+}
+
+int SendLine(disptype input_type, const char *line){
+    return tt_sendline(current, input_type, line);
+}
+
+void SetTxChecksum(const cspars_t *cs){
+    tt_setcs(current, cs);
+}
+
+int SetRxChecksum(const cspars_t *cs){
+    return tt_setrxcs(current, cs);
+}
+
+void GetRxChecksumStat(size_t *good, size_t *bad){
+    tt_rxcsstat(current, good, bad);
+}
+
+int TrackModbus(mbreport_t report){
+    return tt_mbtrack(current, report);
+}
+
+int GetModbusStat(mbstat_t *s){
+    return tt_mbstat(current, s);
+}
@@ -24,6 +24,11 @@
 #include <asm-generic/termbits.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/types.h>
+
+#include "checksum.h"
+#include "dumpfile.h"
+#include "modbus.h"
 //#include "dbg.h"
 
 typedef enum{ // device: tty terminal, network socket or UNIX socket
@@ -53,12 +58,82 @@ typedef struct{
     pthread_mutex_t mutex;      // reading/writing mutex
     char eol[3];                // end of line
     char seol[5];               // `eol` with doubled backslash (for print @ screen)
+    int socktype;               // SOCK_DGRAM or SOCK_SEQPACKET for datagram mode, 0 - stream
+    int bindsock;               // bind socket to given address instead of connecting
+    int rcvbuf;                 // size of socket receive buffer (0 - system default)
 } chardevice;
 
+typedef enum{ // display/input data as
+    DISP_TEXT,      // text (non-ASCII input and output as \xxx)
+    DISP_RAW,       // hex output as xx xx xx, input in as numbers in bin (0bxx), oct(0xx), hex (0xxx||0Xxx) or dec and letters
+    DISP_HEX,       // hexdump output, input in hex only (with or without spaces)
+    DISP_RTURAW,    // modbus RTU (only to send): first number is node address, all other - data; CRC calculated
+    DISP_RTUHEX,    // RTU, input in hex (in raw - like RAW)
+    DISP_MBASCII,   // modbus ASCII (only to send), input like RTUHEX; LRC calculated
+    DISP_MBTCP,     // modbus TCP (only to send), input like RTUHEX; MBAP header with transaction ID added
+    DISP_UNCHANGED, // old
+    DISP_SIZE       // sizeof
+} disptype;
+
+// datagram received in datagram mode
+typedef struct{
+    const uint8_t *data;        // its data (in buffer returned by ReadData())
+    int len;                    // its length
+    int trunc;                  // TRUE if datagram was truncated
+    char src[64];               // source address
+    int64_t stamp;              // time of receiving (see timestamps.h)
+} dgram_t;
+
+// device statistics; UART counters are since device opening
+typedef struct{
+    size_t rxbytes;         // bytes read by terminal
+    size_t txbytes;         // bytes sent by terminal
+    int hwcounters;         // TRUE if counters below are valid (TIOCGICOUNT works)
+    int uartrx, uarttx;     // bytes received/transmitted by UART
+    int frame;              // framing errors
+    int overrun;            // hardware overruns
+    int parity;             // parity errors
+    int brk;                // breaks
+    int buf_overrun;        // kernel buffer overruns
+    int cts, dsr, dcd;      // amount of modem lines changes
+} devstat_t;
+
+// opened device (see ttyterm.h)
+typedef struct ttyterm ttyterm_t;
+
+// function to be called for each data portion read from device `t`; `arg` is given with the hook
+typedef void (*rxhook_t)(ttyterm_t *t, const uint8_t *data, int len, void *arg);
+
 uint8_t *ReadData(int *l);
+int GetDgrams(const dgram_t **d);
+int64_t GetRxStamp();
+int64_t GetRxGap();
+int SetFrameGap(int nsymbols);
+int GetFrameGap();
+int IsFramed();
 int SendData(const uint8_t *data, size_t len);
+ssize_t SendFromFile(int fd, off_t *offset, size_t len);
+int addrxhook(rxhook_t h, void *arg);
+void delrxhook(rxhook_t h, void *arg);
+void RunRxHooks(const uint8_t *data, int len);
+void SetTxChecksum(const cspars_t *cs);
+int SetRxChecksum(const cspars_t *cs);
+void GetRxChecksumStat(size_t *good, size_t *bad);
+int TrackModbus(mbreport_t report);
+int GetModbusStat(mbstat_t *s);
+int SendLine(disptype input_type, const char *line);
+int ClaimDevice();
+void ReleaseDevice();
+int GetDeviceFD();
+int ReadRaw(uint8_t *buf, size_t len, int tmout);
+void DumpData(dumpdir dir, const uint8_t *data, size_t len, int64_t stamp);
+int GetDevStat(devstat_t *s);
+int SetSpeed(int speed);
 void settimeout(int tms);
-int opendev(chardevice *d, char *path);
+TTY_descr2 *opentty(const char *name, int speed, const char *format);
+void closetty(TTY_descr2 **d);
+int tty_symbits(const TTY_descr2 *d);
+int opendev(chardevice *d, const dumppars_t *dump);
 void closedev();
 
 #endif // TTY_H__
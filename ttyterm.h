@@ -0,0 +1,69 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * libttyterm: device I/O, input conversion and formatting without UI. Each opened device is a
+ * handle, so one program can work with many devices at once (from different threads too).
+ * Formatting functions are in formatter.h, checksums - in checksum.h.
+ * Like all programs using usefull_macros, embedding program should have `void signals(int sig)`:
+ * it's called on fatal errors.
+ */
+
+#pragma once
+#ifndef TTYTERM_H__
+#define TTYTERM_H__
+
+#include "ttysocket.h"
+
+typedef enum{ // type of data chunk (for color of its lines)
+    CHUNK_PLAIN,    // default color
+    CHUNK_RX,       // received data (or data from first port of sniffer)
+    CHUNK_TX        // transmitted data (or data from second port of sniffer)
+} chunktype;
+
+ttyterm_t *tt_open(const chardevice *d, const dumppars_t *dump);
+void tt_close(ttyterm_t **t);
+const chardevice *tt_device(ttyterm_t *t);
+void tt_settimeout(ttyterm_t *t, int tms);
+uint8_t *tt_read(ttyterm_t *t, int *len);
+int tt_dgrams(ttyterm_t *t, const dgram_t **d);
+int64_t tt_rxstamp(ttyterm_t *t);
+int64_t tt_rxgap(ttyterm_t *t);
+int tt_setframegap(ttyterm_t *t, int nsymbols);
+int tt_framegap(ttyterm_t *t);
+int tt_framed(ttyterm_t *t);
+int tt_send(ttyterm_t *t, const uint8_t *data, size_t len);
+ssize_t tt_sendfile(ttyterm_t *t, int fd, off_t *offset, size_t len);
+int tt_sendline(ttyterm_t *t, disptype input_type, const char *line);
+void tt_setcs(ttyterm_t *t, const cspars_t *cs);
+int tt_setrxcs(ttyterm_t *t, const cspars_t *cs);
+void tt_rxcsstat(ttyterm_t *t, size_t *good, size_t *bad);
+int tt_mbtrack(ttyterm_t *t, mbreport_t report);
+int tt_mbstat(ttyterm_t *t, mbstat_t *s);
+int tt_addrxhook(ttyterm_t *t, rxhook_t h, void *arg);
+void tt_delrxhook(ttyterm_t *t, rxhook_t h, void *arg);
+void tt_rxhooks(ttyterm_t *t, const uint8_t *data, int len);
+int tt_claim(ttyterm_t *t);
+void tt_release(ttyterm_t *t);
+int tt_fd(ttyterm_t *t);
+int tt_readraw(ttyterm_t *t, uint8_t *buf, size_t len, int tmout);
+void tt_dump(ttyterm_t *t, dumpdir dir, const uint8_t *data, size_t len, int64_t stamp);
+int tt_stat(ttyterm_t *t, devstat_t *s);
+int tt_setspeed(ttyterm_t *t, int speed);
+
+#endif // TTYTERM_H__
@@ -0,0 +1,285 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Offline viewer of captured data: file is mmap'ed and only visible lines are formatted, so
+ * any file opens at once. Position is an offset of first displayed line; previous line in TEXT
+ * mode is found by formatting data from previous '\n'.
+ */
+
+#define _GNU_SOURCE // memrchr()
+#include <curses.h>
+#include <fcntl.h>
+#include <langinfo.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dbg.h"
+#include "formatter.h"
+#include "popup_msg.h"
+#include "viewer.h"
+
+// max amount of bytes to look for line start in TEXT mode (longer lines are cut at this place)
+#define MAXBACKSCAN     (1024*1024)
+
+enum{ // colors
+    STATUS_NO = 1,  // status string
+    MODE_NO         // display mode in status string
+};
+
+static const uint8_t *data = NULL;  // mmap'ed file
+static size_t datalen = 0;          // its size
+static const char *filename = NULL;
+static fmtpars_t pars = {.type = DISP_TEXT};
+static size_t top = 0;              // offset of first displayed line
+static size_t bottom = 0;           // offset of first line after screen
+static WINDOW *view_win = NULL, *status_win = NULL;
+static fmtline_t line;
+
+static const char *help[] = {
+    "Offline viewer:",
+    "  F1             - show this help",
+    "  F2             - text mode",
+    "  F3             - raw mode (all symbols in hex codes)",
+    "  F4             - hexdump mode (like hexdump output)",
+    "  <Up>,<Down>    - scroll by one row",
+    "  <PageUp>,<PageDn> - scroll by 2/3 of screen",
+    "  h,<Home>       - go to start of file",
+    "  e,<End>        - go to end of file",
+    "  mouse scroll   - scroll text",
+    "  q,^c,^d        - quit",
+    0
+};
+
+// amount of bytes per line in RAW and HEX modes
+static size_t bytesperline(){
+    if(pars.type == DISP_HEX) return pars.linelen;
+    size_t n = pars.linelen / 3;
+    return n ? n : 1;
+}
+
+/**
+ * @brief viewline - format line starting from `pos`
+ * @param pos - offset of line
+ * @return offset of next line
+ */
+static size_t viewline(size_t pos){
+    line.buf[0] = 0;
+    if(pos >= datalen) return datalen;
+    if(pars.type == DISP_TEXT) return pos + fmt_textline(&pars, data + pos, datalen - pos, 0, &line);
+    size_t n = bytesperline();
+    if(n > datalen - pos) n = datalen - pos;
+    if(pars.type == DISP_HEX) fmt_hexline(line.buf, data + pos, n, pars.linelen, pos);
+    else fmt_rawline(line.buf, data + pos, n);
+    return pos + n;
+}
+
+/**
+ * @brief prevline - find start of line which ends before `pos`
+ * @param pos - offset
+ * @return offset of line start
+ */
+static size_t prevline(size_t pos){
+    if(pos == 0) return 0;
+    if(pars.type != DISP_TEXT){
+        size_t n = bytesperline();
+        return (pos - 1) / n * n;
+    }
+    size_t lo = (pos - 1 > MAXBACKSCAN) ? pos - 1 - MAXBACKSCAN : 0;
+    const uint8_t *nl = memrchr(data + lo, '\n', pos - 1 - lo);
+    size_t start = nl ? (size_t)(nl - data) + 1 : lo;
+    while(1){ // format paragraph until `pos`
+        size_t next = viewline(start);
+        if(next >= pos || next == start) return start;
+        start = next;
+    }
+}
+
+static void redisplay(){
+    werase(view_win);
+    size_t pos = top;
+    int nlines = LINES - 1;
+    for(int i = 0; i < nlines && pos < datalen; ++i){
+        size_t next = viewline(pos);
+        mvwprintw(view_win, i, 0, "%s", line.buf);
+        if(next == pos) break;
+        pos = next;
+    }
+    bottom = pos;
+    wnoutrefresh(view_win);
+    werase(status_win);
+    wattron(status_win, COLOR_PAIR(MODE_NO));
+    wprintw(status_win, "%s ", pars.type == DISP_TEXT ? "TEXT" : (pars.type == DISP_RAW ? "RAW" : "HEX"));
+    wattroff(status_win, COLOR_PAIR(MODE_NO));
+    wprintw(status_win, "VIEW (F1 - help) %s, offset %zd of %zd (%d%%)", filename, top, datalen,
+            datalen ? (int)(100. * bottom / datalen) : 100);
+    wnoutrefresh(status_win);
+    doupdate();
+}
+
+// set window sizes & line width
+static void resize(){
+    if(LINES > 1){
+        wresize(view_win, LINES - 1, COLS);
+        wresize(status_win, 1, COLS);
+        mvwin(status_win, LINES - 1, 0);
+    }
+    pars.cols = COLS;
+    pars.linelen = fmt_linelen(pars.type, COLS);
+    if(top < datalen) top = prevline(top + 1); // start of line with `top`
+    else top = prevline(datalen);
+    redisplay();
+}
+
+static void scrolldown(size_t N){
+    for(size_t i = 0; i < N && bottom < datalen; ++i){
+        top = viewline(top);
+        bottom = viewline(bottom);
+    }
+    redisplay();
+}
+
+static void scrollup(size_t N){
+    for(size_t i = 0; i < N && top; ++i) top = prevline(top);
+    redisplay();
+}
+
+// show last page
+static void gotoend(){
+    top = datalen;
+    scrollup(LINES - 1);
+}
+
+/**
+ * @brief ViewerStop - restore terminal and unmap file
+ */
+void ViewerStop(){
+    if(view_win){
+        delwin(view_win);
+        delwin(status_win);
+        view_win = status_win = NULL;
+        endwin();
+    }
+    if(data) munmap((void*)data, datalen);
+    data = NULL;
+    datalen = 0;
+}
+
+/**
+ * @brief ViewFile - show file in TEXT, RAW or HEX mode without device
+ * @param path - file name
+ * @return FALSE if failed
+ */
+int ViewFile(const char *path){
+    if(!path) return FALSE;
+    int fd = open(path, O_RDONLY);
+    if(fd < 0){
+        WARN(_("Can't open %s"), path);
+        return FALSE;
+    }
+    struct stat st;
+    if(fstat(fd, &st) || !S_ISREG(st.st_mode)){
+        WARNX(_("%s isn't a regular file"), path);
+        close(fd);
+        return FALSE;
+    }
+    datalen = st.st_size;
+    if(datalen){
+        void *m = mmap(NULL, datalen, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(m == MAP_FAILED){
+            WARN("mmap()");
+            close(fd);
+            datalen = 0;
+            return FALSE;
+        }
+        data = m;
+    }
+    close(fd);
+    filename = path;
+    pars.utf8 = (0 == strcmp(nl_langinfo(CODESET), "UTF-8"));
+    if(!initscr()){
+        ViewerStop();
+        WARNX(_("Failed to initialize ncurses"));
+        return FALSE;
+    }
+    raw(); // ^C and ^D are keys here
+    noecho();
+    nonl();
+    curs_set(0);
+    view_win = newwin(LINES > 1 ? LINES - 1 : 1, COLS, 0, 0);
+    status_win = newwin(1, COLS, LINES > 1 ? LINES - 1 : 0, 0);
+    keypad(status_win, TRUE);
+    if(has_colors()){
+        start_color();
+        use_default_colors();
+        init_pair(STATUS_NO, COLOR_WHITE, COLOR_BLUE);
+        init_pair(MODE_NO, 1, COLOR_BLUE);
+        wbkgd(status_win, COLOR_PAIR(STATUS_NO));
+    }else wbkgd(status_win, A_STANDOUT);
+    mousemask(BUTTON4_PRESSED|BUTTON5_PRESSED, NULL);
+    resize();
+    MEVENT event;
+    int quit = FALSE;
+    while(!quit){
+        int c = wgetch(status_win);
+        disptype dt = DISP_UNCHANGED;
+        switch(c){
+            case KEY_F(1):
+                popup_msg(view_win, help);
+                redisplay();
+            break;
+            case KEY_F(2): dt = DISP_TEXT; break;
+            case KEY_F(3): dt = DISP_RAW; break;
+            case KEY_F(4): dt = DISP_HEX; break;
+            case KEY_UP: scrollup(1); break;
+            case KEY_DOWN: scrolldown(1); break;
+            case KEY_PPAGE: scrollup((2*LINES)/3); break;
+            case KEY_NPAGE: scrolldown((2*LINES)/3); break;
+            case 'h':
+            case KEY_HOME:
+                top = 0;
+                redisplay();
+            break;
+            case 'e':
+            case KEY_END: gotoend(); break;
+            case KEY_MOUSE:
+                if(getmouse(&event) == OK){
+                    if(event.bstate & BUTTON4_PRESSED) scrollup(1); // wheel up
+                    else if(event.bstate & BUTTON5_PRESSED) scrolldown(1); // wheel down
+                }
+            break;
+            case KEY_RESIZE: resize(); break;
+            case 'q':
+            case 'Q':
+            case CTRL('C'):
+            case CTRL('D'):
+                quit = TRUE;
+            break;
+            default:
+            break;
+        }
+        if(dt != DISP_UNCHANGED && dt != pars.type){
+            pars.type = dt;
+            resize(); // new line width; stay on the same place
+        }
+    }
+    ViewerStop();
+    return TRUE;
+}
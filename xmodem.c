@@ -0,0 +1,491 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <libgen.h> // basename
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "checksum.h"
+#include "dbg.h"
+#include "ncurses_and_readline.h"
+#include "ttysocket.h"
+#include "xmodem.h"
+
+// protocol symbols
+#define SOH     (0x01)
+#define STX     (0x02)
+#define EOT     (0x04)
+#define ACK     (0x06)
+#define NAK     (0x15)
+#define CAN     (0x18)
+#define SUB     (0x1A)
+#define CRCCHR  ('C')
+
+// max amount of retries for one block
+#define MAXRETRIES      (10)
+// timeouts, ms
+#define STARTTMOUT      (60000)
+#define ACKTMOUT        (10000)
+#define BYTETMOUT       (1000)
+#define HANDSHAKEINTERVAL (3000)
+// max size of block with header and CRC
+#define MAXPKTSZ        (1024 + 5)
+// interval of progress updating, seconds
+#define PROGRESS_INTERVAL   (0.2)
+
+static const char *protonames[] = {"XMODEM", "XMODEM-1K", "YMODEM"};
+
+typedef struct{
+    xmodem_proto proto; // protocol
+    int send;           // TRUE for sending
+    char *path;         // file name (or directory to store YMODEM files)
+    char *curname;      // name of current file
+    size_t total;       // file size (0 if unknown)
+    size_t done;        // bytes transferred
+    int retries;        // total amount of retransmissions
+    double t0;          // start time
+} xmjob;
+
+static xmjob *job = NULL;
+static volatile int stopflag = 0;
+static pthread_mutex_t jobmutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint16_t crc16(const uint8_t *data, int len){
+    return (uint16_t)cs_calc(CS_XMODEM, data, len);
+}
+
+static uint8_t checksum(const uint8_t *data, int len){
+    return (uint8_t)cs_calc(CS_SUM, data, len);
+}
+
+static void progress(int force){
+    static double tlast = 0.;
+    double t = dtime();
+    if(!force && t - tlast < PROGRESS_INTERVAL) return;
+    tlast = t;
+    double dt = t - job->t0, speed = (dt > 0.) ? job->done / dt : 0.;
+    if(job->total)
+        set_status("%s %s %s: %zd/%zd (%d%%) %.1f kB/s, retries: %d", protonames[job->proto], job->send ? "send" : "recv",
+            job->curname ? job->curname : "", job->done, job->total, (int)(100. * job->done / job->total), speed / 1024., job->retries);
+    else
+        set_status("%s %s %s: %zd %.1f kB/s, retries: %d", protonames[job->proto], job->send ? "send" : "recv",
+            job->curname ? job->curname : "", job->done, speed / 1024., job->retries);
+}
+
+/**
+ * @brief readn - read exactly `n` bytes
+ * @return FALSE if timeout or error
+ */
+static int readn(uint8_t *buf, int n, int tmout){
+    while(n > 0 && !stopflag){
+        int l = ReadRaw(buf, n, tmout);
+        if(l < 1) return FALSE;
+        buf += l; n -= l;
+    }
+    return (n == 0);
+}
+
+// return next byte, -1 if timeout or -2 if error
+static int getbyte(int tmout){
+    uint8_t c;
+    int l = ReadRaw(&c, 1, tmout);
+    if(l == 0) return -1;
+    if(l < 0) return -2;
+    return c;
+}
+
+static int putbyte(uint8_t c){
+    return (SendData(&c, 1) == 1);
+}
+
+// drop all incoming data until line is silent
+static void purge(){
+    uint8_t buf[256];
+    double t0 = dtime();
+    while(ReadRaw(buf, sizeof(buf), 100) > 0 && dtime() - t0 < 3.);
+}
+
+// send CANs to stop transfer
+static void cancel(){
+    static const uint8_t can[] = {CAN, CAN, CAN, CAN, CAN, CAN, CAN, CAN};
+    SendData(can, sizeof(can));
+}
+
+/**
+ * @brief waitresponse - wait for one of protocol symbols (ACK, NAK, CAN or 'C'); all other would be ignored
+ * @param tmout - timeout, ms
+ * @return symbol, -1 if timeout or -2 if error or double CAN
+ */
+static int waitresponse(int tmout){
+    double tend = dtime() + tmout / 1000.;
+    while(!stopflag){
+        int rest = (int)((tend - dtime()) * 1000.);
+        if(rest < 1) return -1;
+        int c = getbyte(rest);
+        if(c < 0) return c;
+        switch(c){
+            case CAN:
+                if(getbyte(BYTETMOUT) == CAN) return -2;
+            break;
+            case ACK:
+            case NAK:
+            case CRCCHR:
+                return c;
+            default:
+            break;
+        }
+    }
+    return -2;
+}
+
+/**
+ * @brief waitstart - wait for receiver to start transfer
+ * @param crc (o) - TRUE if receiver wants CRC
+ * @return error text or NULL
+ */
+static const char *waitstart(int *crc){
+    int c = waitresponse(STARTTMOUT);
+    if(c == CRCCHR) *crc = TRUE;
+    else if(c == NAK) *crc = FALSE;
+    else if(c == -1) return "no answer from receiver";
+    else return "cancelled";
+    return NULL;
+}
+
+/**
+ * @brief sendblock - send one block and wait for ACK (retransmit if need)
+ * @param blkno - number of block
+ * @param data - data (should be exactly `size` bytes)
+ * @param size - 128 or 1024
+ * @param crc - TRUE for CRC16, FALSE for checksum
+ * @return error text or NULL
+ */
+static const char *sendblock(uint8_t blkno, const uint8_t *data, int size, int crc){
+    uint8_t pkt[MAXPKTSZ];
+    pkt[0] = (size == 1024) ? STX : SOH;
+    pkt[1] = blkno;
+    pkt[2] = ~blkno;
+    memcpy(pkt + 3, data, size);
+    int n = size + 3;
+    if(crc){
+        uint16_t c = crc16(data, size);
+        pkt[n++] = c >> 8;
+        pkt[n++] = c & 0xff;
+    }else pkt[n++] = checksum(data, size);
+    for(int retry = 0; retry < MAXRETRIES && !stopflag; ++retry){
+        if(SendData(pkt, n) != n) return "can't send data";
+        int r = waitresponse(ACKTMOUT);
+        if(r == ACK) return NULL;
+        if(r == -2) return stopflag ? "stopped" : "cancelled by receiver";
+        DBG("block %d: got %d instead of ACK", blkno, r);
+        ++job->retries;
+        progress(0);
+    }
+    return stopflag ? "stopped" : "too many retries";
+}
+
+// send EOT until ACK
+static const char *sendeot(){
+    for(int retry = 0; retry < MAXRETRIES && !stopflag; ++retry){
+        if(!putbyte(EOT)) return "can't send data";
+        int r = waitresponse(ACKTMOUT);
+        if(r == ACK) return NULL;
+        if(r == -2) return "cancelled";
+    }
+    return "no ACK for EOT";
+}
+
+static const char *xsend(){
+    int fd = open(job->path, O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st)){
+        if(fd > -1) close(fd);
+        return "can't open file";
+    }
+    job->total = st.st_size;
+    job->curname = strdup(job->path);
+    int crc = TRUE, blksz = (job->proto == XM_CRC) ? 128 : 1024;
+    uint8_t buf[1024];
+    const char *err = waitstart(&crc);
+    job->t0 = dtime(); // don't count handshake time
+    if(!err && job->proto == XM_YMODEM){ // header block: name, size and mtime
+        char *tmp = strdup(job->path);
+        memset(buf, 0, sizeof(buf));
+        int l = snprintf((char*)buf, sizeof(buf) - 32, "%s", basename(tmp)); // name is not longer than NAME_MAX
+        l += 1 + snprintf((char*)buf + l + 1, sizeof(buf) - l - 1, "%zd %lo %o", job->total, (long)st.st_mtime, st.st_mode & 0777);
+        FREE(tmp);
+        if(!crc) err = "YMODEM receiver should use CRC";
+        else if(!(err = sendblock(0, buf, (l < 128) ? 128 : 1024, TRUE))) err = waitstart(&crc); // 1K block for long name
+    }
+    uint8_t blkno = 1;
+    while(!err && job->done < job->total && !stopflag){
+        size_t rest = job->total - job->done;
+        int size = blksz;
+        if(rest <= 128) size = 128; // don't send 1K block with a lot of padding
+        ssize_t got = read(fd, buf, ((size_t)size < rest) ? (size_t)size : rest);
+        if(got < 1){ err = "can't read file"; break; }
+        if(got < size) memset(buf + got, SUB, size - got);
+        if((err = sendblock(blkno++, buf, size, crc))) break;
+        job->done += got;
+        progress(0);
+    }
+    close(fd);
+    if(!err && stopflag) err = "stopped";
+    if(!err) err = sendeot();
+    if(!err && job->proto == XM_YMODEM){ // empty header: end of batch
+        memset(buf, 0, 128);
+        if(!(err = waitstart(&crc))) err = sendblock(0, buf, 128, TRUE);
+    }
+    if(err) cancel();
+    return err;
+}
+
+/**
+ * @brief getblock - receive block after its header symbol
+ * @param hdr - SOH or STX
+ * @param crc - TRUE if CRC used
+ * @param blkno (o) - block number
+ * @param data (o) - data
+ * @return size of block or 0 if failed
+ */
+static int getblock(int hdr, int crc, uint8_t *blkno, uint8_t *data){
+    uint8_t pkt[MAXPKTSZ];
+    int size = (hdr == STX) ? 1024 : 128, n = size + 2 + (crc ? 2 : 1);
+    if(!readn(pkt, n, BYTETMOUT)) return 0;
+    if((uint8_t)(pkt[0] + pkt[1]) != 0xff) return 0;
+    if(crc){
+        uint16_t c = crc16(pkt + 2, size);
+        if(pkt[size + 2] != (c >> 8) || pkt[size + 3] != (c & 0xff)) return 0;
+    }else if(pkt[size + 2] != checksum(pkt + 2, size)) return 0;
+    *blkno = pkt[0];
+    memcpy(data, pkt + 2, size);
+    return size;
+}
+
+// open next file of YMODEM batch by header block; return -1 if error or end of batch (`*end` is set)
+static int yheader(const uint8_t *data, int size, size_t *fsize, int *end){
+    char name[1025];
+    memcpy(name, data, size);
+    name[size] = 0;
+    *end = !*name;
+    if(*end) return -1;
+    const char *sz = name + strlen(name) + 1;
+    *fsize = (sz < name + size) ? strtoull(sz, NULL, 10) : 0;
+    char *fname = basename(name); // don't allow sender to write anywhere
+    char *path = MALLOC(char, strlen(job->path) + strlen(fname) + 2);
+    sprintf(path, "%s/%s", job->path, fname);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    FREE(job->curname);
+    job->curname = path;
+    job->total = *fsize;
+    job->done = 0;
+    return fd;
+}
+
+static const char *xrecv(){
+    int ymodem = (job->proto == XM_YMODEM), crc = TRUE, fd = -1;
+    size_t fsize = 0; // YMODEM file size
+    uint8_t expected = ymodem ? 0 : 1, data[1024];
+    const char *err = NULL;
+    if(!ymodem){
+        if((fd = open(job->path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) return "can't create file";
+        job->curname = strdup(job->path);
+    }
+    // handshake: 'C' every 3 seconds, fallback to checksum for XMODEM
+    int started = FALSE, errors = 0, hdr = -1;
+    for(int i = 0; i < 10 && !stopflag; ++i){
+        if(!ymodem && i > 3) crc = FALSE;
+        if(!putbyte(crc ? CRCCHR : NAK)){ err = "can't send data"; goto ret; }
+        hdr = getbyte(HANDSHAKEINTERVAL);
+        if(hdr == SOH || hdr == STX){ started = TRUE; break; }
+        if(hdr == -2){ err = "device disconnected"; goto ret; }
+    }
+    if(!started){ err = stopflag ? "stopped" : "no answer from sender"; goto ret; }
+    job->t0 = dtime(); // don't count handshake time
+    while(!stopflag){
+        if(hdr < 0){
+            hdr = getbyte(ACKTMOUT);
+            if(hdr == -2){ err = "device disconnected"; break; }
+        }
+        uint8_t blkno;
+        int size;
+        switch(hdr){
+            case SOH:
+            case STX:
+                size = getblock(hdr, crc, &blkno, data);
+                if(!size){
+                    ++job->retries;
+                    purge();
+                    putbyte(NAK);
+                    break;
+                }
+                if(blkno == (uint8_t)(expected - 1) && !(ymodem && expected == 1 && fd < 0)){ // repeated block
+                    putbyte(ACK);
+                    break;
+                }
+                if(blkno != expected){
+                    err = "wrong block number";
+                    cancel();
+                    goto ret;
+                }
+                if(ymodem && expected == 0 && fd < 0){ // header
+                    int end;
+                    fd = yheader(data, size, &fsize, &end);
+                    putbyte(ACK);
+                    if(end) goto ret; // end of batch
+                    if(fd < 0){ err = "can't create file"; cancel(); goto ret; }
+                    putbyte(CRCCHR);
+                    expected = 1;
+                    break;
+                }
+                if(ymodem && fsize && job->done + size > fsize) size = fsize - job->done; // cut padding
+                if(write(fd, data, size) != size){
+                    err = "can't write file";
+                    cancel();
+                    goto ret;
+                }
+                job->done += size;
+                ++expected;
+                errors = 0;
+                putbyte(ACK);
+                progress(0);
+            break;
+            case EOT:
+                putbyte(ACK);
+                if(!ymodem) goto ret;
+                close(fd);
+                fd = -1;
+                expected = 0;
+                progress(1);
+                putbyte(CRCCHR); // ask for next file header
+            break;
+            case CAN:
+                if(getbyte(BYTETMOUT) == CAN){ err = "cancelled by sender"; goto ret; }
+            break;
+            default: // timeout or garbage
+                if(++errors > MAXRETRIES){
+                    err = "too many errors";
+                    cancel();
+                    goto ret;
+                }
+                ++job->retries;
+                purge();
+                putbyte(NAK);
+            break;
+        }
+        hdr = -1;
+    }
+    if(stopflag){
+        err = "stopped";
+        cancel();
+    }
+ret:
+    if(fd > -1) close(fd);
+    return err;
+}
+
+static void *xmodem_thread(_U_ void *arg){
+    DBG("Start %s %s", protonames[job->proto], job->send ? "sending" : "receiving");
+    const char *err = job->send ? xsend() : xrecv();
+    purge();
+    ReleaseDevice();
+    progress(1);
+    double dt = dtime() - job->t0;
+    if(err) set_status("%s: %s (%zd bytes transferred)", protonames[job->proto], err, job->done);
+    else set_status("%s: %s %s OK, %zd bytes in %.2fs (%.1f kB/s), retries: %d", protonames[job->proto],
+                    job->curname ? job->curname : "", job->send ? "sent" : "received", job->done, dt,
+                    (dt > 0.) ? job->done / dt / 1024. : 0., job->retries);
+    pthread_mutex_lock(&jobmutex);
+    FREE(job->path);
+    FREE(job->curname);
+    FREE(job);
+    pthread_mutex_unlock(&jobmutex);
+    return NULL;
+}
+
+static int xmodem_start(xmodem_proto proto, int send, const char *path){
+    pthread_mutex_lock(&jobmutex);
+    if(job){
+        pthread_mutex_unlock(&jobmutex);
+        set_status("Previous transfer isn't over");
+        return FALSE;
+    }
+    if(!ClaimDevice()){
+        pthread_mutex_unlock(&jobmutex);
+        set_status("Device is busy");
+        return FALSE;
+    }
+    job = MALLOC(xmjob, 1);
+    job->proto = proto;
+    job->send = send;
+    job->path = strdup(path);
+    job->t0 = dtime();
+    stopflag = 0;
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, xmodem_thread, NULL)){
+        ReleaseDevice();
+        FREE(job->path);
+        FREE(job);
+        pthread_mutex_unlock(&jobmutex);
+        set_status("Can't run transfer thread");
+        return FALSE;
+    }
+    pthread_detach(thread);
+    pthread_mutex_unlock(&jobmutex);
+    set_status("%s: waiting for %s", protonames[proto], send ? "receiver" : "sender");
+    return TRUE;
+}
+
+/**
+ * @brief XmodemSend - start sending file by XMODEM/YMODEM
+ * @param proto - protocol
+ * @param path - file name
+ * @return FALSE if can't start
+ */
+int XmodemSend(xmodem_proto proto, const char *path){
+    if(!path) return FALSE;
+    return xmodem_start(proto, TRUE, path);
+}
+
+/**
+ * @brief XmodemReceive - start receiving file by XMODEM/YMODEM
+ * @param proto - protocol
+ * @param path - file name for XMODEM or directory for YMODEM (NULL - current)
+ * @return FALSE if can't start
+ */
+int XmodemReceive(xmodem_proto proto, const char *path){
+    if(!path){
+        if(proto != XM_YMODEM) return FALSE;
+        path = ".";
+    }
+    return xmodem_start(proto, FALSE, path);
+}
+
+void XmodemStop(){
+    stopflag = 1;
+}
+
+int XmodemActive(){
+    pthread_mutex_lock(&jobmutex);
+    int r = (job != NULL);
+    pthread_mutex_unlock(&jobmutex);
+    return r;
+}
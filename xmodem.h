@@ -0,0 +1,34 @@
+/*
+ * This file is part of the ttyterm project.
+ * Copyright 2024 Edward V. Emelianov <edward.emelianoff@gmail.com>.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#ifndef XMODEM_H__
+#define XMODEM_H__
+
+typedef enum{
+    XM_CRC,     // XMODEM-CRC: 128-byte blocks
+    XM_1K,      // XMODEM-1K: 1024-byte blocks
+    XM_YMODEM   // YMODEM batch: header block with file name and size + 1024-byte blocks
+} xmodem_proto;
+
+int XmodemSend(xmodem_proto proto, const char *path);
+int XmodemReceive(xmodem_proto proto, const char *path);
+void XmodemStop();
+int XmodemActive();
+
+#endif // XMODEM_H__